@@ -0,0 +1,1132 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime(), posix_fadvise() */
+
+#include "leptjson.h"
+
+#include <stdarg.h> /* va_list */
+#include <stdio.h>  /* printf(), vsnprintf() */
+#include <stdlib.h> /* malloc(), free() */
+#include <string.h> /* memcmp(), strcmp(), strlen(), strcpy() */
+#include <time.h>   /* clock_gettime() */
+#include <fcntl.h>  /* open(), posix_fadvise() */
+#include <unistd.h> /* close(), fork() */
+#include <sys/resource.h> /* getrusage() */
+#include <sys/wait.h>     /* waitpid() */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#define BENCH_HAVE_MALLINFO
+#include <malloc.h> /* mallinfo2() */
+#endif
+
+#define NEW(type) ((type*)malloc(sizeof(type)))
+
+#define BENCH_PASSES 20
+
+static volatile double sink;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* the node layout of lept_array before it became contiguous */
+typedef struct list_item_s {
+    struct list_item_s* next;
+    lept_value* value;
+} list_item;
+
+static void bench_array_iterate(size_t n) {
+    lept_value v;
+    lept_array* a = lept_new_array();
+    list_item* head = NULL;
+    list_item** tail = &head;
+    list_item* item;
+    double begin, list_time, vector_time, sum;
+    size_t i;
+    int pass;
+
+    v.type = LEPT_ARRAY;
+    v.value.a = a;
+    lept_reserve_array(a, n);
+    for (i = 0; i < n; ++i) {
+        lept_value* e = lept_pushback_array_element(a);
+        e->type = LEPT_NUMBER;
+        e->value.n = (double)i;
+        /* allocated in parse order, as the list parser did */
+        item = NEW(list_item);
+        item->value = lept_new_value();
+        item->value->type = LEPT_NUMBER;
+        item->value->value.n = (double)i;
+        item->next = NULL;
+        *tail = item;
+        tail = &item->next;
+    }
+
+    begin = now();
+    for (pass = 0; pass < BENCH_PASSES; ++pass) {
+        sum = 0.0;
+        for (item = head; item; item = item->next) {
+            sum += lept_get_number(item->value);
+        }
+        sink = sum;
+    }
+    list_time = now() - begin;
+
+    begin = now();
+    for (pass = 0; pass < BENCH_PASSES; ++pass) {
+        sum = 0.0;
+        for (i = 0; i < a->len; ++i) {
+            sum += lept_get_number(&a->items[i]);
+        }
+        sink = sum;
+    }
+    vector_time = now() - begin;
+
+    printf("array_iterate/%lu list:   %8.3f ns/element\n",
+           (unsigned long)n, list_time * 1e9 / (n * BENCH_PASSES));
+    printf("array_iterate/%lu vector: %8.3f ns/element (%.1fx)\n",
+           (unsigned long)n, vector_time * 1e9 / (n * BENCH_PASSES), list_time / vector_time);
+
+    while (head) {
+        item = head->next;
+        lept_free_value(head->value);
+        free(head);
+        head = item;
+    }
+    lept_free_value_on_stack(&v);
+}
+
+/* what lept_find_object_value() does for objects without an index */
+static lept_value* find_linear(const lept_object* o, const char* key, size_t keylen) {
+    lept_object_node* node;
+    for (node = o->nodes; node; node = node->next) {
+        if (node->key->len == keylen && memcmp(node->key->str, key, keylen) == 0) {
+            return &node->value;
+        }
+    }
+    return NULL;
+}
+
+static void bench_object_find(int n) {
+    lept_value v;
+    char* json = (char*)malloc(n * 32 + 3);
+    char* p = json;
+    char (*keys)[24] = (char(*)[24])malloc(n * sizeof(*keys));
+    size_t lookups = 0;
+    double begin, linear_time, hashed_time, sum;
+    int i, round;
+    int rounds = 4000000 / n;
+
+    *p++ = '{';
+    for (i = 0; i < n; ++i) {
+        sprintf(keys[i], "field_name_%d", i);
+        p += sprintf(p, "%s\"%s\":%d", i == 0 ? "" : ",", keys[i], i);
+    }
+    *p++ = '}';
+    *p = '\0';
+    lept_parse(&v, json);
+
+    sum = 0.0;
+    begin = now();
+    for (round = 0; round < rounds; ++round) {
+        for (i = 0; i < n; ++i) {
+            sum += lept_get_number(find_linear(lept_get_object(&v), keys[i], strlen(keys[i])));
+        }
+    }
+    linear_time = now() - begin;
+
+    lept_index_object(lept_get_object(&v));
+    begin = now();
+    for (round = 0; round < rounds; ++round) {
+        for (i = 0; i < n; ++i) {
+            sum += lept_get_number(lept_find_object_value(&v, keys[i], strlen(keys[i])));
+        }
+    }
+    hashed_time = now() - begin;
+    sink = sum;
+
+    lookups = (size_t)rounds * n;
+    printf("object_find/%-4d linear: %7.2f ns/lookup  hashed: %7.2f ns/lookup  %s\n", n,
+           linear_time * 1e9 / lookups, hashed_time * 1e9 / lookups,
+           linear_time < hashed_time ? "linear" : "hashed");
+
+    lept_free_value_on_stack(&v);
+    free(keys);
+    free(json);
+}
+
+static void bench_stringify(int n) {
+    lept_value v;
+    lept_buffer b;
+    char* json = (char*)malloc(n * 128 + 3);
+    char* p = json;
+    char number[32];
+    double begin, compact_time, pretty_time, grisu_time, sprintf_time;
+    size_t compact_len, pretty_len, i;
+    int pass;
+
+    *p++ = '[';
+    for (i = 0; i < (size_t)n; ++i) {
+        p += sprintf(p, "%s{\"id\":%lu,\"name\":\"user %lu\\tx\",\"score\":%.17g,"
+                        "\"tags\":[\"a\",\"b\"],\"active\":true}",
+                     i == 0 ? "" : ",", (unsigned long)i, (unsigned long)i, i * 1.37);
+    }
+    *p++ = ']';
+    *p = '\0';
+    lept_parse(&v, json);
+    lept_buffer_init(&b);
+
+    begin = now();
+    for (pass = 0; pass < BENCH_PASSES; ++pass) {
+        lept_buffer_reset(&b);
+        lept_stringify(&v, &b);
+    }
+    compact_time = now() - begin;
+    compact_len = b.len;
+
+    begin = now();
+    for (pass = 0; pass < BENCH_PASSES; ++pass) {
+        lept_buffer_reset(&b);
+        lept_stringify_pretty(&v, &b);
+    }
+    pretty_time = now() - begin;
+    pretty_len = b.len;
+
+    printf("stringify/%d compact: %8.1f MB/s\n", n, compact_len * BENCH_PASSES / compact_time / 1e6);
+    printf("stringify/%d pretty:  %8.1f MB/s\n", n, pretty_len * BENCH_PASSES / pretty_time / 1e6);
+
+    /* numbers alone, against the usual printf round trip format */
+    begin = now();
+    for (i = 0; i < (size_t)n * 10; ++i) {
+        lept_value d;
+        d.type = LEPT_NUMBER;
+        d.value.n = i * 1.37;
+        lept_buffer_reset(&b);
+        lept_stringify(&d, &b);
+    }
+    grisu_time = now() - begin;
+    begin = now();
+    for (i = 0; i < (size_t)n * 10; ++i) {
+        sprintf(number, "%.17g", i * 1.37);
+    }
+    sprintf_time = now() - begin;
+    printf("stringify_number grisu2: %7.1f ns  sprintf(%%.17g): %7.1f ns\n",
+           grisu_time * 1e9 / (n * 10), sprintf_time * 1e9 / (n * 10));
+
+    lept_buffer_free(&b);
+    lept_free_value_on_stack(&v);
+    free(json);
+}
+
+/* the previous lept_parse_file(): a terminated full copy of the file */
+static int parse_file_copy(lept_value* v, const char* path) {
+    FILE* file = fopen(path, "rb");
+    long size;
+    char* buffer;
+    int ret;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    buffer = (char*)malloc(size + 1);
+    buffer[fread(buffer, 1, size, file)] = '\0';
+    fclose(file);
+    ret = lept_parse(v, buffer);
+    free(buffer);
+    return ret;
+}
+
+/* drop the file from the page cache so the next read goes to the device */
+static void evict_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static double time_parse_file(int (*parse)(lept_value*, const char*), const char* path, int cold) {
+    lept_value v;
+    double begin, best = 1e30, t;
+    int pass;
+    for (pass = 0; pass < 5; ++pass) {
+        if (cold) {
+            evict_file(path);
+        }
+        begin = now();
+        parse(&v, path);
+        t = now() - begin;
+        lept_free_value_on_stack(&v);
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+static void bench_parse_file(int n) {
+    const char* path = "leptjson_bench.json";
+    FILE* file = fopen(path, "wb");
+    double size;
+    int i, cold;
+    fputc('[', file);
+    for (i = 0; i < n; ++i) {
+        fprintf(file, "%s{\"id\":%d,\"name\":\"user %d\",\"score\":%.17g,\"tags\":[\"a\",\"b\"]}",
+                i == 0 ? "" : ",", i, i, i * 1.37);
+    }
+    fputc(']', file);
+    size = ftell(file) / 1e6;
+    fclose(file);
+    for (cold = 0; cold <= 1; ++cold) {
+        printf("parse_file/%.0fMB %s: mmap %8.1f MB/s  read+copy %8.1f MB/s\n", size, cold ? "cold" : "warm",
+               size / time_parse_file(lept_parse_file, path, cold),
+               size / time_parse_file(parse_file_copy, path, cold));
+    }
+    remove(path);
+}
+
+static int count_line(void* ctx, size_t offset, lept_value* v, int ret) {
+    (void)ctx;
+    (void)offset;
+    sink += ret == LEPT_PARSE_OK && v->type == LEPT_OBJECT;
+    return 0;
+}
+
+static void bench_ndjson(int n) {
+    char* buf = (char*)malloc((size_t)n * 160);
+    char* p = buf;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double begin, t, base = 0;
+    int i, nthreads, ordered;
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "{\"ts\":%d,\"level\":\"info\",\"msg\":\"request %d done\",\"ms\":%.3f,"
+                        "\"tags\":[\"a\",\"b\"],\"ok\":true}\n", 1600000000 + i, i, i * 0.731);
+    }
+    for (ordered = 0; ordered <= 1; ++ordered) {
+        for (nthreads = 1; nthreads <= cpus * 2; nthreads *= 2) {
+            begin = now();
+            lept_parse_ndjson(buf, p - buf, nthreads, ordered ? LEPT_NDJSON_ORDERED : 0, count_line, NULL);
+            t = now() - begin;
+            base = nthreads == 1 ? t : base;
+            printf("ndjson/%d %s threads %2d: %8.1f MB/s  speedup %4.2f (%ld cpus)\n", n,
+                   ordered ? "ordered  " : "unordered", nthreads, (p - buf) / t / 1e6, base / t, cpus);
+        }
+    }
+    free(buf);
+}
+
+static void bench_parallel(int n) {
+    char* json = (char*)malloc((size_t)n * 160);
+    char* p = json;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double begin, t, serial, size;
+    uint32_t* index;
+    size_t count;
+    lept_value v;
+    int i, nthreads;
+    *p++ = '[';
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s{\"id\":%d,\"name\":\"user %d\",\"score\":%.17g,\"tags\":[\"a\",\"b\"],\"ok\":true}",
+                     i == 0 ? "" : ",", i, i, i * 1.37);
+    }
+    *p++ = ']';
+    size = (p - json) / 1e6;
+
+    begin = now();
+    index = lept_find_structurals(json, p - json, &count);
+    t = now() - begin;
+    free(index);
+    printf("parallel/%.0fMB stage 1: %8.1f MB/s, %lu structurals\n", size, size / t, (unsigned long)count);
+
+    begin = now();
+    lept_parse_n(&v, json, p - json);
+    serial = now() - begin;
+    lept_free_value_on_stack(&v);
+    printf("parallel/%.0fMB serial:     %8.1f MB/s\n", size, size / serial);
+    for (nthreads = 1; nthreads <= cpus * 2; nthreads *= 2) {
+        begin = now();
+        lept_parse_parallel(&v, json, p - json, nthreads);
+        t = now() - begin;
+        lept_free_value_on_stack(&v);
+        printf("parallel/%.0fMB threads %2d: %8.1f MB/s  speedup %4.2f (%ld cpus)\n",
+               size, nthreads, size / t, serial / t, cpus);
+    }
+    free(json);
+}
+
+/* read 5 fields of a large document, parsing eagerly or lazily */
+static void bench_lazy(int n) {
+    static const lept_parse_options eager = { 0, NULL }, lazy = { LEPT_PARSE_LAZY, NULL };
+    const lept_parse_options* opts[] = { &eager, &lazy };
+    const char* names[] = { "eager", "lazy" };
+    char* json = (char*)malloc((size_t)n * 160 + 100);
+    char* p = json;
+    const lept_value* records;
+    double begin, t, size, sum;
+    lept_value v;
+    int i;
+    p += sprintf(p, "{\"meta\":{\"version\":3,\"count\":%d},\"records\":[", n);
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s{\"id\":%d,\"name\":\"user %d\",\"score\":%.17g,\"tags\":[\"a\",\"b\"],\"ok\":true}",
+                     i == 0 ? "" : ",", i, i, i * 1.37);
+    }
+    p += sprintf(p, "],\"done\":true}");
+    size = (p - json) / 1e6;
+    for (i = 0; i < 2; ++i) {
+        begin = now();
+        lept_parse_opts(&v, json, opts[i]);
+        sum = lept_get_number(lept_find_object_value(lept_find_object_value(&v, "meta", 4), "version", 7));
+        sum += lept_get_number(lept_find_object_value(lept_find_object_value(&v, "meta", 4), "count", 5));
+        records = lept_find_object_value(&v, "records", 7);
+        sum += lept_get_number(lept_find_object_value(lept_get_array_element(records, 0), "id", 2));
+        sum += lept_get_number(lept_find_object_value(lept_get_array_element(records, n - 1), "id", 2));
+        sum += lept_get_type(lept_find_object_value(&v, "done", 4));
+        t = now() - begin;
+        lept_free_value_on_stack(&v);
+        printf("lazy/%.0fMB %-5s 5 fields: %8.1f MB/s (%.0f)\n", size, names[i], size / t, sum);
+    }
+    free(json);
+}
+
+/* pull fields out of a large document with a query or through a full parse */
+static void bench_query(int n) {
+    static const char* const fields[] = { "/meta/version", "/records/0/id", "/done" };
+    static const char* const column[] = { "/records/*/score" };
+    char* json = (char*)malloc((size_t)n * 160 + 100);
+    char* p = json;
+    lept_query* q;
+    lept_value v, results[3];
+    double begin, t, size, sum;
+    int i;
+    p += sprintf(p, "{\"meta\":{\"version\":3,\"count\":%d},\"records\":[", n);
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s{\"id\":%d,\"name\":\"user %d\",\"score\":%.17g,\"tags\":[\"a\",\"b\"],\"ok\":true}",
+                     i == 0 ? "" : ",", i, i, i * 1.37);
+    }
+    p += sprintf(p, "],\"done\":true}");
+    size = (p - json) / 1e6;
+
+    begin = now();
+    lept_parse_n(&v, json, p - json);
+    sum = lept_get_number(lept_find_object_value(lept_find_object_value(&v, "meta", 4), "version", 7));
+    t = now() - begin;
+    lept_free_value_on_stack(&v);
+    printf("query/%.0fMB parse and find: %8.1f MB/s (%.0f)\n", size, size / t, sum);
+
+    q = lept_query_compile(fields, 3);
+    begin = now();
+    lept_query_run(q, json, p - json, results);
+    t = now() - begin;
+    sum = lept_get_number(&results[0]) + lept_get_number(&results[1]);
+    for (i = 0; i < 3; ++i) {
+        lept_free_value_on_stack(&results[i]);
+    }
+    lept_query_free(q);
+    printf("query/%.0fMB 3 fields:       %8.1f MB/s (%.0f)\n", size, size / t, sum);
+
+    q = lept_query_compile(column, 1);
+    begin = now();
+    lept_query_run(q, json, p - json, results);
+    t = now() - begin;
+    sum = (double)lept_get_array_size(&results[0]);
+    lept_free_value_on_stack(&results[0]);
+    lept_query_free(q);
+    printf("query/%.0fMB 1 column:       %8.1f MB/s (%.0f)\n", size, size / t, sum);
+    free(json);
+}
+
+/* small documents repeating the same 30 keys, with and without a key pool */
+static void bench_key_pool(int n) {
+    char json[1024];
+    char* p = json;
+    lept_parse_options opts = { 0, NULL, NULL };
+    lept_value v;
+    double begin, t;
+    int i, pass;
+    *p++ = '{';
+    for (i = 0; i < 30; ++i) {
+        p += sprintf(p, "%s\"field_name_%d\":%d", i == 0 ? "" : ",", i, i);
+    }
+    strcpy(p, "}");
+    for (pass = 0; pass < 2; ++pass) {
+        opts.keys = pass == 0 ? NULL : lept_key_pool_new();
+        begin = now();
+        for (i = 0; i < n; ++i) {
+            lept_parse_opts(&v, json, &opts);
+            lept_free_value_on_stack(&v);
+        }
+        t = now() - begin;
+        printf("keys/30 %-6s %8.1f ns/document\n", pass == 0 ? "malloc" : "pool", t * 1e9 / n);
+        if (opts.keys != NULL) {
+            lept_key_pool_free(opts.keys);
+        }
+    }
+}
+
+static double sum_value(const lept_value* v) {
+    const lept_object_node* node;
+    double sum = 0.0;
+    size_t i;
+    switch (lept_get_type(v)) {
+        case LEPT_NUMBER: return lept_get_number(v);
+        case LEPT_STRING: return (double)lept_get_string_length(v);
+        case LEPT_ARRAY:
+            for (i = 0; i < lept_get_array_size(v); ++i) {
+                sum += sum_value(lept_get_array_element(v, i));
+            }
+            return sum;
+        case LEPT_OBJECT:
+            for (node = lept_get_object(v)->nodes; node; node = node->next) {
+                sum += sum_value(&node->value);
+            }
+            return sum;
+        default: return 0.0;
+    }
+}
+
+static double sum_tape(lept_tape_iter it) {
+    lept_tape_iter e;
+    double sum = 0.0;
+    switch (lept_tape_get_type(it)) {
+        case LEPT_NUMBER: return lept_tape_get_number(it);
+        case LEPT_STRING: return (double)lept_tape_get_string_length(it);
+        case LEPT_ARRAY:
+            for (e = lept_tape_first(it); !lept_tape_is_end(e); e = lept_tape_next(e)) {
+                sum += sum_tape(e);
+            }
+            return sum;
+        case LEPT_OBJECT:
+            for (e = lept_tape_first(it); !lept_tape_is_end(e); e = lept_tape_next(e)) {
+                e = lept_tape_next(e); /* skip the key */
+                sum += sum_tape(e);
+            }
+            return sum;
+        default: return 0.0;
+    }
+}
+
+/* decode the same records from JSON text, MessagePack and CBOR */
+static void bench_binary(int n) {
+    int (*encode[])(const lept_value*, lept_buffer*) = { lept_to_msgpack, lept_to_cbor };
+    int (*decode[])(lept_value*, const char*, size_t, const lept_parse_options*) = { lept_from_msgpack, lept_from_cbor };
+    const char* names[] = { "msgpack", "cbor" };
+    char* json = (char*)malloc((size_t)n * 160 + 100);
+    char* p = json;
+    double begin, t, size;
+    lept_buffer b[2];
+    lept_value v;
+    int i;
+    p += sprintf(p, "{\"meta\":{\"version\":3,\"count\":%d},\"records\":[", n);
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s{\"id\":%d,\"name\":\"user %d\",\"score\":%.17g,\"tags\":[\"a\",\"b\"],\"ok\":true}",
+                     i == 0 ? "" : ",", i, i, i * 1.37);
+    }
+    p += sprintf(p, "],\"done\":true}");
+    size = (p - json) / 1e6;
+
+    lept_parse_n(&v, json, p - json);
+    for (i = 0; i < 2; ++i) {
+        lept_buffer_init(&b[i]);
+        begin = now();
+        encode[i](&v, &b[i]);
+        t = now() - begin;
+        printf("binary/%.0fMB %-7s encode: %8.1f MB/s (%.1f MB)\n", size, names[i], size / t, b[i].len / 1e6);
+    }
+    lept_free_value_on_stack(&v);
+    /* decode rates are given against the size of the text */
+    begin = now();
+    lept_parse_n(&v, json, p - json);
+    t = now() - begin;
+    lept_free_value_on_stack(&v);
+    printf("binary/%.0fMB json    decode: %8.1f MB/s\n", size, size / t);
+    for (i = 0; i < 2; ++i) {
+        begin = now();
+        decode[i](&v, b[i].data, b[i].len, NULL);
+        t = now() - begin;
+        lept_free_value_on_stack(&v);
+        lept_buffer_free(&b[i]);
+        printf("binary/%.0fMB %-7s decode: %8.1f MB/s\n", size, names[i], size / t);
+    }
+    free(json);
+}
+
+/* parse and walk every value of a large document as a tree and as a tape */
+static void bench_tape(int n) {
+    char* json = (char*)malloc((size_t)n * 160 + 100);
+    char* p = json;
+    double begin, parse, walk, size, sum;
+    lept_tape tape;
+    lept_value v;
+    int i;
+    p += sprintf(p, "{\"meta\":{\"version\":3,\"count\":%d},\"records\":[", n);
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s{\"id\":%d,\"name\":\"user %d\",\"score\":%.17g,\"tags\":[\"a\",\"b\"],\"ok\":true}",
+                     i == 0 ? "" : ",", i, i, i * 1.37);
+    }
+    p += sprintf(p, "],\"done\":true}");
+    size = (p - json) / 1e6;
+
+    begin = now();
+    lept_parse_n(&v, json, p - json);
+    parse = now() - begin;
+    begin = now();
+    sum = sum_value(&v);
+    walk = now() - begin;
+    lept_free_value_on_stack(&v);
+    printf("tape/%.0fMB tree parse: %8.1f MB/s, walk: %8.1f MB/s (%.0f)\n", size, size / parse, size / walk, sum);
+
+    begin = now();
+    lept_parse_tape(&tape, json, p - json);
+    parse = now() - begin;
+    begin = now();
+    sum = sum_tape(lept_tape_root(&tape));
+    walk = now() - begin;
+    printf("tape/%.0fMB tape parse: %8.1f MB/s, walk: %8.1f MB/s (%.0f, %.1f MB of words)\n", size, size / parse,
+           size / walk, sum, tape.len * sizeof(uint64_t) / 1e6);
+    lept_tape_free(&tape);
+    free(json);
+}
+
+/* one long string of ASCII, of Latin text with accents and of CJK, each validated as it is scanned */
+static void bench_utf8(int n) {
+    static const char* names[3] = { "ascii", "latin", "cjk" };
+    static const char* units[3] = { "plain text ", "caf\xC3\xA9 cr\xC3\xA8me ", "\xE6\x96\x87\xE5\xAD\x97" };
+    char* json = (char*)malloc((size_t)n + 64);
+    double begin, parse;
+    lept_value v;
+    size_t len, unit;
+    int i, k;
+    for (k = 0; k < 3; ++k) {
+        unit = strlen(units[k]);
+        json[0] = '"';
+        for (len = 1; len + unit < (size_t)n; len += unit) {
+            memcpy(json + len, units[k], unit);
+        }
+        json[len++] = '"';
+        begin = now();
+        for (i = 0; i < BENCH_PASSES; ++i) {
+            lept_parse_n(&v, json, len);
+            sink += lept_get_string_length(&v);
+            lept_free_value_on_stack(&v);
+        }
+        parse = (now() - begin) / BENCH_PASSES;
+        printf("utf8/%dMB %-5s parse: %8.2f GB/s\n", n >> 20, names[k], len / parse / 1e9);
+    }
+    free(json);
+}
+
+/* n arrays nested in each other and n arrays side by side, freed by an arena to avoid recursion */
+static void bench_depth(int n) {
+    char* deep = (char*)malloc((size_t)n * 2 + 2);
+    char* flat = (char*)malloc((size_t)n * 4 + 2);
+    char* p = flat;
+    double begin, parse;
+    lept_arena arena;
+    lept_parse_options opts = { 0, NULL, NULL, NULL, LEPT_PARSE_DEPTH_UNLIMITED };
+    lept_value v;
+    int i;
+    memset(deep, '[', n);
+    deep[n] = '0';
+    memset(deep + n + 1, ']', n);
+    deep[n * 2 + 1] = '\0';
+    *p++ = '[';
+    for (i = 1; i < n; ++i, p += 4) {
+        memcpy(p, "[0],", 4);
+    }
+    p[-1] = ']';
+    *p = '\0';
+
+    lept_arena_init(&arena);
+    opts.arena = &arena;
+    begin = now();
+    lept_parse_opts(&v, deep, &opts);
+    parse = now() - begin;
+    lept_arena_free(&arena);
+    printf("depth/%d nested parse: %8.1f M arrays/s\n", n, n / parse / 1e6);
+    begin = now();
+    lept_parse_opts(&v, flat, &opts);
+    parse = now() - begin;
+    lept_arena_free(&arena);
+    printf("depth/%d flat   parse: %8.1f M arrays/s\n", n, n / parse / 1e6);
+    free(deep);
+    free(flat);
+}
+
+/* hand a parsed config of n keys to 1000 consumers: shared copies, a parse each, one writer */
+static void bench_copy(int n) {
+    char* json = (char*)malloc((size_t)n * 48 + 2);
+    char* p = json;
+    lept_value v, c[1000];
+    lept_value* e;
+    double begin, copy, parse, write;
+    int i;
+    *p++ = '{';
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s\"option_%d\":{\"value\":%d,\"on\":true}", i == 0 ? "" : ",", i, i);
+    }
+    *p++ = '}';
+    *p = '\0';
+    lept_parse_n(&v, json, p - json);
+
+    begin = now();
+    for (i = 0; i < 1000; ++i) {
+        lept_copy(&c[i], &v);
+    }
+    copy = now() - begin;
+    for (i = 0; i < 1000; ++i) {
+        lept_free_value_on_stack(&c[i]);
+    }
+    begin = now();
+    for (i = 0; i < 1000; ++i) {
+        lept_parse_n(&c[i], json, p - json);
+    }
+    parse = now() - begin;
+    for (i = 0; i < 1000; ++i) {
+        lept_free_value_on_stack(&c[i]);
+    }
+    begin = now();
+    for (i = 0; i < 1000; ++i) {
+        lept_copy(&c[i], &v);
+        lept_get_mutable_object(&c[i]);
+        e = lept_find_object_value(&c[i], "option_0", 8);
+        lept_free_value_on_stack(e);
+        e->type = LEPT_NULL;
+    }
+    write = now() - begin;
+    for (i = 0; i < 1000; ++i) {
+        lept_free_value_on_stack(&c[i]);
+    }
+    printf("copy/%d keys x1000 copy:  %10.1f ns/consumer\n", n, copy / 1000 * 1e9);
+    printf("copy/%d keys x1000 parse: %10.1f ns/consumer\n", n, parse / 1000 * 1e9);
+    printf("copy/%d keys x1000 write: %10.1f ns/consumer (copy + one top-level write)\n", n, write / 1000 * 1e9);
+    lept_free_value_on_stack(&v);
+    free(json);
+}
+
+/* deduplicate a stream of n events, every other one a repeat with its keys in another order */
+static void bench_equal(int n) {
+    lept_value* events = (lept_value*)malloc((size_t)n * sizeof(lept_value));
+    size_t mask = 1;
+    const lept_value** table;
+    char json[256];
+    double begin, hash, dedup;
+    size_t h, unique = 0;
+    int i, k;
+    while (mask < (size_t)n * 2) {
+        mask *= 2;
+    }
+    table = (const lept_value**)calloc(mask--, sizeof(*table));
+    for (i = 0; i < n; ++i) {
+        k = i / 2;
+        if (i % 2 == 0) {
+            sprintf(json, "{\"id\":%d,\"type\":\"click\",\"user\":\"user %d\",\"ts\":%.17g,"
+                          "\"tags\":[\"a\",\"b\"],\"meta\":{\"ok\":true,\"retries\":%d}}", k, k % 97, k * 1.37, k % 3);
+        } else {
+            sprintf(json, "{\"meta\":{\"retries\":%d,\"ok\":true},\"ts\":%.17g,\"tags\":[\"a\",\"b\"],"
+                          "\"user\":\"user %d\",\"type\":\"click\",\"id\":%d}", k % 3, k * 1.37, k % 97, k);
+        }
+        lept_parse(&events[i], json);
+    }
+
+    begin = now();
+    for (i = 0; i < n; ++i) {
+        h = lept_hash(&events[i]);
+        sink += (double)(h & 1);
+    }
+    hash = now() - begin;
+    /* hashes are cached from here on, as for a message seen by several stages */
+    begin = now();
+    for (i = 0; i < n; ++i) {
+        for (h = lept_hash(&events[i]) & mask; table[h] != NULL; h = (h + 1) & mask) {
+            if (lept_is_equal(table[h], &events[i])) {
+                break;
+            }
+        }
+        if (table[h] == NULL) {
+            table[h] = &events[i];
+            ++unique;
+        }
+    }
+    dedup = now() - begin;
+    printf("equal/%d events hash:  %8.1f ns/event\n", n, hash / n * 1e9);
+    printf("equal/%d events dedup: %8.1f ns/event, %lu unique\n", n, dedup / n * 1e9, (unsigned long)unique);
+    for (i = 0; i < n; ++i) {
+        lept_free_value_on_stack(&events[i]);
+    }
+    free(table);
+    free(events);
+}
+
+/* a feature-flag payload of n flags fetched again and again, as text and as a file */
+static void bench_parse_cache(int n) {
+    const char* path = "leptjson_bench_flags.json";
+    char* json = (char*)malloc((size_t)n * 64 + 2);
+    char* p = json;
+    lept_parse_cache* cache = lept_parse_cache_new(64 << 20);
+    double begin, parse, cached, file, file_cached;
+    lept_value v;
+    FILE* f;
+    int i;
+    *p++ = '{';
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s\"flag_%d\":{\"on\":%s,\"rollout\":%d}", i == 0 ? "" : ",", i, i % 3 ? "true" : "false", i % 100);
+    }
+    *p++ = '}';
+    f = fopen(path, "wb");
+    fwrite(json, 1, p - json, f);
+    fclose(f);
+
+    begin = now();
+    for (i = 0; i < BENCH_PASSES * 10; ++i) {
+        lept_parse_n(&v, json, p - json);
+        lept_free_value_on_stack(&v);
+    }
+    parse = (now() - begin) / (BENCH_PASSES * 10);
+    lept_parse_cached(cache, &v, json, p - json); /* the one miss */
+    lept_free_value_on_stack(&v);
+    begin = now();
+    for (i = 0; i < BENCH_PASSES * 10; ++i) {
+        lept_parse_cached(cache, &v, json, p - json);
+        lept_free_value_on_stack(&v);
+    }
+    cached = (now() - begin) / (BENCH_PASSES * 10);
+    begin = now();
+    for (i = 0; i < BENCH_PASSES * 10; ++i) {
+        lept_parse_file(&v, path);
+        lept_free_value_on_stack(&v);
+    }
+    file = (now() - begin) / (BENCH_PASSES * 10);
+    lept_parse_file_cached(cache, &v, path);
+    lept_free_value_on_stack(&v);
+    begin = now();
+    for (i = 0; i < BENCH_PASSES * 10; ++i) {
+        lept_parse_file_cached(cache, &v, path);
+        lept_free_value_on_stack(&v);
+    }
+    file_cached = (now() - begin) / (BENCH_PASSES * 10);
+    printf("parse_cache/%dKB text: parse %9.2f us  cached %9.2f us  (%.0fx)\n",
+           (int)((p - json) >> 10), parse * 1e6, cached * 1e6, parse / cached);
+    printf("parse_cache/%dKB file: parse %9.2f us  cached %9.2f us  (%.0fx)\n",
+           (int)((p - json) >> 10), file * 1e6, file_cached * 1e6, file / file_cached);
+    lept_parse_cache_free(cache);
+    remove(path);
+    free(json);
+}
+
+static size_t count_values(const lept_value* v) {
+    const lept_object_node* node;
+    size_t i, n = 1;
+    if (v->type == LEPT_ARRAY) {
+        for (i = 0; i < lept_get_array_size(v); ++i) {
+            n += count_values(lept_get_array_element(v, i));
+        }
+    } else if (v->type == LEPT_OBJECT) {
+        for (node = lept_get_object(v)->nodes; node; node = node->next) {
+            n += count_values(&node->value);
+        }
+    }
+    return n;
+}
+
+#ifdef BENCH_HAVE_MALLINFO
+/* heap bytes held per value by records of short strings, numbers and literals */
+static void bench_memory(int n) {
+    char* json = (char*)malloc((size_t)n * 200 + 2);
+    char* p = json;
+    size_t before, values;
+    double begin, t;
+    lept_value v;
+    int i;
+    *p++ = '[';
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s{\"id\":%d,\"user\":\"user%d\",\"lang\":\"en\",\"text\":\"a somewhat longer tweet text %d\","
+                     "\"geo\":null,\"tags\":[\"x\",\"y\"],\"meta\":{\"ok\":true,\"n\":%d}}",
+                     i == 0 ? "" : ",", i, i % 1000, i, i % 7);
+    }
+    *p++ = ']';
+    *p = '\0';
+    before = mallinfo2().uordblks;
+    begin = now();
+    lept_parse(&v, json);
+    t = now() - begin;
+    values = count_values(&v);
+    printf("memory/%d records: %6.1f bytes/value, %6.1f ns/value (%lu values)\n", n,
+           (double)(mallinfo2().uordblks - before) / values, t * 1e9 / values, (unsigned long)values);
+    lept_free_value_on_stack(&v);
+    free(json);
+}
+#endif
+
+/*
+ * Corpora shaped like the usual JSON benchmark files, generated from a
+ * fixed seed so every build measures the same bytes. Run them with
+ * "leptjson_bench corpus [name...]", which prints one JSON object per
+ * corpus and operation.
+ */
+
+#define CORPUS_SIZE (2 << 20)
+
+typedef struct {
+    char* data;
+    size_t len, capacity;
+} corpus_text;
+
+static uint32_t corpus_seed;
+
+static uint32_t corpus_random() { /* xorshift32 */
+    corpus_seed ^= corpus_seed << 13;
+    corpus_seed ^= corpus_seed >> 17;
+    corpus_seed ^= corpus_seed << 5;
+    return corpus_seed;
+}
+
+static void corpus_put(corpus_text* t, const char* format, ...) {
+    va_list args;
+    int n;
+    for (;;) {
+        va_start(args, format);
+        n = vsnprintf(t->data + t->len, t->capacity - t->len, format, args);
+        va_end(args);
+        if ((size_t)n < t->capacity - t->len) {
+            break;
+        }
+        t->capacity = t->capacity * 2 + n;
+        t->data = (char*)realloc(t->data, t->capacity);
+    }
+    t->len += n;
+}
+
+static const char* corpus_pick(const char* const* words, size_t count) {
+    return words[corpus_random() % count];
+}
+
+/* GeoJSON polygons, mostly numbers with 15 decimals */
+static void corpus_canada(corpus_text* t) {
+    int i;
+    corpus_put(t, "{\"type\":\"FeatureCollection\",\"features\":[");
+    while (t->len < CORPUS_SIZE) {
+        corpus_put(t, "%s{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+                      "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[", t->data[t->len - 1] == '[' ? "" : ",");
+        for (i = 0; i < 500; ++i) {
+            corpus_put(t, "%s[%.15f,%.15f]", i == 0 ? "" : ",",
+                       -141.0 + corpus_random() % 8000000 / 100000.0, 41.0 + corpus_random() % 4200000 / 100000.0);
+        }
+        corpus_put(t, "]]}}");
+    }
+    corpus_put(t, "]}");
+}
+
+/* statuses with escaped and multi-byte text */
+static void corpus_twitter(corpus_text* t) {
+    static const char* const words[] = {
+        "the", "a", "RT", "@katze", "#json", "http://t.co/x1Ab", "caf\xC3\xA9", "na\xC3\xAFve",
+        "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E", "\xE3\x81\x93\xE3\x82\x93\xE3\x81\xAB\xE3\x81\xA1\xE3\x81\xAF",
+        "\xF0\x9F\x98\x80", "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82", "\\\"quoted\\\"", "line\\nbreak"
+    };
+    static const char* const langs[] = { "ja", "en", "es", "ru", "und" };
+    uint32_t id = 0;
+    int i, n;
+    corpus_put(t, "{\"statuses\":[");
+    while (t->len < CORPUS_SIZE) {
+        corpus_put(t, "%s{\"metadata\":{\"result_type\":\"recent\",\"iso_language_code\":\"%s\"},"
+                      "\"created_at\":\"Sun Aug 31 00:29:%02u +0000 2014\",\"id\":%u,\"id_str\":\"%u\",\"text\":\"",
+                   t->data[t->len - 1] == '[' ? "" : ",", corpus_pick(langs, 5), id % 60, id, id);
+        for (i = 0, n = 4 + corpus_random() % 20; i < n; ++i) {
+            corpus_put(t, "%s%s", i == 0 ? "" : " ", corpus_pick(words, sizeof(words) / sizeof(words[0])));
+        }
+        corpus_put(t, "\",\"source\":\"<a href=\\\"http://twitter.com\\\" rel=\\\"nofollow\\\">Twitter</a>\","
+                      "\"truncated\":false,\"in_reply_to_status_id\":null,\"user\":{\"id\":%u,\"name\":\"%s %s\","
+                      "\"screen_name\":\"user_%u\",\"location\":\"%s\",\"description\":\"%s %s %s\","
+                      "\"protected\":false,\"followers_count\":%u,\"friends_count\":%u,\"verified\":%s},"
+                      "\"geo\":null,\"retweet_count\":%u,\"favorite_count\":%u,\"entities\":{\"hashtags\":[],"
+                      "\"urls\":[],\"user_mentions\":[{\"screen_name\":\"katze\",\"id\":%u,\"indices\":[3,9]}]},"
+                      "\"favorited\":false,\"retweeted\":false,\"lang\":\"%s\"}",
+                   corpus_random() % 100000, corpus_pick(words, 12), corpus_pick(words, 12), id % 997,
+                   corpus_pick(words, 12), corpus_pick(words, 12), corpus_pick(words, 12), corpus_pick(words, 12),
+                   corpus_random() % 10000, corpus_random() % 1000, corpus_random() % 2 ? "true" : "false",
+                   corpus_random() % 100, corpus_random() % 100, corpus_random(), corpus_pick(langs, 5));
+        ++id;
+    }
+    corpus_put(t, "],\"search_metadata\":{\"completed_in\":0.087,\"count\":%u,\"query\":\"%%E4%%B8%%80\"}}", id);
+}
+
+/* events keyed by id and performances full of small objects */
+static void corpus_citm(corpus_text* t) {
+    static const char* const names[] = { "30th Anniversary Tour", "Berliner Philharmoniker", "Orchestre de Paris",
+                                         "Les Arts Florissants", "Quatuor Ebène" };
+    uint32_t id = 138586341;
+    int i, n;
+    corpus_put(t, "{\"events\":{");
+    while (t->len < CORPUS_SIZE / 3) {
+        corpus_put(t, "%s\"%u\":{\"description\":null,\"id\":%u,\"logo\":%s,\"name\":\"%s\",\"subTopicIds\":[%u,%u],"
+                      "\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[%u,%u]}",
+                   t->data[t->len - 1] == '{' ? "" : ",", id, id, corpus_random() % 4 ? "null" : "\"/images/UE0AAAAACEKo6QAAAAZDSVRN\"",
+                   corpus_pick(names, 5), 337184269 + corpus_random() % 100, 337184283 + corpus_random() % 100,
+                   324846099 + corpus_random() % 100, 107888604 + corpus_random() % 100);
+        id += 1 + corpus_random() % 50;
+    }
+    corpus_put(t, "},\"performances\":[");
+    while (t->len < CORPUS_SIZE) {
+        corpus_put(t, "%s{\"eventId\":%u,\"id\":%u,\"logo\":null,\"name\":null,\"prices\":[",
+                   t->data[t->len - 1] == '[' ? "" : ",", 138586341 + corpus_random() % 10000, id++);
+        for (i = 0, n = 1 + corpus_random() % 4; i < n; ++i) {
+            corpus_put(t, "%s{\"amount\":%u,\"audienceSubCategoryId\":337100890,\"seatCategoryId\":%u}",
+                       i == 0 ? "" : ",", 10000 + corpus_random() % 90000, 338937295 + i);
+        }
+        corpus_put(t, "],\"seatCategories\":[");
+        for (i = 0; i < n; ++i) {
+            corpus_put(t, "%s{\"areas\":[{\"areaId\":205705999,\"blockIds\":[]},{\"areaId\":205705998,\"blockIds\":[]}],"
+                          "\"seatCategoryId\":%u}", i == 0 ? "" : ",", 338937295 + i);
+        }
+        corpus_put(t, "],\"seatMapImage\":null,\"start\":%u000,\"venueCode\":\"PLEYEL_PLEYEL\"}", 1372701600u + id % 1000);
+    }
+    corpus_put(t, "]}");
+}
+
+/* documents 256 containers deep, arrays and objects in turn */
+static void corpus_nested(corpus_text* t) {
+    int i;
+    corpus_put(t, "[");
+    while (t->len < CORPUS_SIZE) {
+        corpus_put(t, t->len == 1 ? "" : ",");
+        for (i = 0; i < 128; ++i) {
+            corpus_put(t, "{\"a\":[");
+        }
+        corpus_put(t, "%u", corpus_random() % 1000);
+        for (i = 0; i < 128; ++i) {
+            corpus_put(t, ",true]}");
+        }
+    }
+    corpus_put(t, "]");
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void corpus_report(const char* corpus, const char* op, size_t bytes, size_t values, double t,
+                          const lept_allocator_stats* before, const lept_allocator_stats* after) {
+    printf("{\"corpus\":\"%s\",\"op\":\"%s\",\"bytes\":%lu,\"values\":%lu,\"mb_per_s\":%.1f,\"ns_per_value\":%.2f,"
+           "\"allocations\":%lu,\"frees\":%lu,\"peak_heap_bytes\":%lu,\"peak_rss_kb\":%ld}\n",
+           corpus, op, (unsigned long)bytes, (unsigned long)values, bytes / t / 1e6, t * 1e9 / values,
+           (unsigned long)(after->allocations - before->allocations), (unsigned long)(after->frees - before->frees),
+           (unsigned long)(after->peak_bytes - before->bytes), peak_rss_kb());
+}
+
+/*
+ * The best time of the passes for each operation. The allocator calls and
+ * heap peak come from a pass of their own through a counting allocator.
+ */
+static void bench_corpus(const char* name, void (*generate)(corpus_text*)) {
+    corpus_text text = { NULL, 0, 0 };
+    lept_counting_allocator counter;
+    lept_allocator_stats s[4];
+    double begin, t, t_parse = 1e9, t_free = 1e9, t_stringify = 1e9;
+    size_t values, out;
+    lept_buffer b;
+    lept_value v;
+    int pass;
+    corpus_seed = 2463534242u;
+    generate(&text);
+
+    lept_counting_allocator_init(&counter, NULL);
+    lept_set_allocator(&counter.allocator);
+    s[0] = counter.stats;
+    if (lept_parse_n(&v, text.data, text.len) != LEPT_PARSE_OK) {
+        fprintf(stderr, "%s: parse error\n", name);
+        exit(1);
+    }
+    s[1] = counter.stats;
+    counter.stats.peak_bytes = counter.stats.bytes;
+    lept_buffer_init(&b);
+    lept_stringify(&v, &b);
+    s[2] = counter.stats;
+    counter.stats.peak_bytes = counter.stats.bytes;
+    lept_buffer_free(&b);
+    values = count_values(&v);
+    lept_free_value_on_stack(&v);
+    s[3] = counter.stats;
+    lept_set_allocator(NULL);
+
+    lept_buffer_init(&b);
+    for (pass = 0; pass < BENCH_PASSES; ++pass) {
+        begin = now();
+        lept_parse_n(&v, text.data, text.len);
+        t = now() - begin;
+        t_parse = t < t_parse ? t : t_parse;
+
+        begin = now();
+        lept_buffer_reset(&b);
+        lept_stringify(&v, &b);
+        t = now() - begin;
+        t_stringify = t < t_stringify ? t : t_stringify;
+
+        begin = now();
+        lept_free_value_on_stack(&v);
+        t = now() - begin;
+        t_free = t < t_free ? t : t_free;
+    }
+    out = b.len;
+    lept_buffer_free(&b);
+    corpus_report(name, "parse", text.len, values, t_parse, &s[0], &s[1]);
+    corpus_report(name, "stringify", out, values, t_stringify, &s[1], &s[2]);
+    corpus_report(name, "free", text.len, values, t_free, &s[2], &s[3]);
+    free(text.data);
+}
+
+/* each corpus in a child of its own, so peak RSS is its own too */
+static void bench_corpora(int argc, char** argv) {
+    static const struct {
+        const char* name;
+        void (*generate)(corpus_text*);
+    } corpora[] = {
+        { "canada", corpus_canada }, { "twitter", corpus_twitter }, { "citm", corpus_citm }, { "nested", corpus_nested }
+    };
+    size_t i;
+    int j, status;
+    pid_t child;
+    for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+        for (j = 0; j < argc && strcmp(argv[j], corpora[i].name) != 0; ++j) {
+        }
+        if (argc > 0 && j == argc) {
+            continue;
+        }
+        fflush(stdout);
+        if ((child = fork()) == 0) {
+            bench_corpus(corpora[i].name, corpora[i].generate);
+            exit(0);
+        }
+        waitpid(child, &status, 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    int n;
+    if (argc > 1 && strcmp(argv[1], "corpus") == 0) {
+        bench_corpora(argc - 2, argv + 2);
+        return 0;
+    }
+    bench_array_iterate(1000000);
+    for (n = 1; n <= 256; n *= 2) {
+        bench_object_find(n);
+        if (n >= 8 && n < 32) {
+            bench_object_find(n + n / 2);
+        }
+    }
+    bench_stringify(100000);
+    bench_parse_file(1000000);
+    bench_ndjson(1000000);
+    bench_parallel(1000000);
+    bench_lazy(1000000);
+    bench_query(1000000);
+    bench_key_pool(200000);
+    bench_tape(1000000);
+    bench_binary(1000000);
+    bench_depth(1000000);
+    bench_utf8(16 << 20);
+    bench_copy(1000);
+    bench_equal(1000000);
+    bench_parse_cache(100);
+    bench_parse_cache(10000);
+#ifdef BENCH_HAVE_MALLINFO
+    bench_memory(200000);
+#endif
+    return 0;
+}
@@ -1,16 +1,46 @@
+#define _POSIX_C_SOURCE 200809L /* fdopen(), posix_madvise(), pthread_*(), stat().st_mtim */
+
 #include "leptjson.h"
+#include "leptjson_pow10.h"
 
 #include <assert.h> /* assert() */
-#include <errno.h>  /* errno, ERANGE */
+#include <float.h>  /* FLT_EVAL_METHOD */
+#include <locale.h> /* localeconv() */
 #include <math.h>   /* HUGE_VAL */
-#include <stdlib.h> /* NULL, strtod(), malloc() */
+#include <stdint.h> /* uint64_t */
+#include <stdlib.h> /* NULL, strtod(), malloc(), realloc(), free() */
 #include <stdio.h>  /* f****() */
-#include <string.h> /* strlen(), strncmp() */
+#include <string.h> /* strlen(), memcmp() */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LEPT_HAVE_MMAP
+#include <fcntl.h>    /* open() */
+#include <sys/mman.h> /* mmap(), posix_madvise() */
+#include <sys/stat.h> /* fstat(), stat() */
+#include <unistd.h>   /* close(), sysconf() */
+#define LEPT_HAVE_THREADS
+#include <pthread.h>  /* pthread_*() */
+#endif
+
+#if !defined(LEPT_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define LEPT_SIMD_X86
+#include <immintrin.h> /* _mm_*(), _mm256_*() */
+#endif
+
+/* allocation through an allocator, and through the global one */
+#define AMALLOC(a, size)     ((a)->malloc((a)->ctx, (size)))
+#define AREALLOC(a, p, size) ((a)->realloc((a)->ctx, (p), (size)))
+#define AFREE(a, p)          ((a)->free((a)->ctx, (p)))
+#define MALLOC(size)     AMALLOC(_allocator, size)
+#define REALLOC(p, size) AREALLOC(_allocator, p, size)
+#define FREE(p)          AFREE(_allocator, p)
 
-#define NEW(type) ((type*)malloc(sizeof(type)))
-#define NEWN(n, type) ((type*)malloc(n * sizeof(type)))
+#define NEW(type) ((type*)MALLOC(sizeof(type)))
+#define NEWN(n, type) ((type*)MALLOC((n) * sizeof(type)))
 
-#define CUR() (*c->json)
+/* the input is [json, end), reading at its end gives '\0' */
+#define CUR() (c->json != c->end ? *c->json : '\0')
 #define NEXT() do { ++c->json; } while (0)
 #define IS(ch) (CUR() == (ch))
 #define C2I(ch)                     \
@@ -27,465 +57,5438 @@
         NEXT();                \
     } while (0)
 
+#define CNEW(type) ((type*)_context_alloc(c, sizeof(type)))
+
+#define PUTC(ch) do { *(char*)_context_push(c, sizeof(char)) = (ch); } while (0)
+
+#ifndef LEPT_PARSE_STACK_INIT_SIZE
+#define LEPT_PARSE_STACK_INIT_SIZE 256
+#endif
+
+/* container frames kept in the context before they move to the heap */
+#ifndef LEPT_PARSE_FRAMES_INLINE
+#define LEPT_PARSE_FRAMES_INLINE 32
+#endif
+
+#ifndef LEPT_ARENA_CHUNK_INIT_SIZE
+#define LEPT_ARENA_CHUNK_INIT_SIZE 4096
+#endif
+
+#define ARENA_ALIGN 8
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+#define CHUNK_HEADER_SIZE ARENA_ROUND(sizeof(lept_arena_chunk))
+#define CHUNK_DATA(k) ((char*)(k) + CHUNK_HEADER_SIZE)
+
+struct lept_object_index_s {
+    size_t mask; /* slot count - 1, slot count is a power of 2 */
+    struct {
+        size_t hash;
+        lept_object_node* node; /* NULL for an empty slot */
+    } slots[1];
+};
+
+typedef const char* (*lept_scan_func)(const char* p, const char* end);
+
+static void* _std_malloc(void* ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void* _std_realloc(void* ctx, void* p, size_t size) {
+    (void)ctx;
+    return realloc(p, size);
+}
+
+static void _std_free(void* ctx, void* p) {
+    (void)ctx;
+    free(p);
+}
+
+static const lept_allocator _std_allocator = { _std_malloc, _std_realloc, _std_free, NULL };
+static const lept_allocator* _allocator = &_std_allocator;
+
 typedef struct lept_context_s {
     const char* json;
+    const char* end; /* the terminating '\0' */
+    lept_scan_func skip_whitespace;
+    lept_scan_func scan_string;
+    int flags;
+    int insitu; /* decode strings inside the input buffer */
+    lept_arena* arena; /* NULL when nodes come from alloc */
+    const lept_allocator* alloc; /* of the nodes, or of the arena */
+    lept_key_pool* keys;
+    const lept_handler* handler;
+    void* handler_ctx;
+    char* stack;
+    size_t size, top;
+    size_t* frames; /* of the open containers, frames_inline until it grows */
+    size_t frames_size, depth, max_depth;
+    size_t frames_inline[LEPT_PARSE_FRAMES_INLINE];
 } lept_context;
 
+static void* _context_alloc(lept_context* c, size_t size) {
+    return c->arena != NULL ? lept_arena_alloc(c->arena, size) : AMALLOC(c->alloc, size);
+}
+
+static void* _context_push(lept_context* c, size_t size) {
+    void* ret;
+    assert(size > 0);
+    if (c->top + size >= c->size) {
+        if (c->size == 0) {
+            c->size = LEPT_PARSE_STACK_INIT_SIZE;
+        }
+        while (c->top + size >= c->size) {
+            c->size += c->size >> 1; /* c->size * 1.5 */
+        }
+        c->stack = (char*)AREALLOC(c->alloc, c->stack, c->size);
+    }
+    ret = c->stack + c->top;
+    c->top += size;
+    return ret;
+}
+
+static void* _context_pop(lept_context* c, size_t size) {
+    assert(c->top >= size);
+    return c->stack + (c->top -= size);
+}
+
+#define LEPT_LONG_STRING 0xFF /* short_spare of a string in value.s */
+
+/* short strings rely on an 8 byte union and no padding */
+typedef char lept_value_is_16_bytes[sizeof(lept_value) == 16 ? 1 : -1];
+
+/* a copy of str in the block, right after the struct */
+static lept_string* _string_block(void* block, const char* str, size_t len) {
+    lept_string* s = (lept_string*)block;
+    s->len = len;
+    s->str = (char*)(s + 1);
+    memcpy(s->str, str, len);
+    s->str[len] = '\0';
+    s->borrowed = 1;
+    s->interned = 0;
+    s->refs = 1;
+    return s;
+}
+
+/* the characters are borrowed from an insitu buffer, copied otherwise */
+static lept_string* _new_string(lept_context* c, const char* str, size_t len) {
+    lept_string* s;
+    if (!c->insitu) {
+        return _string_block(_context_alloc(c, sizeof(lept_string) + len + 1), str, len);
+    }
+    s = CNEW(lept_string);
+    s->len = len;
+    s->str = (char*)str;
+    s->borrowed = 1;
+    s->interned = 0;
+    s->refs = 1;
+    return s;
+}
+
+/* the short string overlays the bytes of the value itself */
+static void _set_short_string(lept_value* v, const char* str, size_t len) {
+    char* p = (char*)v;
+    assert(len <= LEPT_SHORT_STRING_MAX);
+    memcpy(p, str, len);
+    p[len] = '\0';
+    v->short_spare = (unsigned char)(LEPT_SHORT_STRING_MAX - len);
+    v->type = LEPT_STRING;
+}
+
+static void _set_long_string(lept_value* v, lept_string* s) {
+    v->value.s = s;
+    v->short_spare = LEPT_LONG_STRING;
+    v->type = LEPT_STRING;
+}
+
+static lept_array* _new_array(lept_context* c) {
+    lept_array* a = CNEW(lept_array);
+    a->len = 0;
+    a->capacity = 0;
+    a->items = NULL;
+    a->lazy = a->lazy_end = NULL;
+    a->refs = 1;
+    a->hash = 0;
+    return a;
+}
+
+static lept_object_node* _new_object_node(lept_context* c) {
+    lept_object_node* n = CNEW(lept_object_node);
+    n->next = NULL;
+    n->key = NULL;
+    n->value.type = LEPT_UNKNOWN;
+    return n;
+}
+
+static lept_object* _new_object(lept_context* c) {
+    lept_object* o = CNEW(lept_object);
+    o->len = 0;
+    o->nodes = NULL;
+    o->lazy = o->lazy_end = NULL;
+    o->index = NULL;
+    o->arena = c->arena;
+    o->allocator = c->alloc;
+    o->refs = 1;
+    o->hash = 0;
+    return o;
+}
+
+/*
+ * Scanning kernels. Each returns the first byte in [p, end) that stops the
+ * scan, or end. The vector versions only load whole blocks before end and
+ * leave the tail to the scalar version.
+ */
+#define ISWHITESPACE(ch) ((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+/* bytes that end a run of plain string characters */
+#define ISSTRINGSTOP(ch) ((ch) == '"' || (ch) == '\\' || (unsigned char)(ch) < 0x20)
+
+static const char* _skip_whitespace_scalar(const char* p, const char* end) {
+    while (p < end && ISWHITESPACE(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static const char* _scan_string_scalar(const char* p, const char* end) {
+    while (p < end && !ISSTRINGSTOP(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+/*
+ * The length of the well-formed UTF-8 sequence at p, whose lead byte is
+ * 0x80 or above, or 0 if it is ill-formed: overlong, a surrogate, above
+ * U+10FFFF or cut short (RFC 3629).
+ */
+static size_t _utf8_sequence(const char* p, const char* end) {
+    const unsigned char* s = (const unsigned char*)p;
+    unsigned char lo = 0x80, hi = 0xBF; /* the range of the second byte */
+    size_t n, i;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        n = 2;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        n = 3;
+        lo = s[0] == 0xE0 ? 0xA0 : 0x80;
+        hi = s[0] == 0xED ? 0x9F : 0xBF;
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        n = 4;
+        lo = s[0] == 0xF0 ? 0x90 : 0x80;
+        hi = s[0] == 0xF4 ? 0x8F : 0xBF;
+    } else {
+        return 0;
+    }
+    if ((size_t)(end - p) < n || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (i = 2; i < n; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * The UTF-8 kernels scan like the string kernels and also stop at the
+ * first byte of an ill-formed sequence, which is always 0x80 or above.
+ */
+static const char* _scan_utf8_scalar(const char* p, const char* end) {
+    size_t n;
+    while (p < end) {
+        if ((unsigned char)*p < 0x80) {
+            if (ISSTRINGSTOP(*p)) {
+                break;
+            }
+            ++p;
+        } else if ((n = _utf8_sequence(p, end)) != 0) {
+            p += n;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+#ifdef LEPT_SIMD_X86
+
+__attribute__((target("sse2")))
+static const char* _skip_whitespace_sse2(const char* p, const char* end) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)p);
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(s, space), _mm_cmpeq_epi8(s, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(s, lf), _mm_cmpeq_epi8(s, cr)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(ws) ^ 0xFFFFu;
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return _skip_whitespace_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* _scan_string_sse2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)p);
+        /* s <= 0x1F (unsigned) iff min(s, 0x1F) == s */
+        __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(s, quote), _mm_cmpeq_epi8(s, backslash)),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(s, control), s));
+        unsigned mask = (unsigned)_mm_movemask_epi8(stop);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return _scan_string_scalar(p, end);
+}
+
+/* validates a sequence at a time, fast only while the text is mostly ASCII */
+__attribute__((target("sse2")))
+static const char* _scan_utf8_sse2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    unsigned mask;
+    size_t n;
+    while (end - p >= 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)p);
+        __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(s, quote), _mm_cmpeq_epi8(s, backslash)),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(s, control), s));
+        mask = (unsigned)_mm_movemask_epi8(stop) | (unsigned)_mm_movemask_epi8(s); /* and non-ASCII */
+        if (mask == 0) {
+            p += 16;
+            continue;
+        }
+        p += __builtin_ctz(mask);
+        if ((unsigned char)*p < 0x80 || (n = _utf8_sequence(p, end)) == 0) {
+            return p;
+        }
+        p += n;
+    }
+    return _scan_utf8_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* _skip_whitespace_avx2(const char* p, const char* end) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    for (; end - p >= 32; p += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(s, space), _mm256_cmpeq_epi8(s, tab)),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(s, lf), _mm256_cmpeq_epi8(s, cr)));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(ws);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return _skip_whitespace_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* _scan_string_avx2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    for (; end - p >= 32; p += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)p);
+        __m256i stop = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(s, quote), _mm256_cmpeq_epi8(s, backslash)),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(s, control), s));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(stop);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return _scan_string_sse2(p, end);
+}
+
+/*
+ * Keiser and Lemire's UTF-8 validation ("Validating UTF-8 in less than one
+ * instruction per byte"). The high nibble of a byte and both nibbles of
+ * the byte before it each look up a set of the errors they allow, and a
+ * pair is ill-formed where all three sets share one. Bytes that must be
+ * the third or fourth of a sequence are checked apart from the lookups.
+ */
+#define UTF8_TOO_SHORT  (1 << 0) /* 11______ 0_______, 11______ 11______ */
+#define UTF8_TOO_LONG   (1 << 1) /* 0_______ 10______ */
+#define UTF8_OVERLONG_3 (1 << 2) /* 11100000 100_____ */
+#define UTF8_TOO_LARGE  (1 << 3) /* 11110100 1001____, 11110100 101_____, 11110101+ 10______ */
+#define UTF8_SURROGATE  (1 << 4) /* 11101101 101_____ */
+#define UTF8_OVERLONG_2 (1 << 5) /* 1100000_ 10______ */
+#define UTF8_OVERLONG_4 (1 << 6) /* 11110000 1000____, and 11110101+ 1000____ */
+#define UTF8_TWO_CONTS  (1 << 7) /* 10______ 10______ */
+#define UTF8_CARRY      (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+#define UTF8_LARGE      (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_OVERLONG_4)
+
+static const unsigned char _utf8_lookup[3][16] = {
+    { /* high nibble of the first byte */
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_OVERLONG_4
+    },
+    { /* low nibble of the first byte */
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY, UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_LARGE, UTF8_LARGE, UTF8_LARGE, UTF8_LARGE,
+        UTF8_LARGE, UTF8_LARGE, UTF8_LARGE, UTF8_LARGE,
+        UTF8_LARGE | UTF8_SURROGATE,
+        UTF8_LARGE, UTF8_LARGE
+    },
+    { /* high nibble of the second byte */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+    }
+};
+
+/* nonzero in every byte of s where a sequence is found ill-formed, given the block before */
+__attribute__((target("avx2")))
+static __m256i _utf8_errors_avx2(__m256i s, __m256i prev) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i first_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)_utf8_lookup[0]));
+    const __m256i first_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)_utf8_lookup[1]));
+    const __m256i second_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)_utf8_lookup[2]));
+    /* the bytes 1, 2 and 3 positions back, across the lanes and the blocks */
+    __m256i carried = _mm256_permute2x128_si256(prev, s, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(s, carried, 15);
+    __m256i prev2 = _mm256_alignr_epi8(s, carried, 14);
+    __m256i prev3 = _mm256_alignr_epi8(s, carried, 13);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(first_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                         _mm256_shuffle_epi8(first_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(second_high, _mm256_and_si256(_mm256_srli_epi16(s, 4), nibble)));
+    /* 0x80 where the byte 2 back leads 3 or more bytes, or the byte 3 back leads 4 */
+    __m256i must_continue = _mm256_and_si256(
+        _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+                        _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80))),
+        _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_continue, special);
+}
+
+/* back p up to the lead byte of a sequence it cuts, but not before begin */
+static const char* _utf8_rewind(const char* p, const char* begin) {
+    unsigned char ch;
+    int k;
+    for (k = 1; k <= 3 && p - k >= begin; ++k) {
+        ch = (unsigned char)p[-k];
+        if (ch >= 0xC0) {
+            return k < (ch >= 0xF0 ? 4 : ch >= 0xE0 ? 3 : 2) ? p - k : p;
+        } else if (ch < 0x80) {
+            break;
+        }
+    }
+    return p;
+}
+
+/*
+ * Validates the blocks from p, a non-ASCII byte after ASCII, until one
+ * holds a stop byte, returned, or is all ASCII, returned at its start.
+ * Out of line, its tables leave the registers of the ASCII loop alone.
+ */
+__attribute__((target("avx2"), noinline))
+static const char* _scan_utf8_blocks_avx2(const char* p, const char* end, __m256i* error) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(' ');
+    __m256i s, prev, errors, gathered = *error;
+    unsigned mask, high;
+    for (prev = _mm256_setzero_si256(); end - p >= 32; p += 32, prev = s) {
+        s = _mm256_loadu_si256((const __m256i*)p);
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(s, quote), _mm256_cmpeq_epi8(s, backslash)),
+            _mm256_andnot_si256(s, _mm256_cmpgt_epi8(space, s)))); /* controls, not the non-ASCII bytes */
+        high = (unsigned)_mm256_movemask_epi8(s);
+        errors = _utf8_errors_avx2(s, prev);
+        if (mask != 0) { /* errors past the stop do not count */
+            mask ^= mask - 1;
+            if ((~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(errors, _mm256_setzero_si256())) & mask) != 0) {
+                gathered = _mm256_set1_epi8(1);
+            }
+            *error = gathered;
+            return p + __builtin_popcount(mask) - 1;
+        }
+        gathered = _mm256_or_si256(gathered, errors);
+        if (high == 0) { /* nothing carried over */
+            break;
+        }
+    }
+    *error = gathered;
+    return p;
+}
+
+/*
+ * Runs of ASCII are skipped as _scan_string_avx2() does, the blocks from
+ * the first non-ASCII byte are validated. Errors are gathered and only
+ * looked at when the scan stops.
+ */
+__attribute__((target("avx2")))
+static const char* _scan_utf8_avx2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const char* begin = p;
+    __m256i s, error = _mm256_setzero_si256();
+    unsigned mask;
+    for (;;) {
+        for (; end - p >= 32; p += 32) {
+            s = _mm256_loadu_si256((const __m256i*)p);
+            /* as signed bytes, both controls and non-ASCII are below ' ' */
+            mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(s, quote), _mm256_cmpeq_epi8(s, backslash)),
+                _mm256_cmpgt_epi8(space, s)));
+            if (mask != 0) {
+                break;
+            }
+        }
+        if (end - p < 32) {
+            break;
+        }
+        p += __builtin_ctz(mask);
+        if ((unsigned char)*p >= 0x80) {
+            p = _scan_utf8_blocks_avx2(p, end, &error);
+            if (end - p < 32 || !ISSTRINGSTOP(*p)) {
+                continue;
+            }
+        }
+        /* the scalar kernel finds the first error */
+        return _mm256_testz_si256(error, error) ? p : _scan_utf8_scalar(begin, end);
+    }
+    if (!_mm256_testz_si256(error, error)) {
+        return _scan_utf8_scalar(begin, end);
+    }
+    return _scan_utf8_sse2(_utf8_rewind(p, begin), end);
+}
+
+#undef UTF8_TOO_SHORT
+#undef UTF8_TOO_LONG
+#undef UTF8_OVERLONG_3
+#undef UTF8_TOO_LARGE
+#undef UTF8_SURROGATE
+#undef UTF8_OVERLONG_2
+#undef UTF8_OVERLONG_4
+#undef UTF8_TWO_CONTS
+#undef UTF8_CARRY
+#undef UTF8_LARGE
+
+#endif /* LEPT_SIMD_X86 */
+
+/* picks the widest kernels the CPU supports, utf8 for a scan_string that validates */
+static void _select_scan_funcs(lept_scan_func* skip_whitespace, lept_scan_func* scan_string, int utf8) {
+    *skip_whitespace = _skip_whitespace_scalar;
+    *scan_string = utf8 ? _scan_utf8_scalar : _scan_string_scalar;
+#ifdef LEPT_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *skip_whitespace = _skip_whitespace_avx2;
+        *scan_string = utf8 ? _scan_utf8_avx2 : _scan_string_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        *skip_whitespace = _skip_whitespace_sse2;
+        *scan_string = utf8 ? _scan_utf8_sse2 : _scan_string_sse2;
+    }
+#endif
+}
+
 static int _parse_whitespace(lept_context* c) {
-    while (IS(' ') || IS('\t') || IS('\n') || IS('\r')) {
+    /* most tokens are followed by no whitespace or a single space */
+    if (ISWHITESPACE(CUR())) {
+        NEXT();
+        if (ISWHITESPACE(CUR())) {
+            c->json = c->skip_whitespace(c->json, c->end);
+        }
+    }
+    return LEPT_PARSE_OK;
+}
+
+static int _parse_literal(lept_context* c, const char* literal) {
+    size_t len = strlen(literal);
+    if ((size_t)(c->end - c->json) < len || memcmp(c->json, literal, len) != 0) {
+        return LEPT_PARSE_INVALID_VALUE;
+    }
+    c->json += len;
+    return LEPT_PARSE_OK;
+}
+
+#define MAX_EXACT_INT (UINT64_C(1) << 53) /* integers up to this are exact doubles */
+#define MAX_MANTISSA_DIGITS 19              /* digits that always fit in uint64_t */
+#define MAX_EXP_ACCUMULATE 100000           /* far beyond any double, never overflows int */
+
+static const double _exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void _mul_64x64(uint64_t a, uint64_t b, uint64_t* hi, uint64_t* lo) {
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 uint128;
+    uint128 r = (uint128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    *lo = (uint64_t)r;
+#else
+    uint64_t a_lo = a & 0xFFFFFFFFu, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFFu, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFFu) + (hl & 0xFFFFFFFFu);
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    *lo = (mid << 32) | (ll & 0xFFFFFFFFu);
+#endif
+}
+
+static int _leading_zeros_64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & (UINT64_C(1) << 63))) {
+        x <<= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/*
+ * Eisel-Lemire: the correctly rounded double nearest to w * 10^q for a
+ * nonzero w, or 0 when the 128-bit product cannot decide the rounding
+ * (the caller then needs an exact conversion).
+ */
+static int _eisel_lemire(uint64_t w, int q, int negative, double* d) {
+    const uint64_t* pow10 = lept_pow10_128[q - LEPT_POW10_MIN_EXP];
+    uint64_t hi, lo, y_hi, y_lo, mantissa, bits;
+    int64_t exp2;
+    int clz, msb;
+    assert(w != 0);
+    assert(q >= LEPT_POW10_MIN_EXP && q <= LEPT_POW10_MAX_EXP);
+    clz = _leading_zeros_64(w);
+    w <<= clz;
+    /* floor(q * log2(10)) + 64 + bias - clz, 217706 / 2^16 ~ log2(10) */
+    exp2 = (int64_t)((217706 * (int64_t)q) >> 16) + 64 + 1023 - clz;
+    _mul_64x64(w, pow10[0], &hi, &lo);
+    if ((hi & 0x1FF) == 0x1FF && lo + w < w) { /* widen to the low 64 bits of 10^q */
+        _mul_64x64(w, pow10[1], &y_hi, &y_lo);
+        lo += y_hi;
+        if (lo < y_hi) {
+            ++hi;
+        }
+        if ((hi & 0x1FF) == 0x1FF && lo + 1 == 0 && y_lo + w < w) {
+            return 0;
+        }
+    }
+    msb = (int)(hi >> 63);
+    mantissa = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+    if (lo == 0 && (hi & 0x1FF) == 0 && (mantissa & 3) == 1) { /* halfway, cannot tell */
+        return 0;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >> 53) {
+        mantissa >>= 1;
+        ++exp2;
+    }
+    if (exp2 <= 0 || exp2 >= 0x7FF) { /* subnormal or infinite, leave it to strtod() */
+        return 0;
+    }
+    bits = (uint64_t)exp2 << 52 | (mantissa & ((UINT64_C(1) << 52) - 1));
+    if (negative) {
+        bits |= UINT64_C(1) << 63;
+    }
+    memcpy(d, &bits, sizeof(double));
+    return 1;
+}
+
+/* exact conversion of the hard cases, independent of the current locale */
+static double _strtod_exact(lept_context* c, const char* begin, const char* end) {
+    const char* point = localeconv()->decimal_point;
+    size_t point_len = strlen(point);
+    size_t head = c->top;
+    const char* p;
+    double d;
+    for (p = begin; p != end; ++p) {
+        if (*p == '.') {
+            memcpy(_context_push(c, point_len), point, point_len);
+        } else {
+            PUTC(*p);
+        }
+    }
+    PUTC('\0');
+    d = strtod(c->stack + head, NULL);
+    c->top = head;
+    return d;
+}
+
+/* the character at p, '\0' past the input */
+#define AT(p) ((p) != end ? *(p) : '\0')
+
+/* validates and converts the number in one pass */
+static int _parse_number(lept_context* c, double* n) {
+    const char* p = c->json;
+    const char* end = c->end;
+    uint64_t w = 0;     /* leading significant digits */
+    int digits = 0;     /* significant digits seen, may exceed MAX_MANTISSA_DIGITS */
+    int q = 0;          /* decimal exponent applied to w */
+    int exp = 0;
+    int exp_negative = 0;
+    int negative = 0;
+    double d;
+
+    if (AT(p) == '-') {
+        negative = 1;
+        ++p;
+    }
+    if (AT(p) == '0') {
+        ++p;
+    } else if (ISDIGIT1TO9(AT(p))) {
+        for (; ISDIGIT(AT(p)); ++p) {
+            if (digits < MAX_MANTISSA_DIGITS) {
+                w = w * 10 + (*p - '0');
+            } else {
+                ++q; /* dropped digit */
+            }
+            ++digits;
+        }
+    } else {
+        return LEPT_PARSE_INVALID_VALUE;
+    }
+    if (AT(p) == '.') {
+        ++p;
+        if (!ISDIGIT(AT(p))) return LEPT_PARSE_INVALID_VALUE;
+        for (; ISDIGIT(AT(p)); ++p) {
+            if (digits == 0 && *p == '0') { /* leading zeros are not significant */
+                --q;
+                continue;
+            }
+            if (digits < MAX_MANTISSA_DIGITS) {
+                w = w * 10 + (*p - '0');
+                --q;
+            }
+            ++digits;
+        }
+    }
+    if (AT(p) == 'e' || AT(p) == 'E') {
+        ++p;
+        if (AT(p) == '+' || AT(p) == '-') {
+            exp_negative = *p == '-';
+            ++p;
+        }
+        if (!ISDIGIT(AT(p))) return LEPT_PARSE_INVALID_VALUE;
+        for (; ISDIGIT(AT(p)); ++p) {
+            if (exp < MAX_EXP_ACCUMULATE) {
+                exp = exp * 10 + (*p - '0');
+            }
+        }
+        q += exp_negative ? -exp : exp;
+    }
+
+    if (w == 0 || q < LEPT_POW10_MIN_EXP) { /* below half of the smallest denormal */
+        d = negative ? -0.0 : 0.0;
+    } else if (q > LEPT_POW10_MAX_EXP) {
+        return LEPT_PARSE_NUMBER_TOO_BIG;
+    } else if (digits > MAX_MANTISSA_DIGITS) {
+        d = _strtod_exact(c, c->json, p); /* truncated mantissa */
+    } else if (q == 0 && w <= MAX_EXACT_INT) { /* integer */
+        d = negative ? -(double)w : (double)w;
+#if FLT_EVAL_METHOD == 0
+    } else if (w <= MAX_EXACT_INT && q >= -22 && q <= 22) { /* Clinger: both operands exact */
+        d = q < 0 ? (double)w / _exact_pow10[-q] : (double)w * _exact_pow10[q];
+        d = negative ? -d : d;
+#endif
+    } else if (!_eisel_lemire(w, q, negative, &d)) {
+        d = _strtod_exact(c, c->json, p);
+    }
+    if (d == HUGE_VAL || d == -HUGE_VAL) {
+        return LEPT_PARSE_NUMBER_TOO_BIG;
+    }
+    c->json = p;
+    *n = d;
+    return LEPT_PARSE_OK;
+}
+
+#undef AT
+
+/* reads the 4 hex digits of a \\u escape */
+static int _parse_hex4(lept_context* c, unsigned* u) {
+    int i;
+    char ch;
+    *u = 0;
+    for (i = 0; i < 4; ++i) {
+        ch = CUR();
+        if (ch >= '0' && ch <= '9') {
+            *u = *u << 4 | (ch - '0');
+        } else if (ch >= 'A' && ch <= 'F') {
+            *u = *u << 4 | (ch - ('A' - 10));
+        } else if (ch >= 'a' && ch <= 'f') {
+            *u = *u << 4 | (ch - ('a' - 10));
+        } else {
+            return 0;
+        }
+        NEXT();
+    }
+    return 1;
+}
+
+/* writes the code point u as 1 to 4 bytes of UTF-8 */
+static size_t _encode_utf8(unsigned u, char* out) {
+    if (u < 0x80) {
+        out[0] = (char)u;
+        return 1;
+    } else if (u < 0x800) {
+        out[0] = (char)(0xC0 | u >> 6);
+        out[1] = (char)(0x80 | (u & 0x3F));
+        return 2;
+    } else if (u < 0x10000) {
+        out[0] = (char)(0xE0 | u >> 12);
+        out[1] = (char)(0x80 | (u >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (u & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | u >> 18);
+    out[1] = (char)(0x80 | (u >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (u >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (u & 0x3F));
+    return 4;
+}
+
+/* decodes the escape after a backslash into out, which has room for 4 bytes */
+static int _parse_escape(lept_context* c, char* out, size_t* len) {
+    unsigned u, low;
+    switch (CUR()) {
+        case 'b' : *out = '\b'; break;
+        case 'f' : *out = '\f'; break;
+        case 'n' : *out = '\n'; break;
+        case 'r' : *out = '\r'; break;
+        case 't' : *out = '\t'; break;
+        case '\"': *out = '"';  break;
+        case '\\': *out = '\\'; break;
+        case '/' : *out = '/';  break;
+        case 'u':
+            NEXT();
+            if (!_parse_hex4(c, &u) || (u >= 0xDC00 && u <= 0xDFFF)) {
+                return LEPT_PARSE_INVALID_VALUE;
+            }
+            if (u >= 0xD800 && u <= 0xDBFF) { /* a high surrogate, the low one must follow */
+                if (CUR() != '\\') {
+                    return LEPT_PARSE_INVALID_VALUE;
+                }
+                NEXT();
+                if (CUR() != 'u') {
+                    return LEPT_PARSE_INVALID_VALUE;
+                }
+                NEXT();
+                if (!_parse_hex4(c, &low) || low < 0xDC00 || low > 0xDFFF) {
+                    return LEPT_PARSE_INVALID_VALUE;
+                }
+                u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+            }
+            *len = _encode_utf8(u, out);
+            return LEPT_PARSE_OK;
+        default:
+            return LEPT_PARSE_INVALID_VALUE;
+    }
+    NEXT();
+    *len = 1;
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * Decodes the string in place: the decoded bytes never run ahead of the
+ * input, so they are written over it and terminated at the closing quote.
+ * Strings without escapes are left as they are apart from that '\0'.
+ */
+static int _parse_str_insitu(lept_context* c, const char** str, size_t* len) {
+    char* begin;
+    char* dst;
+    const char* span;
+    size_t n;
+    int ret;
+    EXPECT('"');
+    begin = dst = (char*)c->json; /* lept_parse_insitu() was given a writable buffer */
+    for (;;) {
+        span = c->json;
+        c->json = c->scan_string(span, c->end);
+        n = c->json - span;
+        if (dst != span) { /* shift left by what the escapes so far saved */
+            memmove(dst, span, n);
+        }
+        dst += n;
+        switch (CUR()) {
+            case '\0':
+                return LEPT_PARSE_UNCLOSED_QUOTES;
+            case '"':
+                *dst = '\0';
+                NEXT();
+                *str = begin;
+                *len = dst - begin;
+                return LEPT_PARSE_OK;
+            case '\\':
+                NEXT();
+                if ((ret = _parse_escape(c, dst, &n)) != LEPT_PARSE_OK) {
+                    return ret;
+                }
+                dst += n;
+                break;
+            default:
+                if ((unsigned char)CUR() >= 0x80) { /* the scan stopped at ill-formed UTF-8 */
+                    return LEPT_PARSE_INVALID_VALUE;
+                }
+                *dst++ = CUR();
+                NEXT();
+        }
+    }
+}
+
+/*
+ * Decodes a string into *str, which is not NUL-terminated and stays valid
+ * until the next push: it points into the input when there is nothing to
+ * decode, otherwise at the decoded bytes just popped off the stack.
+ */
+static int _parse_str(lept_context* c, const char** str, size_t* len) {
+    size_t head = c->top;
+    const char* span;
+    char escaped[4];
+    size_t n;
+    int ret;
+    if (c->insitu) {
+        return _parse_str_insitu(c, str, len);
+    }
+    EXPECT('"');
+    span = c->json;
+    c->json = c->scan_string(span, c->end);
+    if (CUR() == '"') { /* nothing to decode, no copy */
+        *str = span;
+        *len = c->json - span;
         NEXT();
+        return LEPT_PARSE_OK;
+    }
+    for (;;) {
+        /* bulk copy the run of characters that need no decoding */
+        if (c->json != span) {
+            memcpy(_context_push(c, c->json - span), span, c->json - span);
+        }
+        switch (CUR()) {
+            case '\0':
+                ret = LEPT_PARSE_UNCLOSED_QUOTES;
+                goto fail;
+            case '"':
+                NEXT();
+                goto success;
+            case '\\':
+                NEXT();
+                if ((ret = _parse_escape(c, escaped, &n)) != LEPT_PARSE_OK) {
+                    goto fail;
+                }
+                memcpy(_context_push(c, n), escaped, n);
+                break;
+            default:
+                if ((unsigned char)CUR() >= 0x80) { /* the scan stopped at ill-formed UTF-8 */
+                    ret = LEPT_PARSE_INVALID_VALUE;
+                    goto fail;
+                }
+                PUTC(CUR());
+                NEXT();
+        }
+        span = c->json;
+        c->json = c->scan_string(span, c->end);
+    }
+success:
+    *len = c->top - head;
+    *str = (const char*)_context_pop(c, *len);
+    return LEPT_PARSE_OK;
+fail:
+    c->top = head;
+    return ret;
+}
+
+/* report an event, a handler that returns nonzero stops the parse */
+#define CALL0(event)                                                          \
+    (c->handler->event == NULL || c->handler->event(c->handler_ctx) == 0 ?    \
+     LEPT_PARSE_OK : LEPT_PARSE_STOPPED)
+#define CALL(event, ...)                                                      \
+    (c->handler->event == NULL || c->handler->event(c->handler_ctx, __VA_ARGS__) == 0 ? \
+     LEPT_PARSE_OK : LEPT_PARSE_STOPPED)
+
+static int _parse_string(lept_context* c) {
+    const char* str;
+    size_t len;
+    int ret;
+    if ((ret = _parse_str(c, &str, &len)) != LEPT_PARSE_OK) {
+        return ret;
+    }
+    return CALL(on_string, str, len);
+}
+
+/*
+ * Containers are parsed without recursion. Each open container has a frame
+ * holding its count of values shifted left by one, with the low bit set in
+ * objects, so nesting costs no C stack and no call per level.
+ */
+
+#define FRAME_OBJECT 1
+
+static int _open_frame(lept_context* c, size_t frame) {
+    size_t* frames;
+    if (c->depth >= c->max_depth) {
+        return LEPT_PARSE_TOO_DEEP;
+    }
+    if (c->depth == c->frames_size) {
+        frames = (size_t*)AMALLOC(c->alloc, c->frames_size * 2 * sizeof(size_t));
+        memcpy(frames, c->frames, c->depth * sizeof(size_t));
+        if (c->frames != c->frames_inline) {
+            AFREE(c->alloc, c->frames);
+        }
+        c->frames = frames;
+        c->frames_size *= 2;
+    }
+    c->frames[c->depth++] = frame;
+    return frame & FRAME_OBJECT ? CALL0(on_start_object) : CALL0(on_start_array);
+}
+
+/* one whole value at c->json, the frames below c->depth belong to the caller */
+static int _parse_value(lept_context* c) {
+    size_t base = c->depth;
+    size_t frame;
+    const char* key;
+    size_t keylen;
+    double n;
+    int ret;
+value:
+    switch (CUR()) {
+        case 'n':
+            if ((ret = _parse_literal(c, "null")) != LEPT_PARSE_OK || (ret = CALL0(on_null)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            break;
+        case 't':
+            if ((ret = _parse_literal(c, "true")) != LEPT_PARSE_OK || (ret = CALL(on_bool, 1)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            break;
+        case 'f':
+            if ((ret = _parse_literal(c, "false")) != LEPT_PARSE_OK || (ret = CALL(on_bool, 0)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            break;
+        case '"':
+            if ((ret = _parse_string(c)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            break;
+        case '[':
+            NEXT();
+            if ((ret = _open_frame(c, 0)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            goto array;
+        case '{':
+            NEXT();
+            if ((ret = _open_frame(c, FRAME_OBJECT)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            goto object;
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+        case '-':
+            if ((ret = _parse_number(c, &n)) != LEPT_PARSE_OK || (ret = CALL(on_number, n)) != LEPT_PARSE_OK) {
+                goto error;
+            }
+            break;
+        case '\0':
+            ret = c->json != c->end ? LEPT_PARSE_INVALID_VALUE : LEPT_PARSE_EXPECT_VALUE; /* an embedded NUL */
+            goto error;
+        case ']': case '}':
+            ret = LEPT_PARSE_EXPECT_VALUE;
+            goto error;
+        default :
+            ret = LEPT_PARSE_INVALID_VALUE;
+            goto error;
+    }
+next: /* a value ended, inside the container on top if there is one */
+    if (c->depth == base) {
+        return LEPT_PARSE_OK;
+    }
+    frame = c->frames[c->depth - 1] += 2;
+    _parse_whitespace(c);
+    if (CUR() == ',') {
+        NEXT();
+        if (frame & FRAME_OBJECT) {
+            goto object;
+        }
+        goto array;
+    }
+    if (CUR() != (frame & FRAME_OBJECT ? '}' : ']')) {
+        ret = LEPT_PARSE_UNCLOSED_BRACKETS;
+        goto error;
+    }
+    NEXT();
+    goto close;
+array: /* after '[' or ',' */
+    _parse_whitespace(c);
+    if (CUR() != ']') {
+        goto value;
+    }
+    NEXT();
+    goto close;
+object: /* after '{' or ',' */
+    _parse_whitespace(c);
+    if (CUR() == '}') {
+        NEXT();
+        goto close;
+    }
+    if (CUR() != '\"') {
+        ret = LEPT_PARSE_INVALID_VALUE;
+        goto error;
+    }
+    if ((ret = _parse_str(c, &key, &keylen)) != LEPT_PARSE_OK ||
+        (ret = CALL(on_key, key, keylen)) != LEPT_PARSE_OK) {
+        goto error;
+    }
+    _parse_whitespace(c);
+    if (CUR() != ':') {
+        ret = LEPT_PARSE_EXPECT_VALUE;
+        goto error;
+    }
+    NEXT();
+    _parse_whitespace(c);
+    goto value;
+close:
+    frame = c->frames[--c->depth];
+    ret = frame & FRAME_OBJECT ? CALL(on_end_object, frame >> 1) : CALL(on_end_array, frame >> 1);
+    if (ret != LEPT_PARSE_OK) {
+        goto error;
+    }
+    goto next;
+error:
+    c->depth = base;
+    return ret;
+}
+
+#undef FRAME_OBJECT
+
+static int _parse_root(lept_context* c) {
+    int ret;
+    _parse_whitespace(c);
+    if ((ret = _parse_value(c)) == LEPT_PARSE_OK) {
+        _parse_whitespace(c);
+        if (c->json != c->end) {
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    return ret;
+}
+
+/*
+ * The DOM builder is the handler behind lept_parse(). Finished values wait
+ * on the context stack until the container holding them ends, object keys
+ * wait there as string values in front of their member values.
+ */
+
+static lept_value* _dom_push(lept_context* c) {
+    return (lept_value*)_context_push(c, sizeof(lept_value));
+}
+
+static int _dom_null(void* ctx) {
+    _dom_push((lept_context*)ctx)->type = LEPT_NULL;
+    return 0;
+}
+
+static int _dom_bool(void* ctx, int b) {
+    _dom_push((lept_context*)ctx)->type = b ? LEPT_TRUE : LEPT_FALSE;
+    return 0;
+}
+
+static int _dom_number(void* ctx, double n) {
+    lept_value* v = _dom_push((lept_context*)ctx);
+    v->type = LEPT_NUMBER;
+    v->value.n = n;
+    return 0;
+}
+
+/* the string is copied before the push, which may move decoded bytes */
+static int _dom_string(void* ctx, const char* str, size_t len) {
+    lept_context* c = (lept_context*)ctx;
+    lept_value v;
+    if (len <= LEPT_SHORT_STRING_MAX) {
+        _set_short_string(&v, str, len);
+    } else {
+        _set_long_string(&v, _new_string(c, str, len));
+    }
+    memcpy(_dom_push(c), &v, sizeof(lept_value));
+    return 0;
+}
+
+static lept_string* _pool_intern(lept_key_pool* p, const char* str, size_t len, int retain);
+
+/* keys are always kept in value.s, which becomes the key of the node */
+static int _dom_key(void* ctx, const char* str, size_t len) {
+    lept_context* c = (lept_context*)ctx;
+    lept_string* s = c->keys != NULL ? _pool_intern(c->keys, str, len, c->arena == NULL) :
+                                       _new_string(c, str, len);
+    _set_long_string(_dom_push(c), s);
+    return 0;
+}
+
+/* move the len values on top of the stack into a */
+static void _pop_elements(lept_context* c, lept_array* a, size_t len) {
+    if (len > 0) {
+        a->items = (lept_value*)_context_alloc(c, len * sizeof(lept_value));
+        memcpy(a->items, _context_pop(c, len * sizeof(lept_value)), len * sizeof(lept_value));
+    }
+    a->len = a->capacity = len;
+}
+
+/* move the len keys and values on top of the stack into o */
+static void _pop_members(lept_context* c, lept_object* o, size_t len) {
+    lept_object_node** tail = &o->nodes;
+    lept_object_node* node;
+    lept_value* members = (lept_value*)_context_pop(c, 2 * len * sizeof(lept_value));
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        node = _new_object_node(c);
+        node->key = members[2 * i].value.s;
+        node->value = members[2 * i + 1];
+        *tail = node;
+        tail = &node->next;
+    }
+    o->len = len;
+    if ((c->flags & LEPT_PARSE_INDEX_OBJECTS) && len >= LEPT_OBJECT_INDEX_MIN) {
+        lept_index_object(o);
+    }
+}
+
+static int _dom_end_array(void* ctx, size_t len) {
+    lept_context* c = (lept_context*)ctx;
+    lept_array* a = _new_array(c);
+    lept_value* v;
+    _pop_elements(c, a, len);
+    v = _dom_push(c);
+    v->type = LEPT_ARRAY;
+    v->value.a = a;
+    return 0;
+}
+
+static int _dom_end_object(void* ctx, size_t len) {
+    lept_context* c = (lept_context*)ctx;
+    lept_object* o = _new_object(c);
+    lept_value* v;
+    _pop_members(c, o, len);
+    v = _dom_push(c);
+    v->type = LEPT_OBJECT;
+    v->value.o = o;
+    return 0;
+}
+
+static const lept_handler _dom_handler = {
+    _dom_null,
+    _dom_bool,
+    _dom_number,
+    _dom_string,
+    NULL,           /* on_start_object */
+    _dom_key,       /* on_key */
+    _dom_end_object,
+    NULL,           /* on_start_array */
+    _dom_end_array
+};
+
+static void _free_value(lept_value* v, const lept_allocator* a);
+
+/* hand the finished root over to v, or release what was built so far */
+static int _dom_finish(lept_context* c, lept_value* v, int ret) {
+    if (ret == LEPT_PARSE_OK || ret == LEPT_PARSE_ROOT_NOT_SINGULAR) {
+        memcpy(v, _context_pop(c, sizeof(lept_value)), sizeof(lept_value));
+    } else {
+        v->type = LEPT_UNKNOWN;
+        while (c->top > 0) { /* values of the unfinished containers */
+            lept_value* e = (lept_value*)_context_pop(c, sizeof(lept_value));
+            if (c->arena == NULL) {
+                _free_value(e, c->alloc);
+            }
+        }
+    }
+    assert(c->top == 0);
+    return ret;
+}
+
+static int _parse(lept_context* c, lept_value* v) {
+    c->handler = &_dom_handler;
+    c->handler_ctx = c;
+    return _dom_finish(c, v, _parse_root(c));
+}
+
+static void _push_lazy_value(lept_context* c);
+
+/* validates without building anything, then keeps the root as its source */
+static int _parse_lazy(lept_context* c, lept_value* v) {
+    static const lept_handler validate = { NULL };
+    const char* begin = c->json;
+    int ret;
+    if (c->arena != NULL || c->alloc != _allocator) { /* _materialize() takes the global one */
+        v->type = LEPT_UNKNOWN;
+        return LEPT_PARSE_INVALID_OPTIONS;
+    }
+    c->handler = &validate;
+    ret = _parse_root(c);
+    if (ret != LEPT_PARSE_OK && ret != LEPT_PARSE_ROOT_NOT_SINGULAR) {
+        v->type = LEPT_UNKNOWN;
+        return ret;
+    }
+    c->json = begin;
+    c->handler = &_dom_handler;
+    c->handler_ctx = c;
+    _parse_whitespace(c);
+    _push_lazy_value(c);
+    return _dom_finish(c, v, ret);
+}
+
+int lept_parse(lept_value* v, const char* json) {
+    return lept_parse_opts(v, json, NULL);
+}
+
+static void _context_init(lept_context* c, const char* json, size_t len, const lept_parse_options* opts) {
+    _select_scan_funcs(&c->skip_whitespace, &c->scan_string, 1);
+    c->json = json;
+    c->end = json + len;
+    c->flags = opts != NULL ? opts->flags : 0;
+    c->insitu = 0;
+    c->arena = opts != NULL ? opts->arena : NULL;
+    c->keys = opts != NULL ? opts->keys : NULL;
+    c->alloc = c->arena != NULL ? c->arena->allocator :
+               opts != NULL && opts->allocator != NULL ? opts->allocator : _allocator;
+    if (c->arena != NULL) { /* reuse the stack kept by the arena */
+        c->stack = c->arena->stack;
+        c->size = c->arena->stack_size;
+    } else {
+        c->stack = NULL;
+        c->size = 0;
+    }
+    c->top = 0;
+    c->frames = c->frames_inline;
+    c->frames_size = LEPT_PARSE_FRAMES_INLINE;
+    c->depth = 0;
+    c->max_depth = opts != NULL && opts->max_depth != 0 ? opts->max_depth : LEPT_PARSE_MAX_DEPTH;
+}
+
+static void _context_free(lept_context* c) {
+    if (c->frames != c->frames_inline) {
+        AFREE(c->alloc, c->frames);
+    }
+    if (c->arena != NULL) {
+        c->arena->stack = c->stack;
+        c->arena->stack_size = c->size;
+    } else {
+        AFREE(c->alloc, c->stack);
+    }
+}
+
+int lept_parse_opts(lept_value* v, const char* json, const lept_parse_options* opts) {
+    lept_context c;
+    int ret;
+    assert(v != NULL);
+    assert(json != NULL);
+    _context_init(&c, json, strlen(json), opts);
+    ret = c.flags & LEPT_PARSE_LAZY ? _parse_lazy(&c, v) : _parse(&c, v);
+    _context_free(&c);
+    return ret;
+}
+
+int lept_parse_n(lept_value* v, const char* json, size_t len) {
+    lept_context c;
+    int ret;
+    assert(v != NULL);
+    assert(json != NULL || len == 0);
+    _context_init(&c, json, len, NULL);
+    ret = _parse(&c, v);
+    _context_free(&c);
+    return ret;
+}
+
+int lept_parse_sax(const char* json, const lept_handler* handler, void* ctx) {
+    lept_context c;
+    int ret;
+    assert(json != NULL);
+    assert(handler != NULL);
+    _context_init(&c, json, strlen(json), NULL);
+    c.handler = handler;
+    c.handler_ctx = ctx;
+    ret = _parse_root(&c);
+    c.top = 0; /* strings decoded when the handler stopped */
+    _context_free(&c);
+    return ret;
+}
+
+int lept_parse_insitu(lept_value* v, char* json, size_t len) {
+    lept_context c;
+    int ret;
+    assert(v != NULL);
+    assert(json != NULL);
+    _context_init(&c, json, len, NULL);
+    c.insitu = 1;
+    ret = _parse(&c, v);
+    _context_free(&c);
+    return ret;
+}
+
+int lept_parse_arena(lept_arena* a, lept_value* v, const char* json) {
+    lept_parse_options opts;
+    assert(a != NULL);
+    opts.flags = 0;
+    opts.arena = a;
+    opts.keys = NULL;
+    opts.allocator = NULL;
+    opts.max_depth = 0;
+    return lept_parse_opts(v, json, &opts);
+}
+
+void lept_set_allocator(const lept_allocator* a) {
+    _allocator = a != NULL ? a : &_std_allocator;
+}
+
+const lept_allocator* lept_get_allocator() {
+    return _allocator;
+}
+
+/*
+ * The counting allocator keeps each block's size in a header, which is as
+ * large as the strictest alignment so the block after it stays aligned.
+ */
+typedef union {
+    size_t size;
+    long double align_ld;
+    void* align_p;
+} lept_count_header;
+
+static void _count_add(lept_counting_allocator* a, size_t size) {
+#if defined(__GNUC__) || defined(__clang__)
+    size_t bytes = __atomic_add_fetch(&a->stats.bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&a->stats.peak_bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&a->stats.allocations, 1, __ATOMIC_RELAXED);
+    while (bytes > peak &&
+           !__atomic_compare_exchange_n(&a->stats.peak_bytes, &peak, bytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+#else
+    ++a->stats.allocations;
+    if ((a->stats.bytes += size) > a->stats.peak_bytes) {
+        a->stats.peak_bytes = a->stats.bytes;
+    }
+#endif
+}
+
+static void _count_sub(lept_counting_allocator* a, size_t size, size_t frees) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_sub_fetch(&a->stats.bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&a->stats.frees, frees, __ATOMIC_RELAXED);
+#else
+    a->stats.bytes -= size;
+    a->stats.frees += frees;
+#endif
+}
+
+static void* _count_malloc(void* ctx, size_t size) {
+    lept_counting_allocator* a = (lept_counting_allocator*)ctx;
+    lept_count_header* h = (lept_count_header*)AMALLOC(a->base, sizeof(lept_count_header) + size);
+    if (h == NULL) {
+        return NULL;
+    }
+    h->size = size;
+    _count_add(a, size);
+    return h + 1;
+}
+
+static void* _count_realloc(void* ctx, void* p, size_t size) {
+    lept_counting_allocator* a = (lept_counting_allocator*)ctx;
+    lept_count_header* h;
+    size_t old;
+    if (p == NULL) {
+        return _count_malloc(ctx, size);
+    }
+    h = (lept_count_header*)p - 1;
+    old = h->size;
+    if ((h = (lept_count_header*)AREALLOC(a->base, h, sizeof(lept_count_header) + size)) == NULL) {
+        return NULL;
+    }
+    h->size = size;
+    _count_sub(a, old, 0); /* the block moves, the old size leaves with it */
+    _count_add(a, size);
+    return h + 1;
+}
+
+static void _count_free(void* ctx, void* p) {
+    lept_counting_allocator* a = (lept_counting_allocator*)ctx;
+    lept_count_header* h;
+    if (p != NULL) {
+        h = (lept_count_header*)p - 1;
+        _count_sub(a, h->size, 1);
+        AFREE(a->base, h);
+    }
+}
+
+void lept_counting_allocator_init(lept_counting_allocator* a, const lept_allocator* base) {
+    assert(a != NULL);
+    a->allocator.malloc = _count_malloc;
+    a->allocator.realloc = _count_realloc;
+    a->allocator.free = _count_free;
+    a->allocator.ctx = a;
+    a->base = base != NULL ? base : _allocator;
+    a->stats.allocations = a->stats.frees = 0;
+    a->stats.bytes = a->stats.peak_bytes = 0;
+}
+
+void lept_arena_init(lept_arena* a) {
+    assert(a != NULL);
+    a->chunks = NULL;
+    a->current = NULL;
+    a->stack = NULL;
+    a->stack_size = 0;
+    a->allocator = _allocator;
+}
+
+void lept_arena_reset(lept_arena* a) {
+    lept_arena_chunk* k;
+    assert(a != NULL);
+    for (k = a->chunks; k; k = k->next) {
+        k->used = 0;
+    }
+    a->current = a->chunks;
+}
+
+void lept_arena_free(lept_arena* a) {
+    lept_arena_chunk* k;
+    lept_arena_chunk* next;
+    assert(a != NULL);
+    for (k = a->chunks; k; k = next) {
+        next = k->next;
+        AFREE(a->allocator, k);
+    }
+    AFREE(a->allocator, a->stack);
+    a->chunks = a->current = NULL; /* ready for reuse with the same allocator */
+    a->stack = NULL;
+    a->stack_size = 0;
+}
+
+void* lept_arena_alloc(lept_arena* a, size_t size) {
+    lept_arena_chunk* k;
+    lept_arena_chunk* last = NULL;
+    size_t chunk_size = LEPT_ARENA_CHUNK_INIT_SIZE;
+    void* ret;
+    assert(a != NULL);
+    size = ARENA_ROUND(size);
+    for (k = a->current; k; k = k->next) { /* later chunks are free after a reset */
+        if (k->size - k->used >= size) {
+            goto found;
+        }
+        last = k;
+    }
+    if (last != NULL) {
+        chunk_size = last->size * 2;
+    }
+    if (chunk_size < size) {
+        chunk_size = size;
+    }
+    k = (lept_arena_chunk*)AMALLOC(a->allocator, CHUNK_HEADER_SIZE + chunk_size);
+    k->next = NULL;
+    k->size = chunk_size;
+    k->used = 0;
+    if (last != NULL) {
+        last->next = k;
+    } else {
+        a->chunks = k;
+    }
+found:
+    a->current = k;
+    ret = CHUNK_DATA(k) + k->used;
+    k->used += size;
+    return ret;
+}
+
+lept_string* lept_new_string() {
+    lept_string* s = NEW(lept_string);
+    s->len = 0;
+    s->str = NULL;
+    s->borrowed = 0;
+    s->interned = 0;
+    s->refs = 1;
+    return s;
+}
+
+lept_array* lept_new_array() {
+    lept_array* a = NEW(lept_array);
+    a->len = 0;
+    a->capacity = 0;
+    a->items = NULL;
+    a->lazy = a->lazy_end = NULL;
+    a->refs = 1;
+    a->hash = 0;
+    return a;
+}
+
+lept_object_node* lept_new_object_node() {
+    lept_object_node* n = NEW(lept_object_node);
+    n->next = NULL;
+    n->key = NULL;
+    n->value.type = LEPT_UNKNOWN;
+    return n;
+}
+
+lept_object* lept_new_object() {
+    lept_object* o = NEW(lept_object);
+    o->len = 0;
+    o->nodes = NULL;
+    o->lazy = o->lazy_end = NULL;
+    o->index = NULL;
+    o->arena = NULL;
+    o->allocator = _allocator;
+    o->refs = 1;
+    o->hash = 0;
+    return o;
+}
+
+lept_value* lept_new_value() {
+    lept_value* v = NEW(lept_value);
+    v->type = LEPT_UNKNOWN;
+    return v;
+}
+
+static void _key_retain(lept_string* s);
+static void _key_release(lept_string* s);
+
+/* references to strings and containers shared by lept_copy() */
+static void _retain(size_t* refs) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_add_fetch(refs, 1, __ATOMIC_RELAXED);
+#else
+    ++*refs;
+#endif
+}
+
+/* nonzero when the last reference is gone */
+static int _release(size_t* refs) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL) == 0;
+#else
+    return --*refs == 0;
+#endif
+}
+
+static int _shared(size_t* refs) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(refs, __ATOMIC_ACQUIRE) != 1;
+#else
+    return *refs != 1;
+#endif
+}
+
+static void _string_retain(lept_string* s) {
+    if (s->interned) {
+        _key_retain(s);
+    } else {
+        _retain(&s->refs);
+    }
+}
+
+/* a is the allocator the tree came from */
+static void _free_string(lept_string* s, const lept_allocator* a) {
+    if (s->interned) {
+        _key_release(s);
+        return;
+    }
+    if (!_release(&s->refs)) {
+        return;
+    }
+    if (!s->borrowed) {
+        AFREE(a, s->str);
+    }
+    AFREE(a, s);
+}
+
+static void _free_array(lept_array* arr, const lept_allocator* a) {
+    size_t i;
+    if (!_release(&arr->refs)) {
+        return;
+    }
+    for (i = 0; i < arr->len; ++i) {
+        _free_value(&arr->items[i], a);
+    }
+    AFREE(a, arr->items);
+    AFREE(a, arr);
+}
+
+static void _free_object_node(lept_object_node* n, const lept_allocator* a) {
+    _free_string(n->key, a);
+    _free_value(&n->value, a);
+    AFREE(a, n);
+}
+
+static void _free_object(lept_object* o, const lept_allocator* a) {
+    lept_object_node* node;
+    lept_object_node* next;
+    if (!_release(&o->refs)) {
+        return;
+    }
+    for (node = o->nodes; node; node = next) {
+        next = node->next;
+        _free_object_node(node, a);
+    }
+    AFREE(a, o->index);
+    AFREE(a, o);
+}
+
+static void _free_value(lept_value* v, const lept_allocator* a) {
+    switch (v->type) {
+        case LEPT_STRING:
+            if (v->short_spare == LEPT_LONG_STRING) {
+                _free_string(v->value.s, a);
+            }
+            break;
+        case LEPT_ARRAY : _free_array(v->value.a, a);  break;
+        case LEPT_OBJECT: _free_object(v->value.o, a); break;
+        default: break;
+    }
+}
+
+void lept_free_string(lept_string* s) {
+    assert(s != NULL);
+    _free_string(s, _allocator);
+}
+
+void lept_free_array(lept_array* a) {
+    assert(a != NULL);
+    _free_array(a, _allocator);
+}
+
+void lept_free_object_node(lept_object_node* n) {
+    assert(n != NULL);
+    _free_object_node(n, _allocator);
+}
+
+void lept_free_object(lept_object* o) {
+    assert(o != NULL);
+    _free_object(o, _allocator);
+}
+
+void lept_free_value_on_stack(lept_value* v) {
+    assert(v != NULL);
+    _free_value(v, _allocator);
+}
+
+void lept_free_value(lept_value* v) {
+    assert(v != NULL);
+    _free_value(v, _allocator);
+    FREE(v);
+}
+
+void lept_free_value_with(lept_value* v, const lept_allocator* a) {
+    assert(v != NULL);
+    assert(a != NULL);
+    _free_value(v, a);
+}
+
+void lept_copy(lept_value* dst, const lept_value* src) {
+    assert(dst != NULL);
+    assert(src != NULL);
+    *dst = *src;
+    switch (src->type) {
+        case LEPT_STRING:
+            if (src->short_spare == LEPT_LONG_STRING) {
+                _string_retain(src->value.s);
+            }
+            break;
+        case LEPT_ARRAY : _retain(&src->value.a->refs); break;
+        case LEPT_OBJECT: _retain(&src->value.o->refs); break;
+        default: break;
+    }
+}
+
+void lept_move(lept_value* dst, lept_value* src) {
+    assert(dst != NULL);
+    assert(src != NULL);
+    if (dst != src) {
+        *dst = *src;
+        src->type = LEPT_UNKNOWN;
+    }
+}
+
+void lept_swap(lept_value* a, lept_value* b) {
+    lept_value t;
+    assert(a != NULL);
+    assert(b != NULL);
+    t = *a;
+    *a = *b;
+    *b = t;
+}
+
+#define LEPT_FILE_BUFFER_INIT_SIZE 65536
+
+/* the whole stream into one buffer, for pipes and files that cannot be mapped */
+static int _parse_stream(lept_value* v, FILE* file) {
+    size_t len = 0;
+    size_t capacity = LEPT_FILE_BUFFER_INIT_SIZE;
+    char* buffer = NEWN(capacity, char);
+    size_t n;
+    int ret;
+    while ((n = fread(buffer + len, 1, capacity - len, file)) > 0) {
+        len += n;
+        if (len == capacity) {
+            capacity += capacity >> 1;
+            buffer = (char*)REALLOC(buffer, capacity);
+        }
+    }
+    ret = ferror(file) ? LEPT_FILE_READ_ERROR : lept_parse_n(v, buffer, len);
+    FREE(buffer);
+    return ret;
+}
+
+int lept_parse_file(lept_value* v, const char* path) {
+    FILE* file;
+    int ret;
+#ifdef LEPT_HAVE_MMAP
+    struct stat st;
+    void* map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return LEPT_FILE_CANNOT_OPEN;
+    /* parsed straight from the page cache, strings are copied out before unmapping */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+            ret = lept_parse_n(v, (const char*)map, (size_t)st.st_size);
+            munmap(map, (size_t)st.st_size);
+            return ret;
+        }
+    }
+    file = fdopen(fd, "rb");
+    if (file == NULL) {
+        close(fd);
+        return LEPT_FILE_CANNOT_OPEN;
+    }
+#else
+    file = fopen(path, "rb");
+    if (file == NULL) return LEPT_FILE_CANNOT_OPEN;
+#endif
+    ret = _parse_stream(v, file);
+    fclose(file);
+    return ret;
+}
+
+static void _materialize(const char* begin, const char* end, lept_array* a, lept_object* o);
+
+/* lazy containers are parsed on first access, even through a const value */
+static lept_array* _array_of(const lept_value* v) {
+    lept_array* a = v->value.a;
+    if (a->lazy != NULL) {
+        _materialize(a->lazy, a->lazy_end, a, NULL);
+    }
+    return a;
+}
+
+static lept_object* _object_of(const lept_value* v) {
+    lept_object* o = v->value.o;
+    if (o->lazy != NULL) {
+        _materialize(o->lazy, o->lazy_end, NULL, o);
+    }
+    return o;
+}
+
+lept_type lept_get_type(const lept_value* v) {
+    assert(v != NULL);
+    return (lept_type)v->type;
+}
+
+double lept_get_number(const lept_value* v) {
+    assert(v != NULL);
+    assert(v->type == LEPT_NUMBER);
+    return v->value.n;
+}
+
+const char* lept_get_string(const lept_value* v) {
+    assert(v != NULL);
+    assert(v->type == LEPT_STRING);
+    return v->short_spare == LEPT_LONG_STRING ? v->value.s->str : (const char*)v;
+}
+
+size_t lept_get_string_length(const lept_value* v) {
+    assert(v != NULL);
+    assert(v->type == LEPT_STRING);
+    return v->short_spare == LEPT_LONG_STRING ? v->value.s->len :
+                                                (size_t)(LEPT_SHORT_STRING_MAX - v->short_spare);
+}
+
+void lept_set_string(lept_value* v, const char* str, size_t len) {
+    assert(v != NULL);
+    assert(str != NULL || len == 0);
+    if (len <= LEPT_SHORT_STRING_MAX) {
+        _set_short_string(v, str, len);
+    } else {
+        _set_long_string(v, _string_block(MALLOC(sizeof(lept_string) + len + 1), str, len));
+    }
+}
+
+lept_array* lept_get_array(const lept_value* v) {
+    assert(v != NULL);
+    assert(v->type == LEPT_ARRAY);
+    return _array_of(v);
+}
+
+lept_array* lept_get_mutable_array(lept_value* v) {
+    lept_array* a;
+    lept_array* copy;
+    size_t i;
+    assert(v != NULL);
+    assert(v->type == LEPT_ARRAY);
+    a = _array_of(v);
+    if (_shared(&a->refs)) {
+        copy = lept_new_array();
+        lept_reserve_array(copy, a->len);
+        for (i = 0; i < a->len; ++i) {
+            lept_copy(&copy->items[i], &a->items[i]);
+        }
+        copy->len = a->len;
+        _free_array(a, _allocator); /* only drops the reference, unless the others just went */
+        v->value.a = copy;
+    }
+    v->value.a->hash = 0;
+    return v->value.a;
+}
+
+size_t lept_get_array_size(const lept_value* v) {
+    assert(v != NULL);
+    assert(v->type == LEPT_ARRAY);
+    return _array_of(v)->len;
+}
+
+lept_value* lept_get_array_element(const lept_value* v, size_t index) {
+    lept_array* a;
+    assert(v != NULL);
+    assert(v->type == LEPT_ARRAY);
+    a = _array_of(v);
+    assert(index < a->len);
+    return &a->items[index];
+}
+
+void lept_reserve_array(lept_array* a, size_t capacity) {
+    assert(a != NULL);
+    if (a->capacity < capacity) {
+        a->capacity = capacity;
+        a->items = (lept_value*)REALLOC(a->items, capacity * sizeof(lept_value));
+    }
+}
+
+lept_value* lept_pushback_array_element(lept_array* a) {
+    lept_value* e;
+    assert(a != NULL);
+    if (a->len == a->capacity) {
+        lept_reserve_array(a, a->capacity == 0 ? 1 : a->capacity * 2);
+    }
+    e = &a->items[a->len++];
+    e->type = LEPT_UNKNOWN;
+    a->hash = 0;
+    return e;
+}
+
+lept_object* lept_get_object(const lept_value* v) {
+    assert(v != NULL);
+    assert(v->type == LEPT_OBJECT);
+    return _object_of(v);
+}
+
+lept_object* lept_get_mutable_object(lept_value* v) {
+    lept_object* o;
+    lept_object* copy;
+    lept_object_node* node;
+    lept_object_node** tail;
+    assert(v != NULL);
+    assert(v->type == LEPT_OBJECT);
+    o = _object_of(v);
+    if (_shared(&o->refs)) {
+        copy = lept_new_object();
+        copy->len = o->len;
+        tail = &copy->nodes;
+        for (node = o->nodes; node; node = node->next) {
+            *tail = lept_new_object_node();
+            _string_retain((*tail)->key = node->key);
+            lept_copy(&(*tail)->value, &node->value);
+            tail = &(*tail)->next;
+        }
+        _free_object(o, _allocator);
+        v->value.o = copy;
+    }
+    v->value.o->hash = 0;
+    return v->value.o;
+}
+
+/* FNV-1a */
+static size_t _hash_key(const char* key, size_t len) {
+    size_t h = sizeof(size_t) > 4 ? (size_t)14695981039346656037ull : (size_t)2166136261u;
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        h ^= (unsigned char)key[i];
+        h *= sizeof(size_t) > 4 ? (size_t)1099511628211ull : (size_t)16777619u;
+    }
+    return h;
+}
+
+/*
+ * Key pool. Interned keys live in entries holding their hash and a count
+ * of references, one of them the pool's own. Lookups share a read lock,
+ * only a miss takes the write lock to insert.
+ */
+
+#ifdef LEPT_HAVE_THREADS
+#define READ_LOCK(p)  pthread_rwlock_rdlock(&(p)->lock)
+#define WRITE_LOCK(p) pthread_rwlock_wrlock(&(p)->lock)
+#define RW_UNLOCK(p)  pthread_rwlock_unlock(&(p)->lock)
+#else
+#define READ_LOCK(p)  ((void)0)
+#define WRITE_LOCK(p) ((void)0)
+#define RW_UNLOCK(p)  ((void)0)
+#endif
+
+typedef struct {
+    lept_string key; /* first, keys are handed out as &entry->key */
+    size_t hash;
+    long refs;
+    const lept_allocator* allocator; /* of the pool, which the key may outlive */
+} lept_pool_key;
+
+struct lept_key_pool_s {
+    lept_pool_key** slots; /* open addressing, NULL for an empty slot */
+    size_t mask, count;
+    const lept_allocator* allocator; /* the global one when created */
+#ifdef LEPT_HAVE_THREADS
+    pthread_rwlock_t lock;
+#endif
+};
+
+static size_t _string_hash(const lept_string* s) {
+    return s->interned ? ((const lept_pool_key*)s)->hash : _hash_key(s->str, s->len);
+}
+
+static void _key_retain(lept_string* s) {
+    lept_pool_key* k = (lept_pool_key*)s;
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_add_fetch(&k->refs, 1, __ATOMIC_RELAXED);
+#else
+    ++k->refs;
+#endif
+}
+
+static void _key_release(lept_string* s) {
+    lept_pool_key* k = (lept_pool_key*)s;
+#if defined(__GNUC__) || defined(__clang__)
+    if (__atomic_sub_fetch(&k->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+#else
+    if (--k->refs != 0) {
+        return;
+    }
+#endif
+    AFREE(k->allocator, k->key.str);
+    AFREE(k->allocator, k);
+}
+
+lept_key_pool* lept_key_pool_new() {
+    lept_key_pool* p = NEW(lept_key_pool);
+    size_t i;
+    p->allocator = _allocator;
+    p->mask = 63;
+    p->count = 0;
+    p->slots = NEWN(p->mask + 1, lept_pool_key*);
+    for (i = 0; i <= p->mask; ++i) {
+        p->slots[i] = NULL;
+    }
+#ifdef LEPT_HAVE_THREADS
+    pthread_rwlock_init(&p->lock, NULL);
+#endif
+    return p;
+}
+
+void lept_key_pool_free(lept_key_pool* p) {
+    size_t i;
+    assert(p != NULL);
+    for (i = 0; i <= p->mask; ++i) {
+        if (p->slots[i] != NULL) {
+            _key_release(&p->slots[i]->key);
+        }
+    }
+#ifdef LEPT_HAVE_THREADS
+    pthread_rwlock_destroy(&p->lock);
+#endif
+    AFREE(p->allocator, p->slots);
+    AFREE(p->allocator, p);
+}
+
+static lept_pool_key* _pool_find(const lept_key_pool* p, const char* str, size_t len, size_t h) {
+    lept_pool_key* k;
+    size_t i;
+    for (i = h & p->mask; (k = p->slots[i]) != NULL; i = (i + 1) & p->mask) {
+        if (k->hash == h && k->key.len == len && memcmp(k->key.str, str, len) == 0) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+static void _pool_put(lept_key_pool* p, lept_pool_key* k) {
+    size_t i;
+    for (i = k->hash & p->mask; p->slots[i] != NULL; i = (i + 1) & p->mask);
+    p->slots[i] = k;
+}
+
+static lept_pool_key* _pool_insert(lept_key_pool* p, const char* str, size_t len, size_t h) {
+    lept_pool_key** slots = p->slots;
+    lept_pool_key* k = (lept_pool_key*)AMALLOC(p->allocator, sizeof(lept_pool_key));
+    size_t i, size = p->mask + 1;
+    if ((p->count + 1) * 2 > size) { /* keep the load factor at or below 1/2 */
+        p->slots = (lept_pool_key**)AMALLOC(p->allocator, size * 2 * sizeof(lept_pool_key*));
+        p->mask = size * 2 - 1;
+        for (i = 0; i <= p->mask; ++i) {
+            p->slots[i] = NULL;
+        }
+        for (i = 0; i < size; ++i) {
+            if (slots[i] != NULL) {
+                _pool_put(p, slots[i]);
+            }
+        }
+        AFREE(p->allocator, slots);
+    }
+    k->key.len = len;
+    k->key.str = (char*)AMALLOC(p->allocator, len + 1);
+    memcpy(k->key.str, str, len);
+    k->key.str[len] = '\0';
+    k->key.borrowed = 0;
+    k->key.interned = 1;
+    k->key.refs = 1; /* unused, k->refs counts */
+    k->hash = h;
+    k->refs = 1;
+    k->allocator = p->allocator;
+    _pool_put(p, k);
+    ++p->count;
+    return k;
+}
+
+/* the pool holds a reference to each key, so none is freed while it exists */
+static lept_string* _pool_intern(lept_key_pool* p, const char* str, size_t len, int retain) {
+    size_t h = _hash_key(str, len);
+    lept_pool_key* k;
+    READ_LOCK(p);
+    k = _pool_find(p, str, len, h);
+    RW_UNLOCK(p);
+    if (k == NULL) {
+        WRITE_LOCK(p);
+        if ((k = _pool_find(p, str, len, h)) == NULL) {
+            k = _pool_insert(p, str, len, h);
+        }
+        RW_UNLOCK(p);
+    }
+    if (retain) {
+        _key_retain(&k->key);
+    }
+    return &k->key;
+}
+
+lept_string* lept_key_pool_intern(lept_key_pool* p, const char* str, size_t len) {
+    assert(p != NULL);
+    assert(str != NULL || len == 0);
+    return _pool_intern(p, str, len, 1);
+}
+
+#undef READ_LOCK
+#undef WRITE_LOCK
+#undef RW_UNLOCK
+
+/* a new index of the nodes of o, not yet installed */
+static lept_object_index* _build_index(lept_object* o) {
+    lept_object_index* index;
+    lept_object_node* node;
+    size_t slots = 4;
+    size_t size;
+    size_t i;
+    while (slots < o->len * 2) { /* keep the load factor at or below 1/2 */
+        slots *= 2;
+    }
+    size = sizeof(lept_object_index) + (slots - 1) * sizeof(index->slots[0]);
+    if (o->arena == NULL) {
+        index = (lept_object_index*)AMALLOC(o->allocator, size);
+    } else {
+        index = (lept_object_index*)lept_arena_alloc(o->arena, size);
+    }
+    index->mask = slots - 1;
+    for (i = 0; i < slots; ++i) {
+        index->slots[i].node = NULL;
+    }
+    for (node = o->nodes; node; node = node->next) {
+        size_t h = _string_hash(node->key);
+        for (i = h & index->mask; index->slots[i].node; i = (i + 1) & index->mask);
+        index->slots[i].hash = h;
+        index->slots[i].node = node;
+    }
+    return index;
+}
+
+void lept_index_object(lept_object* o) {
+    assert(o != NULL);
+    if (o->arena == NULL) {
+        AFREE(o->allocator, o->index);
+    }
+    o->index = _build_index(o);
+    o->hash = 0;
+}
+
+/*
+ * The index of o, built on the first lookup. Copies of o may look up from
+ * several threads, so only the first index built is installed.
+ */
+static lept_object_index* _object_index(lept_object* o) {
+    lept_object_index* index;
+    lept_object_index* expected = NULL;
+#if defined(__GNUC__) || defined(__clang__)
+    if ((index = __atomic_load_n(&o->index, __ATOMIC_ACQUIRE)) != NULL) {
+        return index;
+    }
+    index = _build_index(o);
+    if (!__atomic_compare_exchange_n(&o->index, &expected, index, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (o->arena == NULL) {
+            AFREE(o->allocator, index);
+        }
+        index = expected;
+    }
+#else
+    if ((index = o->index) == NULL) {
+        index = o->index = _build_index(o);
+    }
+    (void)expected;
+#endif
+    return index;
+}
+
+/* same is the key itself when the caller has it, so it matches by address */
+static lept_value* _find_object_value(const lept_value* v, const lept_string* same, const char* key, size_t keylen) {
+    lept_object* o = _object_of(v);
+    lept_object_index* index;
+    lept_object_node* node;
+    size_t h;
+    size_t i;
+    if (o->len < LEPT_OBJECT_INDEX_MIN && o->index == NULL) { /* only indexed on request */
+        for (node = o->nodes; node; node = node->next) {
+            if (node->key == same ||
+                (node->key->len == keylen && memcmp(node->key->str, key, keylen) == 0)) {
+                return &node->value;
+            }
+        }
+        return NULL;
+    }
+    index = _object_index(o);
+    h = same != NULL ? _string_hash(same) : _hash_key(key, keylen);
+    for (i = h & index->mask; (node = index->slots[i].node) != NULL; i = (i + 1) & index->mask) {
+        if (node->key == same || (index->slots[i].hash == h && node->key->len == keylen &&
+                                  memcmp(node->key->str, key, keylen) == 0)) {
+            return &node->value;
+        }
+    }
+    return NULL;
+}
+
+lept_value* lept_find_object_value(const lept_value* v, const char* key, size_t keylen) {
+    assert(v != NULL);
+    assert(v->type == LEPT_OBJECT);
+    assert(key != NULL);
+    return _find_object_value(v, NULL, key, keylen);
+}
+
+lept_value* lept_find_object_key(const lept_value* v, const lept_string* key) {
+    assert(v != NULL);
+    assert(v->type == LEPT_OBJECT);
+    assert(key != NULL);
+    return _find_object_value(v, key, key->str, key->len);
+}
+
+/*
+ * Equality and hashing. Containers shared by lept_copy() are equal by
+ * address, and two cached hashes that differ end a comparison early.
+ */
+
+static size_t _cached_hash(const size_t* hash) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(hash, __ATOMIC_RELAXED);
+#else
+    return *hash;
+#endif
+}
+
+static int _hashes_differ(const size_t* a, const size_t* b) {
+    size_t ha = _cached_hash(a);
+    size_t hb = _cached_hash(b);
+    return ha != 0 && hb != 0 && ha != hb;
+}
+
+static int _is_equal(const lept_value* a, const lept_value* b);
+
+static int _same_key(const lept_string* x, const lept_string* y) {
+    return x == y || (x->len == y->len && memcmp(x->str, y->str, x->len) == 0);
+}
+
+/* takes the member of rest equal to node, slots hash rest when it is not short */
+static int _take_member(const lept_object_node** rest, size_t n, const size_t* slots, size_t mask,
+                        const lept_object_node* node) {
+    size_t i, k;
+    if (slots == NULL) {
+        for (i = 0; i < n; ++i) {
+            if (rest[i] != NULL && _same_key(rest[i]->key, node->key) && _is_equal(&rest[i]->value, &node->value)) {
+                rest[i] = NULL;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (k = _string_hash(node->key) & mask; slots[k] != 0; k = (k + 1) & mask) {
+        i = slots[k] - 1;
+        if (rest[i] != NULL && _same_key(rest[i]->key, node->key) && _is_equal(&rest[i]->value, &node->value)) {
+            rest[i] = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Pairs each of the n members from node on with an equal member from other
+ * on, keys may repeat. Each member of other is taken once, so matching all
+ * n leaves none of them over.
+ */
+static int _match_members(const lept_object_node* node, const lept_object_node* other, size_t n) {
+    const lept_object_node* rest_inline[LEPT_OBJECT_INDEX_MIN];
+    const lept_object_node** rest = rest_inline; /* NULL once taken */
+    size_t* slots = NULL;                        /* index in rest + 1, 0 for an empty slot */
+    size_t mask = 0, i, k;
+    int ret = 1;
+    if (n > LEPT_OBJECT_INDEX_MIN) {
+        rest = NEWN(n, const lept_object_node*);
+        for (mask = 4; mask < n * 2; mask *= 2);
+        slots = NEWN(mask--, size_t);
+        for (k = 0; k <= mask; ++k) {
+            slots[k] = 0;
+        }
+    }
+    for (i = 0; i < n; ++i, other = other->next) {
+        rest[i] = other;
+        if (slots != NULL) {
+            for (k = _string_hash(other->key) & mask; slots[k] != 0; k = (k + 1) & mask);
+            slots[k] = i + 1;
+        }
+    }
+    for (; node != NULL && ret; node = node->next) {
+        ret = _take_member(rest, n, slots, mask, node);
+    }
+    if (slots != NULL) {
+        FREE(slots);
+        FREE(rest);
+    }
+    return ret;
+}
+
+static int _is_equal(const lept_value* a, const lept_value* b) {
+    const lept_array* x;
+    const lept_array* y;
+    const lept_object_node* node;
+    const lept_object_node* other;
+    size_t len, i;
+    if (a->type != b->type) {
+        return 0;
+    }
+    switch (a->type) {
+        case LEPT_NUMBER:
+            return a->value.n == b->value.n;
+        case LEPT_STRING:
+            len = lept_get_string_length(a);
+            if (a->short_spare == LEPT_LONG_STRING && b->short_spare == LEPT_LONG_STRING &&
+                a->value.s == b->value.s) {
+                return 1;
+            }
+            return len == lept_get_string_length(b) && memcmp(lept_get_string(a), lept_get_string(b), len) == 0;
+        case LEPT_ARRAY:
+            x = _array_of(a);
+            y = _array_of(b);
+            if (x == y) {
+                return 1;
+            }
+            if (x->len != y->len || _hashes_differ(&x->hash, &y->hash)) {
+                return 0;
+            }
+            for (i = 0; i < x->len; ++i) {
+                if (!_is_equal(&x->items[i], &y->items[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        case LEPT_OBJECT:
+            if (_object_of(a) == _object_of(b)) {
+                return 1;
+            }
+            if (a->value.o->len != b->value.o->len || _hashes_differ(&a->value.o->hash, &b->value.o->hash)) {
+                return 0;
+            }
+            /* members in the same order pair up in place, the rest are matched */
+            node = a->value.o->nodes;
+            other = b->value.o->nodes;
+            for (i = a->value.o->len; node != NULL && _same_key(node->key, other->key) &&
+                                      _is_equal(&node->value, &other->value); --i) {
+                node = node->next;
+                other = other->next;
+            }
+            return node == NULL || _match_members(node, other, i);
+        default:
+            return 1;
+    }
+}
+
+int lept_is_equal(const lept_value* a, const lept_value* b) {
+    assert(a != NULL);
+    assert(b != NULL);
+    return _is_equal(a, b);
+}
+
+/* the finalizer of MurmurHash3 */
+static uint64_t _mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+#define HASH_ROUND(h, p)                                     \
+    do {                                                     \
+        uint64_t w_;                                         \
+        memcpy(&w_, p, 8);                                   \
+        h ^= w_ * 0x87c37b91114253d5ull;                     \
+        h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937full; \
+    } while (0)
+
+/*
+ * Eight bytes at a time, in four independent lanes while 32 are left so
+ * long texts hash at the rate of the multiplier. The tail is read in loads
+ * that may overlap, as the length is hashed too.
+ */
+static uint64_t _hash_bytes(const char* p, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    uint64_t h1, h2, h3;
+    uint64_t w;
+    uint32_t lo, hi;
+    if (len >= 32) {
+        h1 = h + 1;
+        h2 = h + 2;
+        h3 = h + 3;
+        for (; len >= 32; p += 32, len -= 32) {
+            HASH_ROUND(h, p);
+            HASH_ROUND(h1, p + 8);
+            HASH_ROUND(h2, p + 16);
+            HASH_ROUND(h3, p + 24);
+        }
+        h = _mix64(h) + _mix64(h1 ^ 0x2545f4914f6cdd1dull) * 3 + _mix64(h2) * 5 + _mix64(h3) * 7;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        HASH_ROUND(h, p);
+    }
+    w = 0;
+    if (len >= 4) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + len - 4, 4);
+        w = (uint64_t)lo << 32 | hi;
+    } else if (len > 0) {
+        w = (uint64_t)(unsigned char)p[0] << 16 | (uint64_t)(unsigned char)p[len / 2] << 8 | (unsigned char)p[len - 1];
+    }
+    return _mix64(h ^ w);
+}
+
+#undef HASH_ROUND
+
+static uint64_t _hash_value(const lept_value* v);
+
+static uint64_t _hash_array(lept_array* a) {
+    uint64_t h = _cached_hash(&a->hash);
+    size_t i;
+    if (h != 0) {
+        return h;
+    }
+    h = 0x5a4d3c2b1a098776ull ^ a->len;
+    for (i = 0; i < a->len; ++i) {
+        h = _mix64(h + _hash_value(&a->items[i]));
+    }
+    h = (size_t)h != 0 ? (size_t)h : 1; /* 0 stands for not hashed */
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&a->hash, (size_t)h, __ATOMIC_RELAXED);
+#else
+    a->hash = (size_t)h;
+#endif
+    return (size_t)h;
+}
+
+/* a sum of the members, which does not depend on their order */
+static uint64_t _hash_object(lept_object* o) {
+    uint64_t h = _cached_hash(&o->hash);
+    const lept_object_node* node;
+    if (h != 0) {
+        return h;
+    }
+    h = 0;
+    for (node = o->nodes; node; node = node->next) {
+        h += _mix64(_string_hash(node->key) * 0x9e3779b97f4a7c15ull + _hash_value(&node->value));
+    }
+    h = _mix64(h ^ 0x3c6ef372fe94f82bull ^ o->len);
+    h = (size_t)h != 0 ? (size_t)h : 1;
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&o->hash, (size_t)h, __ATOMIC_RELAXED);
+#else
+    o->hash = (size_t)h;
+#endif
+    return (size_t)h;
+}
+
+static uint64_t _hash_value(const lept_value* v) {
+    double n;
+    uint64_t bits;
+    switch (v->type) {
+        case LEPT_NUMBER:
+            n = v->value.n == 0.0 ? 0.0 : v->value.n; /* -0 too */
+            memcpy(&bits, &n, sizeof(bits));
+            return _mix64(bits ^ LEPT_NUMBER);
+        case LEPT_STRING:
+            return _hash_bytes(lept_get_string(v), lept_get_string_length(v));
+        case LEPT_ARRAY:
+            return _hash_array(_array_of(v));
+        case LEPT_OBJECT:
+            return _hash_object(_object_of(v));
+        default:
+            return _mix64(v->type);
+    }
+}
+
+size_t lept_hash(const lept_value* v) {
+    assert(v != NULL);
+    return (size_t)_hash_value(v);
+}
+
+/*
+ * Parse cache. Entries sit in hash chains and on a list from the most to
+ * the least recently used. Parsing happens outside the lock, and a thread
+ * that loses the race to insert the same text keeps the winner's entry.
+ */
+
+typedef struct lept_cache_entry_s lept_cache_entry;
+
+struct lept_cache_entry_s {
+    lept_cache_entry* next;  /* in its hash chain */
+    lept_cache_entry* newer; /* toward the most recently used */
+    lept_cache_entry* older;
+    uint64_t hash;
+    lept_value value;
+    size_t bytes;            /* charged to the cache */
+    int is_file;
+    /* of a file, what stat() gave before it was read */
+    long long mtime, mtime_nsec, size, ino;
+    size_t len;
+    char text[1];            /* the text or the path, len bytes and '\0' */
+};
+
+struct lept_parse_cache_s {
+    lept_cache_entry** chains;
+    size_t mask;
+    lept_cache_entry* newest;
+    lept_cache_entry* oldest;
+    size_t max_bytes;
+    lept_parse_cache_stats stats;
+    const lept_allocator* allocator; /* the global one when created */
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+#ifdef LEPT_HAVE_THREADS
+#define CACHE_LOCK(c)   pthread_mutex_lock(&(c)->lock)
+#define CACHE_UNLOCK(c) pthread_mutex_unlock(&(c)->lock)
+#else
+#define CACHE_LOCK(c)   ((void)0)
+#define CACHE_UNLOCK(c) ((void)0)
+#endif
+
+/* what v holds on the heap, as _free_value() would release it */
+static size_t _value_bytes(const lept_value* v) {
+    const lept_array* a;
+    const lept_object_node* node;
+    size_t bytes = 0, i;
+    switch (v->type) {
+        case LEPT_STRING:
+            return v->short_spare == LEPT_LONG_STRING ? sizeof(lept_string) + v->value.s->len + 1 : 0;
+        case LEPT_ARRAY:
+            a = _array_of(v);
+            bytes = sizeof(lept_array) + a->capacity * sizeof(lept_value);
+            for (i = 0; i < a->len; ++i) {
+                bytes += _value_bytes(&a->items[i]);
+            }
+            return bytes;
+        case LEPT_OBJECT:
+            bytes = sizeof(lept_object);
+            for (node = _object_of(v)->nodes; node; node = node->next) {
+                bytes += sizeof(lept_object_node) + sizeof(lept_string) + node->key->len + 1 +
+                         _value_bytes(&node->value);
+            }
+            return bytes;
+        default:
+            return 0;
+    }
+}
+
+lept_parse_cache* lept_parse_cache_new(size_t max_bytes) {
+    lept_parse_cache* c = NEW(lept_parse_cache);
+    size_t i;
+    c->allocator = _allocator;
+    c->mask = 63;
+    c->chains = NEWN(c->mask + 1, lept_cache_entry*);
+    for (i = 0; i <= c->mask; ++i) {
+        c->chains[i] = NULL;
+    }
+    c->newest = c->oldest = NULL;
+    c->max_bytes = max_bytes;
+    c->stats.hits = c->stats.misses = c->stats.entries = c->stats.bytes = 0;
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_init(&c->lock, NULL);
+#endif
+    return c;
+}
+
+static void _cache_entry_free(lept_parse_cache* c, lept_cache_entry* e) {
+    _free_value(&e->value, _allocator);
+    AFREE(c->allocator, e);
+}
+
+void lept_parse_cache_free(lept_parse_cache* c) {
+    lept_cache_entry* e;
+    lept_cache_entry* older;
+    assert(c != NULL);
+    for (e = c->newest; e; e = older) {
+        older = e->older;
+        _cache_entry_free(c, e);
+    }
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_destroy(&c->lock);
+#endif
+    AFREE(c->allocator, c->chains);
+    AFREE(c->allocator, c);
+}
+
+void lept_parse_cache_get_stats(lept_parse_cache* c, lept_parse_cache_stats* stats) {
+    assert(c != NULL);
+    assert(stats != NULL);
+    CACHE_LOCK(c);
+    *stats = c->stats;
+    CACHE_UNLOCK(c);
+}
+
+static lept_cache_entry* _cache_find(lept_parse_cache* c, uint64_t hash, int is_file, const char* text, size_t len) {
+    lept_cache_entry* e;
+    for (e = c->chains[hash & c->mask]; e; e = e->next) {
+        if (e->hash == hash && e->is_file == is_file && e->len == len && memcmp(e->text, text, len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void _cache_unlist(lept_parse_cache* c, lept_cache_entry* e) {
+    *(e->newer != NULL ? &e->newer->older : &c->newest) = e->older;
+    *(e->older != NULL ? &e->older->newer : &c->oldest) = e->newer;
+}
+
+static void _cache_list_newest(lept_parse_cache* c, lept_cache_entry* e) {
+    e->newer = NULL;
+    e->older = c->newest;
+    *(c->newest != NULL ? &c->newest->newer : &c->oldest) = e;
+    c->newest = e;
+}
+
+static void _cache_remove(lept_parse_cache* c, lept_cache_entry* e) {
+    lept_cache_entry** p;
+    for (p = &c->chains[e->hash & c->mask]; *p != e; p = &(*p)->next);
+    *p = e->next;
+    _cache_unlist(c, e);
+    c->stats.bytes -= e->bytes;
+    --c->stats.entries;
+}
+
+/* the entry for the text of e if another thread put it in first, else NULL once e is in */
+static lept_cache_entry* _cache_insert(lept_parse_cache* c, lept_cache_entry* e) {
+    lept_cache_entry** chains;
+    lept_cache_entry* other;
+    lept_cache_entry* next;
+    size_t mask, i;
+    if ((other = _cache_find(c, e->hash, e->is_file, e->text, e->len)) != NULL) {
+        return other;
+    }
+    if (c->stats.entries > c->mask) { /* keep the chains short */
+        mask = c->mask * 2 + 1;
+        chains = (lept_cache_entry**)AMALLOC(c->allocator, (mask + 1) * sizeof(lept_cache_entry*));
+        for (i = 0; i <= mask; ++i) {
+            chains[i] = NULL;
+        }
+        for (i = 0; i <= c->mask; ++i) {
+            for (other = c->chains[i]; other; other = next) {
+                next = other->next;
+                other->next = chains[other->hash & mask];
+                chains[other->hash & mask] = other;
+            }
+        }
+        AFREE(c->allocator, c->chains);
+        c->chains = chains;
+        c->mask = mask;
+    }
+    e->next = c->chains[e->hash & c->mask];
+    c->chains[e->hash & c->mask] = e;
+    _cache_list_newest(c, e);
+    c->stats.bytes += e->bytes;
+    ++c->stats.entries;
+    while (c->stats.bytes > c->max_bytes && c->oldest != e) {
+        other = c->oldest;
+        _cache_remove(c, other);
+        _cache_entry_free(c, other);
+    }
+    return NULL;
+}
+
+/* a copy of the document in the entry, most recently used from now on */
+static void _cache_hit(lept_parse_cache* c, lept_cache_entry* e, lept_value* v) {
+    _cache_unlist(c, e);
+    _cache_list_newest(c, e);
+    lept_copy(v, &e->value);
+    ++c->stats.hits;
+}
+
+/* keeps a copy of the document just parsed into v, unless it is too big */
+static void _cache_keep(lept_parse_cache* c, uint64_t hash, int is_file, const char* text, size_t len,
+                        const long long* stamp, lept_value* v) {
+    lept_cache_entry* e;
+    lept_cache_entry* other;
+    size_t bytes = sizeof(lept_cache_entry) + len + _value_bytes(v);
+    if (bytes > c->max_bytes) {
+        return;
+    }
+    e = (lept_cache_entry*)AMALLOC(c->allocator, sizeof(lept_cache_entry) + len);
+    e->hash = hash;
+    e->is_file = is_file;
+    e->bytes = bytes;
+    e->len = len;
+    memcpy(e->text, text, len);
+    e->text[len] = '\0';
+    if (stamp != NULL) {
+        e->mtime = stamp[0];
+        e->mtime_nsec = stamp[1];
+        e->size = stamp[2];
+        e->ino = stamp[3];
+    }
+    lept_copy(&e->value, v);
+    CACHE_LOCK(c);
+    other = _cache_insert(c, e);
+    CACHE_UNLOCK(c);
+    if (other != NULL) {
+        _cache_entry_free(c, e);
+    }
+}
+
+int lept_parse_cached(lept_parse_cache* c, lept_value* v, const char* json, size_t len) {
+    uint64_t hash;
+    lept_cache_entry* e;
+    int ret;
+    assert(c != NULL);
+    assert(v != NULL);
+    assert(json != NULL || len == 0);
+    hash = _hash_bytes(json, len);
+    CACHE_LOCK(c);
+    if ((e = _cache_find(c, hash, 0, json, len)) != NULL) {
+        _cache_hit(c, e, v);
+        CACHE_UNLOCK(c);
+        return LEPT_PARSE_OK;
+    }
+    ++c->stats.misses;
+    CACHE_UNLOCK(c);
+    if ((ret = lept_parse_n(v, json, len)) == LEPT_PARSE_OK) {
+        _cache_keep(c, hash, 0, json, len, NULL, v);
+    }
+    return ret;
+}
+
+int lept_parse_file_cached(lept_parse_cache* c, lept_value* v, const char* path) {
+#ifdef LEPT_HAVE_MMAP
+    struct stat st;
+    long long stamp[4];
+    uint64_t hash;
+    lept_cache_entry* e;
+    size_t len;
+    int ret;
+    assert(c != NULL);
+    assert(v != NULL);
+    assert(path != NULL);
+    if (stat(path, &st) != 0) {
+        return LEPT_FILE_CANNOT_OPEN;
+    }
+    /* a change after stat() leaves a stamp that the next call finds out of date */
+    stamp[0] = (long long)st.st_mtime;
+#ifdef __APPLE__
+    stamp[1] = 0; /* st_mtim is not there without _DARWIN_C_SOURCE */
+#else
+    stamp[1] = (long long)st.st_mtim.tv_nsec;
+#endif
+    stamp[2] = (long long)st.st_size;
+    stamp[3] = (long long)st.st_ino;
+    len = strlen(path);
+    hash = _hash_bytes(path, len);
+    CACHE_LOCK(c);
+    if ((e = _cache_find(c, hash, 1, path, len)) != NULL) {
+        if (e->mtime == stamp[0] && e->mtime_nsec == stamp[1] && e->size == stamp[2] && e->ino == stamp[3]) {
+            _cache_hit(c, e, v);
+            CACHE_UNLOCK(c);
+            return LEPT_PARSE_OK;
+        }
+        _cache_remove(c, e);
+    }
+    ++c->stats.misses;
+    CACHE_UNLOCK(c);
+    if (e != NULL) {
+        _cache_entry_free(c, e);
+    }
+    if ((ret = lept_parse_file(v, path)) == LEPT_PARSE_OK) {
+        _cache_keep(c, hash, 1, path, len, stamp, v);
+    }
+    return ret;
+#else
+    assert(c != NULL);
+    (void)c;
+    return lept_parse_file(v, path); /* no modification time to check */
+#endif
+}
+
+#undef CACHE_LOCK
+#undef CACHE_UNLOCK
+
+/*
+ * Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers"): the shortest digits that read back as the
+ * same double in nearly all cases, and always digits that round-trip.
+ */
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT     (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK    UINT64_C(0x7FF0000000000000)
+#define DP_SIGNIFICAND_MASK UINT64_C(0x000FFFFFFFFFFFFF)
+#define DP_HIDDEN_BIT       UINT64_C(0x0010000000000000)
+
+typedef struct diy_fp_s {
+    uint64_t f;
+    int e;
+} diy_fp;
+
+static const uint32_t _pow10_32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static diy_fp _diy_fp(uint64_t f, int e) {
+    diy_fp r;
+    r.f = f;
+    r.e = e;
+    return r;
+}
+
+static diy_fp _diy_fp_from_double(double d) {
+    uint64_t u;
+    int biased_e;
+    memcpy(&u, &d, sizeof(double));
+    biased_e = (int)((u & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    if (biased_e != 0) {
+        return _diy_fp((u & DP_SIGNIFICAND_MASK) + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS);
+    }
+    return _diy_fp(u & DP_SIGNIFICAND_MASK, DP_MIN_EXPONENT + 1); /* denormal */
+}
+
+static diy_fp _diy_fp_multiply(diy_fp x, diy_fp y) {
+    uint64_t hi, lo;
+    _mul_64x64(x.f, y.f, &hi, &lo);
+    return _diy_fp(hi + (lo >> 63), x.e + y.e + 64); /* rounded */
+}
+
+static diy_fp _diy_fp_normalize(diy_fp x) {
+    int shift = _leading_zeros_64(x.f);
+    return _diy_fp(x.f << shift, x.e - shift);
+}
+
+/* the boundaries halfway to the neighbouring doubles, sharing the exponent of plus */
+static void _diy_fp_boundaries(diy_fp v, diy_fp* minus, diy_fp* plus) {
+    *plus = _diy_fp_normalize(_diy_fp((v.f << 1) + 1, v.e - 1));
+    if (v.f == DP_HIDDEN_BIT) { /* the lower neighbour is closer */
+        *minus = _diy_fp((v.f << 2) - 1, v.e - 2);
+    } else {
+        *minus = _diy_fp((v.f << 1) - 1, v.e - 1);
+    }
+    minus->f <<= minus->e - plus->e;
+    minus->e = plus->e;
+}
+
+/* a cached 10^-k that brings a number with binary exponent e into [2^-60, 2^-32) */
+static diy_fp _cached_power(int e, int* k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347; /* log10(2), kept positive for the ceiling */
+    int ceil_k = (int)dk;
+    unsigned index;
+    if (ceil_k != dk) {
+        ++ceil_k;
+    }
+    index = (unsigned)((ceil_k >> 3) + 1);
+    *k = -(LEPT_CACHED_POW10_MIN_EXP + (int)(index * LEPT_CACHED_POW10_STEP));
+    return _diy_fp(lept_cached_pow10_f[index], lept_cached_pow10_e[index]);
+}
+
+static void _grisu_round(char* buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        --buffer[len - 1];
+        rest += ten_kappa;
+    }
+}
+
+static void _grisu_digits(diy_fp w, diy_fp mp, uint64_t delta, char* buffer, int* len, int* k) {
+    const diy_fp one = _diy_fp(UINT64_C(1) << -mp.e, mp.e);
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    uint64_t rest;
+    int kappa = 1;
+    uint32_t d;
+    while (kappa < 10 && p1 >= _pow10_32[kappa]) {
+        ++kappa;
+    }
+    *len = 0;
+    while (kappa > 0) { /* integral part */
+        d = p1 / _pow10_32[kappa - 1];
+        p1 %= _pow10_32[kappa - 1];
+        if (d || *len) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        --kappa;
+        rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            _grisu_round(buffer, *len, delta, rest, (uint64_t)_pow10_32[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+    for (;;) { /* fractional part */
+        p2 *= 10;
+        delta *= 10;
+        d = (uint32_t)(p2 >> -one.e);
+        if (d || *len) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        --kappa;
+        if (p2 < delta) {
+            *k += kappa;
+            _grisu_round(buffer, *len, delta, p2, one.f, wp_w * (-kappa < 10 ? _pow10_32[-kappa] : 0));
+            return;
+        }
+    }
+}
+
+/* digits of a positive finite d and their decimal exponent: d ~ buffer * 10^k */
+static void _grisu2(double d, char* buffer, int* len, int* k) {
+    diy_fp v = _diy_fp_from_double(d);
+    diy_fp w_minus, w_plus, c_mk, w, wp, wm;
+    _diy_fp_boundaries(v, &w_minus, &w_plus);
+    c_mk = _cached_power(w_plus.e, k);
+    w = _diy_fp_multiply(_diy_fp_normalize(v), c_mk);
+    wp = _diy_fp_multiply(w_plus, c_mk);
+    wm = _diy_fp_multiply(w_minus, c_mk);
+    ++wm.f;
+    --wp.f;
+    _grisu_digits(w, wp, wp.f - wm.f, buffer, len, k);
+}
+
+static char* _write_exponent(int k, char* p) {
+    *p++ = 'e';
+    if (k < 0) {
+        *p++ = '-';
+        k = -k;
+    }
+    if (k >= 100) {
+        *p++ = (char)('0' + k / 100);
+        k %= 100;
+        *p++ = (char)('0' + k / 10);
+    } else if (k >= 10) {
+        *p++ = (char)('0' + k / 10);
+    }
+    *p++ = (char)('0' + k % 10);
+    return p;
+}
+
+/* lays out len digits times 10^k as an integer, a fraction or in exponent form */
+static char* _prettify(char* buffer, int len, int k) {
+    const int kk = len + k; /* 10^(kk - 1) <= v < 10^kk */
+    int i;
+    if (k >= 0 && kk <= 21) { /* 1234e7 -> 12340000000 */
+        for (i = len; i < kk; ++i) {
+            buffer[i] = '0';
+        }
+        return buffer + kk;
+    } else if (kk > 0 && kk <= 21) { /* 1234e-2 -> 12.34 */
+        memmove(buffer + kk + 1, buffer + kk, len - kk);
+        buffer[kk] = '.';
+        return buffer + len + 1;
+    } else if (kk > -6 && kk <= 0) { /* 1234e-6 -> 0.001234 */
+        const int offset = 2 - kk;
+        memmove(buffer + offset, buffer, len);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        for (i = 2; i < offset; ++i) {
+            buffer[i] = '0';
+        }
+        return buffer + len + offset;
+    } else if (len == 1) { /* 1e30 */
+        return _write_exponent(kk - 1, buffer + 1);
+    } else { /* 1234e30 -> 1.234e33 */
+        memmove(buffer + 2, buffer + 1, len - 1);
+        buffer[1] = '.';
+        return _write_exponent(kk - 1, buffer + len + 1);
+    }
+}
+
+#ifndef LEPT_BUFFER_INIT_SIZE
+#define LEPT_BUFFER_INIT_SIZE 256
+#endif
+
+#define MAX_NUMBER_LENGTH 32 /* "-1.2345678901234567e-308" and the like */
+
+typedef struct lept_stringify_context_s {
+    lept_buffer* b;
+    lept_scan_func scan_string;
+    int pretty;
+} lept_stringify_context;
+
+/* room for n more bytes and the terminating '\0' */
+static char* _buffer_grow(lept_buffer* b, size_t n) {
+    if (b->len + n + 1 > b->capacity) {
+        size_t capacity = b->capacity != 0 ? b->capacity : LEPT_BUFFER_INIT_SIZE;
+        while (capacity < b->len + n + 1) {
+            capacity += capacity >> 1; /* capacity * 1.5 */
+        }
+        b->data = (char*)REALLOC(b->data, capacity);
+        b->capacity = capacity;
+    }
+    return b->data + b->len;
+}
+
+#define PUTS(s, n) do { memcpy(_buffer_grow(c->b, n), s, n); c->b->len += (n); } while (0)
+#define PUTCH(ch)  do { *_buffer_grow(c->b, 1) = (ch); ++c->b->len; } while (0)
+
+/* the character after the backslash that escapes a byte, 0 if it needs none */
+static const char _escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u', /* 0x00 */
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', /* 0x10 */
+     0,   0,  '"',  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  /* 0x20 */
+     0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  /* 0x30 */
+     0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  /* 0x40 */
+     0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, '\\',  0,   0,   0   /* 0x50 */
+};
+
+static void _stringify_string(lept_stringify_context* c, const char* s, size_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+    const char* end = s + len;
+    const char* span;
+    char* p;
+    PUTCH('"');
+    while (s != end) {
+        /* bulk copy the run that needs no escaping */
+        span = s;
+        s = c->scan_string(span, end);
+        if (s != span) {
+            PUTS(span, (size_t)(s - span));
+        }
+        if (s == end) {
+            break;
+        }
+        p = _buffer_grow(c->b, 6);
+        *p++ = '\\';
+        *p++ = _escape[(unsigned char)*s];
+        if (p[-1] == 'u') {
+            *p++ = '0';
+            *p++ = '0';
+            *p++ = hex[(unsigned char)*s >> 4];
+            *p++ = hex[(unsigned char)*s & 0xF];
+        }
+        c->b->len = p - c->b->data;
+        ++s;
+    }
+    PUTCH('"');
+}
+
+static int _stringify_number(lept_stringify_context* c, double d) {
+    char* buffer;
+    char* p;
+    int len, k;
+    if (d != d || d == HUGE_VAL || d == -HUGE_VAL) { /* NaN or infinity */
+        return LEPT_STRINGIFY_INVALID_VALUE;
+    }
+    p = buffer = _buffer_grow(c->b, MAX_NUMBER_LENGTH);
+    if (d == 0.0) {
+        if (1 / d < 0) {
+            *p++ = '-';
+        }
+        *p++ = '0';
+    } else {
+        if (d < 0) {
+            *p++ = '-';
+            d = -d;
+        }
+        _grisu2(d, p, &len, &k);
+        p = _prettify(p, len, k);
+    }
+    c->b->len += p - buffer;
+    return LEPT_STRINGIFY_OK;
+}
+
+static void _stringify_indent(lept_stringify_context* c, int depth) {
+    char* p;
+    if (c->pretty) {
+        p = _buffer_grow(c->b, 1 + depth * 4);
+        *p++ = '\n';
+        memset(p, ' ', depth * 4);
+        c->b->len += 1 + depth * 4;
+    }
+}
+
+static int _stringify_value(lept_stringify_context* c, const lept_value* v, int depth) {
+    const lept_array* a;
+    const lept_object* o;
+    const lept_object_node* node;
+    size_t i;
+    int ret;
+    switch (v->type) {
+        case LEPT_NULL:  PUTS("null", 4);  break;
+        case LEPT_FALSE: PUTS("false", 5); break;
+        case LEPT_TRUE:  PUTS("true", 4);  break;
+        case LEPT_NUMBER:
+            return _stringify_number(c, v->value.n);
+        case LEPT_STRING:
+            _stringify_string(c, lept_get_string(v), lept_get_string_length(v));
+            break;
+        case LEPT_ARRAY:
+            a = _array_of(v);
+            PUTCH('[');
+            for (i = 0; i < a->len; ++i) {
+                if (i > 0) {
+                    PUTCH(',');
+                }
+                _stringify_indent(c, depth + 1);
+                if ((ret = _stringify_value(c, &a->items[i], depth + 1)) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            if (a->len > 0) {
+                _stringify_indent(c, depth);
+            }
+            PUTCH(']');
+            break;
+        case LEPT_OBJECT:
+            o = _object_of(v);
+            PUTCH('{');
+            for (node = o->nodes; node; node = node->next) {
+                if (node != o->nodes) {
+                    PUTCH(',');
+                }
+                _stringify_indent(c, depth + 1);
+                _stringify_string(c, node->key->str, node->key->len);
+                if (c->pretty) {
+                    PUTS(": ", 2);
+                } else {
+                    PUTCH(':');
+                }
+                if ((ret = _stringify_value(c, &node->value, depth + 1)) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            if (o->nodes != NULL) {
+                _stringify_indent(c, depth);
+            }
+            PUTCH('}');
+            break;
+        default:
+            return LEPT_STRINGIFY_INVALID_VALUE;
+    }
+    return LEPT_STRINGIFY_OK;
+}
+
+static int _stringify(const lept_value* v, lept_buffer* b, int pretty) {
+    lept_stringify_context c;
+    lept_scan_func skip_whitespace;
+    size_t head;
+    int ret;
+    assert(v != NULL);
+    assert(b != NULL);
+    c.b = b;
+    c.pretty = pretty;
+    _select_scan_funcs(&skip_whitespace, &c.scan_string, 0); /* strings go out as they are */
+    head = b->len;
+    if ((ret = _stringify_value(&c, v, 0)) != LEPT_STRINGIFY_OK) {
+        b->len = head; /* drop the partial output */
+    }
+    _buffer_grow(b, 0);
+    b->data[b->len] = '\0';
+    return ret;
+}
+
+int lept_stringify(const lept_value* v, lept_buffer* b) {
+    return _stringify(v, b, 0);
+}
+
+int lept_stringify_pretty(const lept_value* v, lept_buffer* b) {
+    return _stringify(v, b, 1);
+}
+
+void lept_buffer_init(lept_buffer* b) {
+    assert(b != NULL);
+    b->data = NULL;
+    b->len = 0;
+    b->capacity = 0;
+}
+
+void lept_buffer_reset(lept_buffer* b) {
+    assert(b != NULL);
+    b->len = 0;
+    if (b->data != NULL) {
+        b->data[0] = '\0';
+    }
+}
+
+void lept_buffer_free(lept_buffer* b) {
+    assert(b != NULL);
+    FREE(b->data);
+    lept_buffer_init(b);
+}
+
+/*
+ * Binary encodings. The encoders append to a buffer like lept_stringify(),
+ * numbers holding an integer take the shortest integer form and others a
+ * 64-bit float. The decoders read with a parse context and report to the
+ * DOM handler, so values are allocated as lept_parse_opts() would.
+ */
+
+/* append the low n bytes of x, most significant first */
+static void _put_be(lept_stringify_context* c, uint64_t x, int n) {
+    char* p = _buffer_grow(c->b, n);
+    int i;
+    for (i = n - 1; i >= 0; --i) {
+        p[i] = (char)(x & 0xFF);
+        x >>= 8;
+    }
+    c->b->len += n;
+}
+
+static void _put_double(lept_stringify_context* c, int tag, double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(double));
+    PUTCH((char)tag);
+    _put_be(c, bits, 8);
+}
+
+/* d without a fraction, in the range of int64_t and not -0.0 */
+static int _as_integer(double d, int64_t* i) {
+    if (d >= -9223372036854775808.0 && d < 9223372036854775808.0 && d == (double)(int64_t)d &&
+        !(d == 0.0 && 1 / d < 0)) {
+        *i = (int64_t)d;
+        return 1;
+    }
+    return 0;
+}
+
+/* the fix form holds lengths up to fix_max, then 16 and 32-bit lengths follow tag16 */
+static void _msgpack_head(lept_stringify_context* c, int fix, size_t fix_max, int tag16, size_t len) {
+    if (len <= fix_max) {
+        PUTCH((char)(fix | len));
+    } else if (len <= 0xFFFF) {
+        PUTCH((char)tag16);
+        _put_be(c, len, 2);
+    } else {
+        PUTCH((char)(tag16 + 1));
+        _put_be(c, len, 4);
+    }
+}
+
+static void _msgpack_number(lept_stringify_context* c, double d) {
+    int64_t i;
+    if (!_as_integer(d, &i)) {
+        _put_double(c, 0xCB, d);
+    } else if (i >= 0) {
+        uint64_t u = (uint64_t)i;
+        if (u < 0x80) {
+            PUTCH((char)u);
+        } else if (u <= 0xFF) {
+            PUTCH((char)0xCC);
+            _put_be(c, u, 1);
+        } else if (u <= 0xFFFF) {
+            PUTCH((char)0xCD);
+            _put_be(c, u, 2);
+        } else if (u <= 0xFFFFFFFF) {
+            PUTCH((char)0xCE);
+            _put_be(c, u, 4);
+        } else {
+            PUTCH((char)0xCF);
+            _put_be(c, u, 8);
+        }
+    } else if (i >= -32) {
+        PUTCH((char)i);
+    } else if (i >= -0x80) {
+        PUTCH((char)0xD0);
+        _put_be(c, (uint64_t)i, 1);
+    } else if (i >= -0x8000) {
+        PUTCH((char)0xD1);
+        _put_be(c, (uint64_t)i, 2);
+    } else if (i >= -0x7FFFFFFF - 1) {
+        PUTCH((char)0xD2);
+        _put_be(c, (uint64_t)i, 4);
+    } else {
+        PUTCH((char)0xD3);
+        _put_be(c, (uint64_t)i, 8);
+    }
+}
+
+static void _msgpack_string(lept_stringify_context* c, const char* s, size_t len) {
+    if (len > 31 && len <= 0xFF) {
+        PUTCH((char)0xD9);
+        _put_be(c, len, 1);
+    } else {
+        _msgpack_head(c, 0xA0, 31, 0xDA, len);
+    }
+    PUTS(s, len);
+}
+
+static int _msgpack_value(lept_stringify_context* c, const lept_value* v) {
+    const lept_array* a;
+    const lept_object* o;
+    const lept_object_node* node;
+    size_t i;
+    int ret;
+    switch (v->type) {
+        case LEPT_NULL:  PUTCH((char)0xC0); break;
+        case LEPT_FALSE: PUTCH((char)0xC2); break;
+        case LEPT_TRUE:  PUTCH((char)0xC3); break;
+        case LEPT_NUMBER:
+            _msgpack_number(c, v->value.n);
+            break;
+        case LEPT_STRING:
+            _msgpack_string(c, lept_get_string(v), lept_get_string_length(v));
+            break;
+        case LEPT_ARRAY:
+            a = _array_of(v);
+            _msgpack_head(c, 0x90, 15, 0xDC, a->len);
+            for (i = 0; i < a->len; ++i) {
+                if ((ret = _msgpack_value(c, &a->items[i])) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            break;
+        case LEPT_OBJECT:
+            o = _object_of(v);
+            _msgpack_head(c, 0x80, 15, 0xDE, o->len);
+            for (node = o->nodes; node; node = node->next) {
+                _msgpack_string(c, node->key->str, node->key->len);
+                if ((ret = _msgpack_value(c, &node->value)) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            break;
+        default:
+            return LEPT_STRINGIFY_INVALID_VALUE;
+    }
+    return LEPT_STRINGIFY_OK;
+}
+
+/* the major type in the top 3 bits, arguments below 24 fit in the rest */
+static void _cbor_head(lept_stringify_context* c, int major, uint64_t arg) {
+    major <<= 5;
+    if (arg < 24) {
+        PUTCH((char)(major | arg));
+    } else if (arg <= 0xFF) {
+        PUTCH((char)(major | 24));
+        _put_be(c, arg, 1);
+    } else if (arg <= 0xFFFF) {
+        PUTCH((char)(major | 25));
+        _put_be(c, arg, 2);
+    } else if (arg <= 0xFFFFFFFF) {
+        PUTCH((char)(major | 26));
+        _put_be(c, arg, 4);
+    } else {
+        PUTCH((char)(major | 27));
+        _put_be(c, arg, 8);
+    }
+}
+
+static int _cbor_value(lept_stringify_context* c, const lept_value* v) {
+    const lept_array* a;
+    const lept_object* o;
+    const lept_object_node* node;
+    int64_t n;
+    size_t i;
+    int ret;
+    switch (v->type) {
+        case LEPT_NULL:  PUTCH((char)0xF6); break;
+        case LEPT_FALSE: PUTCH((char)0xF4); break;
+        case LEPT_TRUE:  PUTCH((char)0xF5); break;
+        case LEPT_NUMBER:
+            if (!_as_integer(v->value.n, &n)) {
+                _put_double(c, 0xFB, v->value.n);
+            } else if (n >= 0) {
+                _cbor_head(c, 0, (uint64_t)n);
+            } else {
+                _cbor_head(c, 1, (uint64_t)(-1 - n));
+            }
+            break;
+        case LEPT_STRING:
+            _cbor_head(c, 3, lept_get_string_length(v));
+            PUTS(lept_get_string(v), lept_get_string_length(v));
+            break;
+        case LEPT_ARRAY:
+            a = _array_of(v);
+            _cbor_head(c, 4, a->len);
+            for (i = 0; i < a->len; ++i) {
+                if ((ret = _cbor_value(c, &a->items[i])) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            break;
+        case LEPT_OBJECT:
+            o = _object_of(v);
+            _cbor_head(c, 5, o->len);
+            for (node = o->nodes; node; node = node->next) {
+                _cbor_head(c, 3, node->key->len);
+                PUTS(node->key->str, node->key->len);
+                if ((ret = _cbor_value(c, &node->value)) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            break;
+        default:
+            return LEPT_STRINGIFY_INVALID_VALUE;
+    }
+    return LEPT_STRINGIFY_OK;
+}
+
+static int _encode(const lept_value* v, lept_buffer* b, int (*encode)(lept_stringify_context*, const lept_value*)) {
+    lept_stringify_context c;
+    size_t head;
+    int ret;
+    assert(v != NULL);
+    assert(b != NULL);
+    c.b = b;
+    head = b->len;
+    if ((ret = encode(&c, v)) != LEPT_STRINGIFY_OK) {
+        b->len = head;
+    }
+    _buffer_grow(b, 0);
+    b->data[b->len] = '\0';
+    return ret;
+}
+
+int lept_to_msgpack(const lept_value* v, lept_buffer* b) {
+    return _encode(v, b, _msgpack_value);
+}
+
+int lept_to_cbor(const lept_value* v, lept_buffer* b) {
+    return _encode(v, b, _cbor_value);
+}
+
+/* read an n byte big-endian argument, 0 if the input ends first */
+static int _get_be(lept_context* c, int n, uint64_t* x) {
+    if (c->end - c->json < n) {
+        return 0;
+    }
+    for (*x = 0; n > 0; --n) {
+        *x = *x << 8 | (unsigned char)*c->json++;
+    }
+    return 1;
+}
+
+static double _bits_to_double(uint64_t bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(double));
+    return d;
+}
+
+static double _float_to_double(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+static double _half_to_double(unsigned half) {
+    int exp = (half >> 10) & 0x1F;
+    double mant = half & 0x3FF;
+    double d = exp == 0  ? ldexp(mant, -24) :
+               exp != 31 ? ldexp(mant + 1024, exp - 25) :
+               mant == 0 ? HUGE_VAL : HUGE_VAL - HUGE_VAL;
+    return half & 0x8000 ? -d : d;
+}
+
+/* a string of len bytes at the read position, which is passed over */
+static int _binary_string(lept_context* c, uint64_t len, int key) {
+    const char* s = c->json;
+    if ((uint64_t)(c->end - c->json) < len) {
+        return LEPT_PARSE_UNCLOSED_QUOTES;
+    }
+    c->json += len;
+    return key ? CALL(on_key, s, (size_t)len) : CALL(on_string, s, (size_t)len);
+}
+
+static int _msgpack_parse_value(lept_context* c);
+
+/* the key of a member, msgpack and CBOR only take string keys here */
+static int _msgpack_parse_key(lept_context* c) {
+    unsigned char tag = (unsigned char)*c->json++;
+    uint64_t len;
+    if ((tag & 0xE0) == 0xA0) {
+        return _binary_string(c, tag & 0x1F, 1);
+    }
+    if (tag < 0xD9 || tag > 0xDB) {
+        return LEPT_PARSE_INVALID_VALUE;
+    }
+    if (!_get_be(c, 1 << (tag - 0xD9), &len)) {
+        return LEPT_PARSE_UNCLOSED_QUOTES;
+    }
+    return _binary_string(c, len, 1);
+}
+
+/* the decoders recurse, the depth limit keeps that bounded */
+static int _binary_open(lept_context* c, int object) {
+    if (c->depth >= c->max_depth) {
+        return LEPT_PARSE_TOO_DEEP;
+    }
+    ++c->depth;
+    return object ? CALL0(on_start_object) : CALL0(on_start_array);
+}
+
+static int _binary_close(lept_context* c, int object, size_t len) {
+    --c->depth;
+    return object ? CALL(on_end_object, len) : CALL(on_end_array, len);
+}
+
+static int _msgpack_parse_container(lept_context* c, uint64_t len, int object) {
+    uint64_t i;
+    int ret;
+    if ((ret = _binary_open(c, object)) != LEPT_PARSE_OK) {
+        return ret;
+    }
+    for (i = 0; i < len; ++i) {
+        if (c->json == c->end) {
+            return LEPT_PARSE_UNCLOSED_BRACKETS;
+        }
+        if (object && (ret = _msgpack_parse_key(c)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+        if (object && c->json == c->end) {
+            return LEPT_PARSE_UNCLOSED_BRACKETS;
+        }
+        if ((ret = _msgpack_parse_value(c)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+    }
+    return _binary_close(c, object, (size_t)len);
+}
+
+static int _msgpack_parse_value(lept_context* c) {
+    unsigned char tag;
+    uint64_t x;
+    if (c->json == c->end) {
+        return LEPT_PARSE_EXPECT_VALUE;
+    }
+    tag = (unsigned char)*c->json++;
+    if (tag < 0x80) {
+        return CALL(on_number, (double)tag);
+    } else if (tag >= 0xE0) {
+        return CALL(on_number, (double)(tag - 0x100));
+    } else if (tag < 0x90) {
+        return _msgpack_parse_container(c, tag & 0x0F, 1);
+    } else if (tag < 0xA0) {
+        return _msgpack_parse_container(c, tag & 0x0F, 0);
+    } else if (tag < 0xC0) {
+        return _binary_string(c, tag & 0x1F, 0);
+    }
+    switch (tag) {
+        case 0xC0: return CALL0(on_null);
+        case 0xC2: return CALL(on_bool, 0);
+        case 0xC3: return CALL(on_bool, 1);
+        case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+            /* float 32 and 64, then unsigned and signed ints of 1 to 8 bytes */
+            if (!_get_be(c, tag <= 0xCB ? 4 << (tag - 0xCA) : 1 << ((tag - 0xCC) & 3), &x)) {
+                return LEPT_PARSE_INVALID_VALUE;
+            }
+            switch (tag) {
+                case 0xCA: return CALL(on_number, _float_to_double((uint32_t)x));
+                case 0xCB: return CALL(on_number, _bits_to_double(x));
+                case 0xD0: return CALL(on_number, (double)(int8_t)x);
+                case 0xD1: return CALL(on_number, (double)(int16_t)x);
+                case 0xD2: return CALL(on_number, (double)(int32_t)x);
+                case 0xD3: return CALL(on_number, (double)(int64_t)x);
+                default:   return CALL(on_number, (double)x);
+            }
+        case 0xD9: case 0xDA: case 0xDB:
+            if (!_get_be(c, 1 << (tag - 0xD9), &x)) {
+                return LEPT_PARSE_UNCLOSED_QUOTES;
+            }
+            return _binary_string(c, x, 0);
+        case 0xDC: case 0xDD: case 0xDE: case 0xDF:
+            if (!_get_be(c, 2 << (tag & 1), &x)) {
+                return LEPT_PARSE_UNCLOSED_BRACKETS;
+            }
+            return _msgpack_parse_container(c, x, tag >= 0xDE);
+        default: /* bin, ext and the unused tag */
+            return LEPT_PARSE_INVALID_VALUE;
+    }
+}
+
+#define CBOR_INDEFINITE UINT64_MAX
+#define CBOR_BREAK      0xFF
+
+/* the argument following an initial byte, CBOR_INDEFINITE for 31 */
+static int _cbor_arg(lept_context* c, unsigned char initial, uint64_t* arg) {
+    int info = initial & 0x1F;
+    if (info < 24) {
+        *arg = (uint64_t)info;
+    } else if (info < 28) {
+        return _get_be(c, 1 << (info - 24), arg);
+    } else if (info == 31) {
+        *arg = CBOR_INDEFINITE;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int _cbor_parse_value(lept_context* c);
+
+static int _cbor_parse_key(lept_context* c) {
+    unsigned char initial = (unsigned char)*c->json++;
+    uint64_t len;
+    if (initial >> 5 != 3 || !_cbor_arg(c, initial, &len) || len == CBOR_INDEFINITE) {
+        return LEPT_PARSE_INVALID_VALUE;
+    }
+    return _binary_string(c, len, 1);
+}
+
+/* counts of CBOR_INDEFINITE run until a break byte */
+static int _cbor_parse_container(lept_context* c, uint64_t count, int object) {
+    size_t len = 0;
+    int ret;
+    if ((ret = _binary_open(c, object)) != LEPT_PARSE_OK) {
+        return ret;
+    }
+    for (; count == CBOR_INDEFINITE || len < count; ++len) {
+        if (c->json == c->end) {
+            return LEPT_PARSE_UNCLOSED_BRACKETS;
+        }
+        if (count == CBOR_INDEFINITE && (unsigned char)*c->json == CBOR_BREAK) {
+            ++c->json;
+            break;
+        }
+        if (object && (ret = _cbor_parse_key(c)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+        if (object && c->json == c->end) {
+            return LEPT_PARSE_UNCLOSED_BRACKETS;
+        }
+        if ((ret = _cbor_parse_value(c)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+    }
+    return _binary_close(c, object, len);
+}
+
+static int _cbor_parse_value(lept_context* c) {
+    unsigned char initial;
+    uint64_t arg;
+    if (c->json == c->end) {
+        return LEPT_PARSE_EXPECT_VALUE;
+    }
+    initial = (unsigned char)*c->json++;
+    if (!_cbor_arg(c, initial, &arg)) {
+        return initial >> 5 == 3 ? LEPT_PARSE_UNCLOSED_QUOTES :
+               initial >> 5 >= 4 && initial >> 5 <= 5 ? LEPT_PARSE_UNCLOSED_BRACKETS : LEPT_PARSE_INVALID_VALUE;
+    }
+    switch (initial >> 5) {
+        case 0:
+            return arg == CBOR_INDEFINITE ? LEPT_PARSE_INVALID_VALUE : CALL(on_number, (double)arg);
+        case 1:
+            return arg == CBOR_INDEFINITE ? LEPT_PARSE_INVALID_VALUE : CALL(on_number, -1.0 - (double)arg);
+        case 3: /* chunked text is not supported */
+            return arg == CBOR_INDEFINITE ? LEPT_PARSE_INVALID_VALUE : _binary_string(c, arg, 0);
+        case 4:
+            return _cbor_parse_container(c, arg, 0);
+        case 5:
+            return _cbor_parse_container(c, arg, 1);
+        case 7:
+            switch (initial & 0x1F) {
+                case 20: return CALL(on_bool, 0);
+                case 21: return CALL(on_bool, 1);
+                case 22: return CALL0(on_null);
+                case 25: return CALL(on_number, _half_to_double((unsigned)arg));
+                case 26: return CALL(on_number, _float_to_double((uint32_t)arg));
+                case 27: return CALL(on_number, _bits_to_double(arg));
+            }
+            return LEPT_PARSE_INVALID_VALUE; /* undefined and other simple values */
+        default: /* byte strings and tags */
+            return LEPT_PARSE_INVALID_VALUE;
+    }
+}
+
+#undef CBOR_INDEFINITE
+#undef CBOR_BREAK
+
+static int _decode(lept_value* v, const char* data, size_t len, const lept_parse_options* opts,
+                   int (*parse_value)(lept_context*)) {
+    lept_context c;
+    int ret;
+    assert(v != NULL);
+    assert(data != NULL || len == 0);
+    _context_init(&c, data, len, opts);
+    c.flags &= ~LEPT_PARSE_LAZY;
+    c.handler = &_dom_handler;
+    c.handler_ctx = &c;
+    if ((ret = parse_value(&c)) == LEPT_PARSE_OK && c.json != c.end) {
+        ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+    ret = _dom_finish(&c, v, ret);
+    _context_free(&c);
+    return ret;
+}
+
+int lept_from_msgpack(lept_value* v, const char* data, size_t len, const lept_parse_options* opts) {
+    return _decode(v, data, len, opts, _msgpack_parse_value);
+}
+
+int lept_from_cbor(lept_value* v, const char* data, size_t len, const lept_parse_options* opts) {
+    return _decode(v, data, len, opts, _cbor_parse_value);
+}
+
+/*
+ * The push parser tracks the grammar with an explicit state and container
+ * stack, so it can stop after any byte. Scalars and keys are handed to the
+ * usual token parsers once complete: in place when they end inside a chunk,
+ * otherwise from a buffer collecting their pieces across chunks.
+ */
+
+#define LEPT_PUSH_FRAMES_INIT_SIZE 16
+
+#define ISNUMBERCHAR(ch) (ISDIGIT(ch) || (ch) == '-' || (ch) == '+' || (ch) == '.' || (ch) == 'e' || (ch) == 'E')
+#define ISLITERALCHAR(ch) ((ch) >= 'a' && (ch) <= 'z')
+
+typedef enum {
+    PUSH_VALUE,     /* the root or a member value */
+    PUSH_FIRST,     /* an element or ']' */
+    PUSH_FIRST_KEY, /* a key or '}' */
+    PUSH_COLON,
+    PUSH_NEXT,      /* ',' or the closing bracket */
+    PUSH_DONE       /* only whitespace may follow the root */
+} lept_push_state;
+
+typedef enum {
+    PUSH_TOKEN_NONE,
+    PUSH_TOKEN_STRING,
+    PUSH_TOKEN_NUMBER,
+    PUSH_TOKEN_LITERAL
+} lept_push_token;
+
+typedef struct {
+    char close;
+    size_t len;
+} lept_push_frame;
+
+struct lept_push_parser_s {
+    lept_context c;
+    lept_push_state state;
+    lept_push_frame* frames;
+    size_t depth, frames_size;
+    lept_push_token token;
+    int escaped; /* the last byte of the pending string was a backslash */
+    lept_buffer pending;
+    int ret;
+};
+
+static void _push_reset(lept_push_parser* p) {
+    p->state = PUSH_VALUE;
+    p->depth = 0;
+    p->token = PUSH_TOKEN_NONE;
+    p->pending.len = 0;
+    p->ret = LEPT_PARSE_OK;
+}
+
+lept_push_parser* lept_push_parser_new(const lept_parse_options* opts) {
+    lept_push_parser* p = NEW(lept_push_parser);
+    _context_init(&p->c, "", 0, opts);
+    p->c.handler = &_dom_handler;
+    p->c.handler_ctx = &p->c;
+    p->frames = NULL;
+    p->frames_size = 0;
+    lept_buffer_init(&p->pending);
+    _push_reset(p);
+    return p;
+}
+
+void lept_push_parser_free(lept_push_parser* p) {
+    lept_value v;
+    assert(p != NULL);
+    _dom_finish(&p->c, &v, LEPT_PARSE_EXPECT_VALUE); /* drop an unfinished document */
+    _context_free(&p->c);
+    FREE(p->frames);
+    lept_buffer_free(&p->pending);
+    FREE(p);
+}
+
+static void _push_value_done(lept_push_parser* p) {
+    if (p->depth == 0) {
+        p->state = PUSH_DONE;
+    } else {
+        ++p->frames[p->depth - 1].len;
+        p->state = PUSH_NEXT;
+    }
+}
+
+static int _push_open(lept_push_parser* p, char close) {
+    lept_context* c = &p->c;
+    if (p->depth >= c->max_depth) {
+        return LEPT_PARSE_TOO_DEEP;
+    }
+    if (p->depth == p->frames_size) {
+        p->frames_size = p->frames_size != 0 ? p->frames_size * 2 : LEPT_PUSH_FRAMES_INIT_SIZE;
+        p->frames = (lept_push_frame*)REALLOC(p->frames, p->frames_size * sizeof(lept_push_frame));
+    }
+    p->frames[p->depth].close = close;
+    p->frames[p->depth].len = 0;
+    ++p->depth;
+    if (close == ']') {
+        p->state = PUSH_FIRST;
+        return CALL0(on_start_array);
+    }
+    p->state = PUSH_FIRST_KEY;
+    return CALL0(on_start_object);
+}
+
+static int _push_close(lept_push_parser* p) {
+    lept_context* c = &p->c;
+    lept_push_frame* f = &p->frames[--p->depth];
+    int ret = f->close == ']' ? CALL(on_end_array, f->len) : CALL(on_end_object, f->len);
+    _push_value_done(p);
+    return ret;
+}
+
+/* the end of the token continuing at s, NULL when it runs past the chunk */
+static const char* _push_scan_token(lept_push_parser* p, const char* s, const char* end) {
+    switch (p->token) {
+        case PUSH_TOKEN_STRING:
+            while (s < end) {
+                if (p->escaped) {
+                    p->escaped = 0;
+                    ++s;
+                    continue;
+                }
+                s = p->c.scan_string(s, end);
+                if (s == end) {
+                    break;
+                }
+                if (*s == '"') {
+                    return s + 1;
+                }
+                p->escaped = *s == '\\';
+                ++s;
+            }
+            return NULL;
+        case PUSH_TOKEN_NUMBER:
+            while (s < end && ISNUMBERCHAR(*s)) {
+                ++s;
+            }
+            return s < end ? s : NULL;
+        case PUSH_TOKEN_LITERAL:
+            while (s < end && ISLITERALCHAR(*s)) {
+                ++s;
+            }
+            return s < end ? s : NULL;
+        default:
+            assert(0);
+            return NULL;
+    }
+}
+
+/* parse the complete token [begin, end) */
+static int _push_token(lept_push_parser* p, const char* begin, const char* end) {
+    lept_context* c = &p->c;
+    const char* key;
+    size_t keylen;
+    int ret;
+    c->json = begin;
+    c->end = end;
+    p->token = PUSH_TOKEN_NONE;
+    if (p->state == PUSH_FIRST_KEY) {
+        if ((ret = _parse_str(c, &key, &keylen)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+        p->state = PUSH_COLON;
+        return CALL(on_key, key, keylen);
+    }
+    if ((ret = _parse_value(c)) != LEPT_PARSE_OK) {
+        return ret;
+    }
+    _push_value_done(p);
+    if (c->json != end) { /* e.g. "1.2.3", nothing may follow a value directly */
+        return p->state == PUSH_DONE ? LEPT_PARSE_ROOT_NOT_SINGULAR : LEPT_PARSE_UNCLOSED_BRACKETS;
+    }
+    return LEPT_PARSE_OK;
+}
+
+static int _push_start_token(lept_push_parser* p, const char** s, const char* end, lept_push_token token) {
+    const char* begin = *s;
+    const char* q;
+    size_t n;
+    p->token = token;
+    p->escaped = 0;
+    q = _push_scan_token(p, token == PUSH_TOKEN_STRING ? begin + 1 : begin, end);
+    if (q != NULL) {
+        *s = q;
+        return _push_token(p, begin, q);
+    }
+    n = end - begin;
+    memcpy(_buffer_grow(&p->pending, n), begin, n);
+    p->pending.len = n;
+    p->pending.data[n] = '\0';
+    *s = end;
+    return LEPT_PARSE_OK;
+}
+
+/* consume the structural character or start the token at *s */
+static int _push_char(lept_push_parser* p, const char** s, const char* end) {
+    char ch = **s;
+    switch (p->state) {
+        case PUSH_DONE:
+            return LEPT_PARSE_ROOT_NOT_SINGULAR;
+        case PUSH_COLON:
+            if (ch != ':') {
+                return LEPT_PARSE_EXPECT_VALUE;
+            }
+            ++*s;
+            p->state = PUSH_VALUE;
+            return LEPT_PARSE_OK;
+        case PUSH_NEXT:
+            if (ch == ',') {
+                ++*s;
+                p->state = p->frames[p->depth - 1].close == ']' ? PUSH_FIRST : PUSH_FIRST_KEY;
+                return LEPT_PARSE_OK;
+            }
+            if (ch == p->frames[p->depth - 1].close) {
+                ++*s;
+                return _push_close(p);
+            }
+            return LEPT_PARSE_UNCLOSED_BRACKETS;
+        case PUSH_FIRST_KEY:
+            if (ch == '}') {
+                ++*s;
+                return _push_close(p);
+            }
+            if (ch != '"') {
+                return LEPT_PARSE_INVALID_VALUE;
+            }
+            return _push_start_token(p, s, end, PUSH_TOKEN_STRING);
+        case PUSH_FIRST:
+            if (ch == ']') {
+                ++*s;
+                return _push_close(p);
+            }
+            /* fall through */
+        case PUSH_VALUE:
+            switch (ch) {
+                case '[':
+                case '{':
+                    ++*s;
+                    return _push_open(p, ch == '[' ? ']' : '}');
+                case '"':
+                    return _push_start_token(p, s, end, PUSH_TOKEN_STRING);
+                case 'n': case 't': case 'f':
+                    return _push_start_token(p, s, end, PUSH_TOKEN_LITERAL);
+                case '0': case '1': case '2': case '3': case '4':
+                case '5': case '6': case '7': case '8': case '9':
+                case '-':
+                    return _push_start_token(p, s, end, PUSH_TOKEN_NUMBER);
+                case ']': case '}':
+                    return LEPT_PARSE_EXPECT_VALUE;
+                default:
+                    return LEPT_PARSE_INVALID_VALUE;
+            }
+    }
+    return LEPT_PARSE_INVALID_VALUE;
+}
+
+int lept_push_parser_feed(lept_push_parser* p, const char* chunk, size_t len) {
+    const char* s = chunk;
+    const char* end = chunk + len;
+    const char* q;
+    size_t n;
+    assert(p != NULL && (chunk != NULL || len == 0));
+    while (p->ret == LEPT_PARSE_OK && s < end) {
+        if (p->token != PUSH_TOKEN_NONE) {
+            q = _push_scan_token(p, s, end);
+            n = (q != NULL ? q : end) - s;
+            memcpy(_buffer_grow(&p->pending, n), s, n);
+            p->pending.len += n;
+            p->pending.data[p->pending.len] = '\0';
+            if (q == NULL) {
+                break;
+            }
+            s = q;
+            p->ret = _push_token(p, p->pending.data, p->pending.data + p->pending.len);
+            p->pending.len = 0;
+            continue;
+        }
+        s = p->c.skip_whitespace(s, end);
+        if (s < end) {
+            p->ret = _push_char(p, &s, end);
+        }
+    }
+    return p->ret;
+}
+
+int lept_push_parser_finish(lept_push_parser* p, lept_value* v) {
+    int ret = p->ret;
+    assert(p != NULL && v != NULL);
+    if (ret == LEPT_PARSE_OK && p->token != PUSH_TOKEN_NONE) {
+        /* numbers and literals end with the input, strings are unclosed */
+        ret = _push_token(p, p->pending.data, p->pending.data + p->pending.len);
+    }
+    if (ret == LEPT_PARSE_OK) {
+        switch (p->state) {
+            case PUSH_DONE:
+                break;
+            case PUSH_FIRST_KEY:
+                ret = LEPT_PARSE_INVALID_VALUE;
+                break;
+            case PUSH_NEXT:
+                ret = LEPT_PARSE_UNCLOSED_BRACKETS;
+                break;
+            default:
+                ret = LEPT_PARSE_EXPECT_VALUE;
+        }
+    }
+    ret = _dom_finish(&p->c, v, ret);
+    _push_reset(p);
+    return ret;
+}
+
+/*
+ * Batch work is spread over threads by handing the same worker to each of
+ * them, the workers then take tasks from a counter in their shared state.
+ */
+
+#ifdef LEPT_HAVE_THREADS
+#define LOCK(b)   pthread_mutex_lock(&(b)->lock)
+#define UNLOCK(b) pthread_mutex_unlock(&(b)->lock)
+#else
+#define LOCK(b)   ((void)0)
+#define UNLOCK(b) ((void)0)
+#endif
+
+static int _thread_count(int nthreads) {
+#ifdef LEPT_HAVE_THREADS
+    if (nthreads <= 0) {
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+    return nthreads > 0 ? nthreads : 1;
+}
+
+/* the calling thread is one of the nthreads running worker */
+static void _run_workers(int nthreads, void* (*worker)(void*), void* arg) {
+#ifdef LEPT_HAVE_THREADS
+    pthread_t* threads = NEWN(nthreads, pthread_t);
+    int t;
+    for (t = 0; t < nthreads - 1; ++t) {
+        if (pthread_create(&threads[t], NULL, worker, arg) != 0) {
+            break;
+        }
+    }
+    worker(arg);
+    while (t-- > 0) {
+        pthread_join(threads[t], NULL);
+    }
+    FREE(threads);
+#else
+    (void)nthreads;
+    worker(arg);
+#endif
+}
+
+/*
+ * NDJSON batches are cut into line aligned chunks up front, and threads
+ * take the next chunk from a shared counter. Each thread parses into its
+ * own arena. Unordered delivery calls back right after each line. Ordered
+ * delivery keeps a parsed chunk until every earlier chunk is delivered,
+ * and whichever thread completes the oldest pending chunk delivers the run
+ * of ready chunks behind it.
+ */
+
+#define LEPT_NDJSON_CHUNKS_PER_THREAD 8
+#define LEPT_NDJSON_MIN_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    size_t offset;
+    int ret;
+    lept_value v;
+} lept_ndjson_line;
+
+typedef struct {
+    lept_ndjson_line* lines;
+    size_t len, capacity;
+    lept_arena arena;
+    int ready;
+} lept_ndjson_chunk;
+
+typedef struct {
+    const char* buf;
+    size_t* bounds; /* chunk i is [bounds[i], bounds[i + 1]) */
+    size_t nchunks;
+    lept_ndjson_chunk* chunks; /* LEPT_NDJSON_ORDERED only */
+    int flags;
+    lept_ndjson_callback callback;
+    void* ctx;
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+    size_t next_chunk;   /* to parse */
+    size_t next_deliver; /* to call back */
+    int delivering;
+    int stopped;
+} lept_ndjson_batch;
+
+static int _is_blank(const char* p, const char* end) {
+    for (; p != end; ++p) {
+        if (!ISWHITESPACE(*p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _ndjson_parse_line(lept_ndjson_batch* b, lept_arena* a, lept_value* v, const char* line, const char* eol) {
+    lept_parse_options opts;
+    lept_context c;
+    int ret;
+    opts.flags = b->flags;
+    opts.arena = a;
+    opts.keys = NULL;
+    opts.allocator = NULL;
+    opts.max_depth = 0;
+    _context_init(&c, line, eol - line, &opts);
+    ret = _parse(&c, v);
+    _context_free(&c);
+    return ret;
+}
+
+static void _ndjson_parse_unordered(lept_ndjson_batch* b, size_t i, lept_arena* a) {
+    const char* p = b->buf + b->bounds[i];
+    const char* end = b->buf + b->bounds[i + 1];
+    const char* eol;
+    lept_value v;
+    int ret;
+    for (; p < end; p = eol + 1) {
+        if ((eol = (const char*)memchr(p, '\n', end - p)) == NULL) {
+            eol = end;
+        }
+        if (_is_blank(p, eol)) {
+            continue;
+        }
+        ret = _ndjson_parse_line(b, a, &v, p, eol);
+        if (b->callback(b->ctx, p - b->buf, &v, ret) != 0) {
+            LOCK(b);
+            b->stopped = 1;
+            UNLOCK(b);
+            break;
+        }
+        lept_arena_reset(a);
+    }
+}
+
+static void _ndjson_parse_chunk(lept_ndjson_batch* b, size_t i) {
+    lept_ndjson_chunk* k = &b->chunks[i];
+    const char* p = b->buf + b->bounds[i];
+    const char* end = b->buf + b->bounds[i + 1];
+    const char* eol;
+    lept_ndjson_line* line;
+    for (; p < end; p = eol + 1) {
+        if ((eol = (const char*)memchr(p, '\n', end - p)) == NULL) {
+            eol = end;
+        }
+        if (_is_blank(p, eol)) {
+            continue;
+        }
+        if (k->len == k->capacity) {
+            k->capacity = k->capacity != 0 ? k->capacity + (k->capacity >> 1) : 64;
+            k->lines = (lept_ndjson_line*)REALLOC(k->lines, k->capacity * sizeof(lept_ndjson_line));
+        }
+        line = &k->lines[k->len++];
+        line->offset = p - b->buf;
+        line->ret = _ndjson_parse_line(b, &k->arena, &line->v, p, eol);
+    }
+}
+
+static void _ndjson_free_chunk(lept_ndjson_chunk* k) {
+    FREE(k->lines);
+    k->lines = NULL;
+    k->len = k->capacity = 0;
+    lept_arena_free(&k->arena);
+}
+
+static void _ndjson_deliver(lept_ndjson_batch* b, size_t i) {
+    lept_ndjson_chunk* k;
+    size_t j;
+    int stopped;
+    LOCK(b);
+    b->chunks[i].ready = 1;
+    if (b->delivering || i != b->next_deliver) {
+        UNLOCK(b);
+        return;
+    }
+    b->delivering = 1;
+    while (b->next_deliver < b->nchunks && b->chunks[b->next_deliver].ready) {
+        k = &b->chunks[b->next_deliver];
+        stopped = b->stopped;
+        UNLOCK(b);
+        for (j = 0; j < k->len && !stopped; ++j) {
+            stopped = b->callback(b->ctx, k->lines[j].offset, &k->lines[j].v, k->lines[j].ret) != 0;
+        }
+        _ndjson_free_chunk(k);
+        LOCK(b);
+        b->stopped |= stopped;
+        ++b->next_deliver;
+    }
+    b->delivering = 0;
+    UNLOCK(b);
+}
+
+static void* _ndjson_worker(void* arg) {
+    lept_ndjson_batch* b = (lept_ndjson_batch*)arg;
+    lept_arena a;
+    size_t i;
+    lept_arena_init(&a);
+    for (;;) {
+        LOCK(b);
+        i = b->stopped ? b->nchunks : b->next_chunk++;
+        UNLOCK(b);
+        if (i >= b->nchunks) {
+            break;
+        }
+        if (b->flags & LEPT_NDJSON_ORDERED) {
+            _ndjson_parse_chunk(b, i);
+            _ndjson_deliver(b, i);
+        } else {
+            _ndjson_parse_unordered(b, i, &a);
+        }
+    }
+    lept_arena_free(&a);
+    return NULL;
+}
+
+int lept_parse_ndjson(const char* buf, size_t len, int nthreads, int flags,
+                      lept_ndjson_callback callback, void* ctx) {
+    lept_ndjson_batch b;
+    size_t chunk_size, pos, i;
+    const char* eol;
+    assert(buf != NULL || len == 0);
+    assert(callback != NULL);
+    nthreads = _thread_count(nthreads);
+
+    chunk_size = len / ((size_t)nthreads * LEPT_NDJSON_CHUNKS_PER_THREAD);
+    if (chunk_size < LEPT_NDJSON_MIN_CHUNK_SIZE) {
+        chunk_size = LEPT_NDJSON_MIN_CHUNK_SIZE;
+    }
+    b.nchunks = (len + chunk_size - 1) / chunk_size;
+    b.bounds = NEWN(b.nchunks + 1, size_t);
+    b.bounds[0] = 0;
+    for (i = 1; i < b.nchunks; ++i) { /* move each cut past the end of its line */
+        pos = i * chunk_size > b.bounds[i - 1] ? i * chunk_size : b.bounds[i - 1];
+        eol = (const char*)memchr(buf + pos, '\n', len - pos);
+        b.bounds[i] = eol != NULL ? (size_t)(eol - buf) + 1 : len;
+    }
+    b.bounds[b.nchunks] = len;
+
+    b.buf = buf;
+    b.chunks = NULL;
+    if (flags & LEPT_NDJSON_ORDERED) {
+        b.chunks = NEWN(b.nchunks, lept_ndjson_chunk);
+        for (i = 0; i < b.nchunks; ++i) {
+            b.chunks[i].lines = NULL;
+            b.chunks[i].len = b.chunks[i].capacity = 0;
+            b.chunks[i].ready = 0;
+            lept_arena_init(&b.chunks[i].arena);
+        }
+    }
+    b.flags = flags;
+    b.callback = callback;
+    b.ctx = ctx;
+    b.next_chunk = b.next_deliver = 0;
+    b.delivering = b.stopped = 0;
+
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_init(&b.lock, NULL);
+#endif
+    _run_workers(nthreads, _ndjson_worker, &b);
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_destroy(&b.lock);
+#endif
+
+    if (b.chunks != NULL) { /* left behind by a stop */
+        for (i = 0; i < b.nchunks; ++i) {
+            _ndjson_free_chunk(&b.chunks[i]);
+        }
+        FREE(b.chunks);
+    }
+    FREE(b.bounds);
+    return b.stopped ? LEPT_PARSE_STOPPED : LEPT_PARSE_OK;
+}
+
+/*
+ * Stage 1 of parallel parsing finds the structural characters outside
+ * strings 64 bytes at a time: vector compares give bit masks of
+ * backslashes, quotes and {}[],: in the block, carries between blocks
+ * track odd backslash runs and whether the block starts inside a string.
+ */
+
+typedef void (*lept_block_func)(const char* p, uint64_t* backslash, uint64_t* quote, uint64_t* op);
+
+static void _block_masks_scalar(const char* p, uint64_t* backslash, uint64_t* quote, uint64_t* op) {
+    uint64_t b = 0, q = 0, o = 0, bit;
+    int i;
+    for (i = 0; i < 64; ++i) {
+        bit = UINT64_C(1) << i;
+        switch (p[i]) {
+            case '\\': b |= bit; break;
+            case '"':  q |= bit; break;
+            case '[': case ']': case '{': case '}': case ',': case ':':
+                o |= bit;
+        }
+    }
+    *backslash = b;
+    *quote = q;
+    *op = o;
+}
+
+#ifdef LEPT_SIMD_X86
+
+__attribute__((target("sse2")))
+static void _block_masks_sse2(const char* p, uint64_t* backslash, uint64_t* quote, uint64_t* op) {
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i qu = _mm_set1_epi8('"');
+    const __m128i lower = _mm_set1_epi8(0x20); /* '[' | 0x20 == '{', ']' | 0x20 == '}' */
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i colon = _mm_set1_epi8(':');
+    uint64_t b = 0, q = 0, o = 0;
+    int i;
+    for (i = 0; i < 64; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i l = _mm_or_si128(s, lower);
+        __m128i ops = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l, lbrace), _mm_cmpeq_epi8(l, rbrace)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(s, comma), _mm_cmpeq_epi8(s, colon)));
+        b |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(s, bs)) << i;
+        q |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(s, qu)) << i;
+        o |= (uint64_t)(unsigned)_mm_movemask_epi8(ops) << i;
+    }
+    *backslash = b;
+    *quote = q;
+    *op = o;
+}
+
+__attribute__((target("avx2")))
+static void _block_masks_avx2(const char* p, uint64_t* backslash, uint64_t* quote, uint64_t* op) {
+    const __m256i bs = _mm256_set1_epi8('\\');
+    const __m256i qu = _mm256_set1_epi8('"');
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i lbrace = _mm256_set1_epi8('{');
+    const __m256i rbrace = _mm256_set1_epi8('}');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i colon = _mm256_set1_epi8(':');
+    uint64_t b = 0, q = 0, o = 0;
+    int i;
+    for (i = 0; i < 64; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i l = _mm256_or_si256(s, lower);
+        __m256i ops = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(l, lbrace), _mm256_cmpeq_epi8(l, rbrace)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(s, comma), _mm256_cmpeq_epi8(s, colon)));
+        b |= (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(s, bs)) << i;
+        q |= (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(s, qu)) << i;
+        o |= (uint64_t)(unsigned)_mm256_movemask_epi8(ops) << i;
+    }
+    *backslash = b;
+    *quote = q;
+    *op = o;
+}
+
+#endif /* LEPT_SIMD_X86 */
+
+static lept_block_func _select_block_func(void) {
+#ifdef LEPT_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return _block_masks_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return _block_masks_sse2;
+    }
+#endif
+    return _block_masks_scalar;
+}
+
+static int _trailing_zeros_64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/*
+ * The characters escaped by a backslash: those ending a backslash run of
+ * odd length. Runs are told apart by whether they start on an even or odd
+ * bit, adding the starts to the runs carries each one to its end.
+ */
+static uint64_t _escaped_mask(uint64_t backslash, uint64_t* prev_odd) {
+    const uint64_t even_bits = UINT64_C(0x5555555555555555);
+    const uint64_t odd_bits = ~even_bits;
+    uint64_t starts = backslash & ~(backslash << 1);
+    uint64_t even_start_mask = even_bits ^ *prev_odd;
+    uint64_t even_starts = starts & even_start_mask;
+    uint64_t odd_starts = starts & ~even_start_mask;
+    uint64_t even_carries = backslash + even_starts;
+    uint64_t odd_carries = backslash + odd_starts;
+    uint64_t ends_odd = odd_carries < backslash; /* the run goes on in the next block */
+    uint64_t even_carry_ends, odd_carry_ends;
+    odd_carries |= *prev_odd;
+    *prev_odd = ends_odd;
+    even_carry_ends = even_carries & ~backslash;
+    odd_carry_ends = odd_carries & ~backslash;
+    return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+}
+
+/* bit i is the parity of the bits 0..i of x */
+static uint64_t _prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+uint32_t* lept_find_structurals(const char* json, size_t len, size_t* count) {
+    lept_block_func block = _select_block_func();
+    size_t capacity = len / 8 + 64;
+    uint32_t* out = NEWN(capacity, uint32_t);
+    uint64_t prev_odd = 0, prev_in_string = 0;
+    uint64_t backslash, quote, op, in_string;
+    size_t n = 0, i;
+    char tail[64];
+    assert(json != NULL || len == 0);
+    assert(count != NULL);
+    assert(len <= UINT32_MAX);
+    for (i = 0; i < len; i += 64) {
+        if (len - i >= 64) {
+            block(json + i, &backslash, &quote, &op);
+        } else { /* the last block padded with spaces */
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, json + i, len - i);
+            block(tail, &backslash, &quote, &op);
+        }
+        quote &= ~_escaped_mask(backslash, &prev_odd);
+        in_string = _prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = 0 - (in_string >> 63);
+        op &= ~in_string;
+        if (n + 64 > capacity) {
+            capacity += capacity >> 1;
+            out = (uint32_t*)REALLOC(out, capacity * sizeof(uint32_t));
+        }
+        for (; op != 0; op &= op - 1) {
+            out[n++] = (uint32_t)(i + _trailing_zeros_64(op));
+        }
+    }
+    *count = n;
+    return out;
+}
+
+/*
+ * Stage 2 uses the index to find the members of the root container, which
+ * are cut into runs of about equal size. Each run is parsed by the usual
+ * DOM builder on its own thread and context, and the results are joined
+ * into the root on the calling thread. Documents the index cannot split
+ * safely, and all malformed ones, go through lept_parse_n() instead so
+ * errors are reported exactly as usual.
+ */
+
+#define LEPT_PARALLEL_TASKS_PER_THREAD 4
+#ifndef LEPT_PARALLEL_MIN_SIZE
+#define LEPT_PARALLEL_MIN_SIZE (64 * 1024)
+#endif
+
+typedef struct {
+    size_t first, count; /* members of the root */
+    lept_context c;      /* the parsed members wait on its stack */
+} lept_parallel_task;
+
+typedef struct {
+    const char* json;
+    const uint32_t* bounds; /* member i is (bounds[i], bounds[i + 1]) */
+    size_t members;
+    int object;
+    lept_parallel_task* tasks;
+    size_t ntasks;
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+    size_t next_task;
+    int failed;
+} lept_parallel_batch;
+
+static int _parse_member(lept_parallel_batch* b, lept_context* c) {
+    const char* key;
+    size_t keylen;
+    int ret;
+    _parse_whitespace(c);
+    if (b->object) {
+        if (CUR() != '"') {
+            return LEPT_PARSE_INVALID_VALUE;
+        }
+        if ((ret = _parse_str(c, &key, &keylen)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+        _dom_key(c, key, keylen);
+        _parse_whitespace(c);
+        if (CUR() != ':') {
+            return LEPT_PARSE_EXPECT_VALUE;
+        }
+        NEXT();
+        _parse_whitespace(c);
+    }
+    if ((ret = _parse_value(c)) != LEPT_PARSE_OK) {
+        return ret;
+    }
+    _parse_whitespace(c);
+    return c->json == c->end ? LEPT_PARSE_OK : LEPT_PARSE_INVALID_VALUE;
+}
+
+static void* _parallel_worker(void* arg) {
+    lept_parallel_batch* b = (lept_parallel_batch*)arg;
+    lept_parallel_task* t;
+    lept_context* c;
+    size_t i, k;
+    int ret = LEPT_PARSE_OK;
+    for (;;) {
+        LOCK(b);
+        k = b->failed ? b->ntasks : b->next_task++;
+        UNLOCK(b);
+        if (k >= b->ntasks) {
+            break;
+        }
+        t = &b->tasks[k];
+        c = &t->c;
+        for (i = t->first; i < t->first + t->count && ret == LEPT_PARSE_OK; ++i) {
+            c->json = b->json + b->bounds[i] + 1;
+            c->end = b->json + b->bounds[i + 1];
+            ret = _parse_member(b, c);
+        }
+        if (ret != LEPT_PARSE_OK) {
+            LOCK(b);
+            b->failed = 1;
+            UNLOCK(b);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* whether [p, end) holds whitespace only */
+static int _is_blank_range(const char* p, const char* end) {
+    return _skip_whitespace_scalar(p, end) == end;
+}
+
+int lept_parse_parallel(lept_value* v, const char* json, size_t len, int nthreads) {
+    lept_parallel_batch b;
+    lept_context* c;
+    uint32_t* index;
+    uint32_t* bounds;
+    size_t n, i, k, depth = 0, members = 0, task_size, begin;
+    const char* p;
+    int ret;
+    assert(v != NULL);
+    assert(json != NULL || len == 0);
+    nthreads = _thread_count(nthreads);
+    p = _skip_whitespace_scalar(json, json + len);
+    if (nthreads == 1 || len < LEPT_PARALLEL_MIN_SIZE || len > UINT32_MAX || (*p != '[' && *p != '{')) {
+        return lept_parse_n(v, json, len);
+    }
+
+    /* stage 1, then the members of the root from its top level commas */
+    index = lept_find_structurals(json, len, &n);
+    bounds = index; /* written behind the read position */
+    for (i = 0; i < n; ++i) {
+        switch (json[index[i]]) {
+            case '[': case '{':
+                if (depth++ == 0) {
+                    bounds[members++] = index[i];
+                }
+                break;
+            case ']': case '}':
+                if (--depth == 0) {
+                    bounds[members++] = index[i];
+                    goto closed;
+                }
+                break;
+            case ',':
+                if (depth == 1) {
+                    bounds[members++] = index[i];
+                }
+                break;
+        }
+    }
+closed:
+    if (i == n || !_is_blank_range(json + index[i] + 1, json + len)) {
+        FREE(index);
+        return lept_parse_n(v, json, len);
+    }
+    --members; /* fences around the members */
+    /* an empty root or a trailing comma leaves a blank last member */
+    if (_is_blank_range(json + bounds[members - 1] + 1, json + bounds[members])) {
+        --members;
+    }
+    if (members < 2) {
+        FREE(index);
+        return lept_parse_n(v, json, len);
+    }
+
+    /* stage 2 */
+    task_size = (bounds[members] - bounds[0]) / ((size_t)nthreads * LEPT_PARALLEL_TASKS_PER_THREAD) + 1;
+    b.tasks = NEWN(members, lept_parallel_task);
+    b.ntasks = 0;
+    for (begin = 0, k = 0; k < members; ++k) {
+        if (k + 1 == members || bounds[k + 1] - bounds[begin] >= task_size) {
+            b.tasks[b.ntasks].first = begin;
+            b.tasks[b.ntasks].count = k + 1 - begin;
+            c = &b.tasks[b.ntasks++].c;
+            _context_init(c, json, len, NULL);
+            c->max_depth = LEPT_PARSE_MAX_DEPTH - 1; /* the members are inside the root */
+            c->handler = &_dom_handler;
+            c->handler_ctx = c;
+            begin = k + 1;
+        }
+    }
+    b.json = json;
+    b.bounds = bounds;
+    b.members = members;
+    b.object = *p == '{';
+    b.next_task = 0;
+    b.failed = 0;
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_init(&b.lock, NULL);
+#endif
+    _run_workers(nthreads, _parallel_worker, &b);
+#ifdef LEPT_HAVE_THREADS
+    pthread_mutex_destroy(&b.lock);
+#endif
+
+    ret = LEPT_PARSE_OK;
+    if (!b.failed) { /* join the members on the stack of the first task */
+        c = &b.tasks[0].c;
+        for (k = 1; k < b.ntasks; ++k) {
+            n = b.tasks[k].c.top;
+            memcpy(_context_push(c, n), b.tasks[k].c.stack, n);
+            b.tasks[k].c.top = 0;
+        }
+        if (b.object) {
+            _dom_end_object(c, members);
+        } else {
+            _dom_end_array(c, members);
+        }
+        ret = _dom_finish(c, v, LEPT_PARSE_OK);
+    }
+    for (k = 0; k < b.ntasks; ++k) {
+        if (b.failed) { /* release the members parsed so far */
+            _dom_finish(&b.tasks[k].c, v, LEPT_PARSE_INVALID_VALUE);
+        }
+        _context_free(&b.tasks[k].c);
+    }
+    FREE(b.tasks);
+    FREE(index);
+    return b.failed ? lept_parse_n(v, json, len) : ret;
+}
+
+#undef LOCK
+#undef UNLOCK
+
+/*
+ * Lazy containers. A level is parsed from text that was validated up
+ * front, so it cannot fail. Its child containers only get their source
+ * span, found by matching brackets over the stage 1 masks instead of
+ * parsing what is inside.
+ */
+
+/* the end of the container starting at p, NULL if it is not closed */
+static const char* _match_bracket(const char* p, const char* end) {
+    lept_block_func block = _select_block_func();
+    uint64_t prev_odd = 0, prev_in_string = 0;
+    uint64_t backslash, quote, op, in_string;
+    size_t depth = 0;
+    const char* q;
+    char tail[64];
+    for (; p < end; p += 64) {
+        if (end - p >= 64) {
+            block(p, &backslash, &quote, &op);
+        } else {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, end - p);
+            block(tail, &backslash, &quote, &op);
+        }
+        quote &= ~_escaped_mask(backslash, &prev_odd);
+        in_string = _prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = 0 - (in_string >> 63);
+        for (op &= ~in_string; op != 0; op &= op - 1) {
+            q = p + _trailing_zeros_64(op);
+            if (*q == '[' || *q == '{') {
+                ++depth;
+            } else if ((*q == ']' || *q == '}') && --depth == 0) {
+                return q + 1;
+            }
+        }
     }
-    return LEPT_PARSE_OK;
+    return NULL;
 }
 
-static int _parse_literal(lept_context* c, lept_value* v, const char* literal, lept_type type) {
-    size_t len = strlen(literal);
-    if (strncmp(c->json, literal, len) != 0) {
-        return LEPT_PARSE_INVALID_VALUE;
+/* push the value at c->json, a container only as its source span */
+static void _push_lazy_value(lept_context* c) {
+    lept_array* a;
+    lept_object* o;
+    lept_value* v;
+    switch (CUR()) {
+        case '[':
+            a = _new_array(c);
+            a->lazy = c->json;
+            a->lazy_end = c->json = _match_bracket(c->json, c->end);
+            v = _dom_push(c);
+            v->type = LEPT_ARRAY;
+            v->value.a = a;
+            break;
+        case '{':
+            o = _new_object(c);
+            o->lazy = c->json;
+            o->lazy_end = c->json = _match_bracket(c->json, c->end);
+            v = _dom_push(c);
+            v->type = LEPT_OBJECT;
+            v->value.o = o;
+            break;
+        default:
+            _parse_value(c);
     }
-    c->json += len;
-    v->type = type;
-    return LEPT_PARSE_OK;
 }
 
-static const char* _validate_number(const char* str) {
-    const char* p = str;
-    if (*p == '-') ++p;
-    if (*p == '0') {
-        ++p;
-    } else if (ISDIGIT1TO9(*p)) {
-        for (++p; ISDIGIT(*p); ++p);
-    } else {
-        goto invalid;
-    }
-    if (*p == '.') {
-        ++p;
-        if (!ISDIGIT(*p)) goto invalid;
-        for (++p; ISDIGIT(*p); ++p);
-    }
-    if (*p == 'e' || *p == 'E') {
-        ++p;
-        if (*p == '+' || *p == '-') {
-            ++p;
+/* parse one level of the array a or object o from [begin, end) */
+static void _materialize(const char* begin, const char* end, lept_array* a, lept_object* o) {
+    lept_context context;
+    lept_context* c = &context;
+    const char* key;
+    size_t keylen;
+    size_t len = 0;
+    _context_init(c, begin, end - begin, NULL);
+    c->handler = &_dom_handler;
+    c->handler_ctx = c;
+    NEXT();
+    for (;;) {
+        _parse_whitespace(c);
+        if (CUR() == ']' || CUR() == '}') {
+            break;
+        }
+        if (o != NULL) {
+            _parse_str(c, &key, &keylen);
+            _dom_key(c, key, keylen);
+            _parse_whitespace(c);
+            NEXT(); /* ':' */
+            _parse_whitespace(c);
+        }
+        _push_lazy_value(c);
+        ++len;
+        _parse_whitespace(c);
+        if (CUR() == ',') {
+            NEXT();
         }
-        if (!ISDIGIT(*p)) goto invalid;
-        for (++p; ISDIGIT(*p); ++p);
     }
-    return p;
-invalid:
-    return str;
+    if (a != NULL) {
+        a->lazy = NULL;
+        _pop_elements(c, a, len);
+    } else {
+        o->lazy = NULL;
+        _pop_members(c, o, len);
+    }
+    _context_free(c);
 }
 
-static int _parse_number(lept_context* c, lept_value* v) {
-    const char* end;
-    if ((end = _validate_number(c->json)) == c->json) {
-        return LEPT_PARSE_INVALID_VALUE;
+/*
+ * Queries. The compiled paths are matched while walking the text: values
+ * no path continues into are skipped without being parsed, values a path
+ * ends at are built with the DOM handler. Below such a value the remaining
+ * paths are matched against the built tree, as for lept_query_run_value().
+ */
+
+typedef struct {
+    const char* key; /* unescaped, NULL for "*" */
+    size_t len;
+    size_t index;    /* the key as an array index, (size_t)-1 if it is not one */
+} lept_query_token;
+
+typedef struct {
+    lept_query_token* tokens;
+    size_t len;
+    int wildcard;
+} lept_query_path;
+
+struct lept_query_s {
+    lept_query_path* paths;
+    size_t count;
+    size_t depth;           /* tokens of the longest path */
+    lept_query_token* tokens;
+    char* keys;
+};
+
+/* the first index and every array index without leading zeros */
+static size_t _query_index(const char* key, size_t len) {
+    size_t index = 0;
+    size_t i;
+    if (len == 0 || len > 18 || (key[0] == '0' && len > 1)) {
+        return (size_t)-1;
     }
-    errno = 0;
-    v->value.n = strtod(c->json, NULL);
-    if (errno == ERANGE && (v->value.n == HUGE_VAL || v->value.n == -HUGE_VAL)) {
-        return LEPT_PARSE_NUMBER_TOO_BIG;
+    for (i = 0; i < len; ++i) {
+        if (!ISDIGIT(key[i])) {
+            return (size_t)-1;
+        }
+        index = index * 10 + (key[i] - '0');
     }
-    c->json = end;
-    v->type = LEPT_NUMBER;
-    return LEPT_PARSE_OK;
+    return index;
 }
 
-static int _parse_str(lept_context* c, lept_string* str) {
-    int buffer_capacity = 8;
-    char* buffer = NEWN(buffer_capacity, char);
-    char* p = buffer;
-    char* new_buffer = NULL;
-    int ret;
-    EXPECT('"');
-    for (;;) {
-        if (p - buffer == buffer_capacity) { /* reach buffer end */
-            new_buffer = NEWN(buffer_capacity * 2, char);
-            memcpy(new_buffer, buffer, buffer_capacity);
-            free(buffer);
-            p = new_buffer + (p - buffer);
-            buffer_capacity *= 2;
-            buffer = new_buffer;
+lept_query* lept_query_compile(const char* const* paths, size_t count) {
+    lept_query* q = NEW(lept_query);
+    lept_query_token* t;
+    const char* p;
+    char* k;
+    size_t ntokens = 0, nchars = 0, i;
+    for (i = 0; i < count; ++i) {
+        for (p = paths[i]; *p; ++p) {
+            ntokens += *p == '/';
         }
-        switch (CUR()) {
-            case '\0':
-                ret = LEPT_PARSE_UNCLOSED_QUOTES;
-                goto fail;
-            case '"':
-                NEXT();
-                goto success;
-            case '\\':
-                NEXT();
-                switch (CUR()) {
-                    case 'b' : *p++ = '\b'; NEXT(); break;
-                    case 'f' : *p++ = '\f'; NEXT(); break;
-                    case 'n' : *p++ = '\n'; NEXT(); break;
-                    case 'r' : *p++ = '\r'; NEXT(); break;
-                    case 't' : *p++ = '\t'; NEXT(); break;
-                    case '\"': *p++ = '"';  NEXT(); break;
-                    case '\\': *p++ = '\\'; NEXT(); break;
-                    case '/' : *p++ = '/';  NEXT(); break;
-                    case 'u':
-                        /* \TODO unicode */
-                    default:
-                        ret = LEPT_PARSE_INVALID_VALUE;
-                        goto fail;
+        nchars += p - paths[i];
+    }
+    q->paths = NEWN(count, lept_query_path);
+    q->count = count;
+    q->depth = 0;
+    q->tokens = t = NEWN(ntokens, lept_query_token);
+    q->keys = k = NEWN(nchars, char);
+    for (i = 0; i < count; ++i) {
+        lept_query_path* path = &q->paths[i];
+        p = paths[i];
+        if (*p != '\0' && *p != '/') {
+            goto fail;
+        }
+        path->tokens = t;
+        path->wildcard = 0;
+        while (*p == '/') {
+            t->key = k;
+            for (++p; *p != '\0' && *p != '/'; ++p) {
+                if (*p != '~') {
+                    *k++ = *p;
+                } else if (p[1] == '0' || p[1] == '1') {
+                    *k++ = *++p == '0' ? '~' : '/';
+                } else {
+                    goto fail;
                 }
-                break;
-            default:
-                *p++ = CUR();
-                NEXT();
+            }
+            t->len = k - t->key;
+            t->index = _query_index(t->key, t->len);
+            if (t->len == 1 && t->key[0] == '*') {
+                t->key = NULL;
+                path->wildcard = 1;
+            }
+            ++t;
+        }
+        path->len = t - path->tokens;
+        if (path->len > q->depth) {
+            q->depth = path->len;
         }
     }
-success:
-    *p = '\0';
-    str->len = p - buffer;
-    str->str = buffer;
-    return LEPT_PARSE_OK;
+    return q;
 fail:
-    free(buffer);
-    return ret;
+    lept_query_free(q);
+    return NULL;
 }
 
-static int _parse_string(lept_context* c, lept_value* v) {
-    lept_string* str;
-    int ret;
-    str = lept_new_string();
-    if ((ret = _parse_str(c, str)) != LEPT_PARSE_OK) {
-        lept_free_string(str);
-        return ret;
+void lept_query_free(lept_query* q) {
+    assert(q != NULL);
+    FREE(q->paths);
+    FREE(q->tokens);
+    FREE(q->keys);
+    FREE(q);
+}
+
+static int _token_matches_key(const lept_query_token* t, const char* key, size_t len) {
+    return t->key == NULL || (t->len == len && memcmp(t->key, key, len) == 0);
+}
+
+static int _token_matches_index(const lept_query_token* t, size_t index) {
+    return t->key == NULL || t->index == index;
+}
+
+static lept_string* _copy_string(const lept_string* s) {
+    return _string_block(MALLOC(sizeof(lept_string) + s->len + 1), s->str, s->len);
+}
+
+/* a deep copy of src in malloc'ed memory, whatever src was allocated from */
+static void _copy_value(lept_value* dst, const lept_value* src) {
+    const lept_array* a;
+    const lept_object_node* node;
+    lept_object_node** tail;
+    size_t i;
+    dst->type = src->type;
+    switch (src->type) {
+        case LEPT_NUMBER:
+            dst->value.n = src->value.n;
+            break;
+        case LEPT_STRING:
+            lept_set_string(dst, lept_get_string(src), lept_get_string_length(src));
+            break;
+        case LEPT_ARRAY:
+            a = _array_of(src);
+            dst->value.a = lept_new_array();
+            lept_reserve_array(dst->value.a, a->len);
+            for (i = 0; i < a->len; ++i) {
+                _copy_value(lept_pushback_array_element(dst->value.a), &a->items[i]);
+            }
+            break;
+        case LEPT_OBJECT:
+            dst->value.o = lept_new_object();
+            dst->value.o->len = _object_of(src)->len;
+            tail = &dst->value.o->nodes;
+            for (node = src->value.o->nodes; node; node = node->next) {
+                *tail = lept_new_object_node();
+                (*tail)->key = _copy_string(node->key);
+                _copy_value(&(*tail)->value, &node->value);
+                tail = &(*tail)->next;
+            }
+            break;
+        default:
+            break;
     }
-    v->value.s = str;
-    v->type = LEPT_STRING;
-    return LEPT_PARSE_OK;
 }
 
-static int _parse_value(lept_context* c, lept_value* v);
+typedef struct {
+    const lept_query* q;
+    lept_value* results;
+    size_t* active; /* numbers of the paths matched so far, q->count per depth */
+} lept_query_state;
 
-static int _parse_array(lept_context* c, lept_value* v) {
-    lept_array* a;
-    lept_array_item* head = NULL;
-    lept_array_item* previous = NULL;
-    lept_array_item* item = NULL;
-    lept_value* value;
-    size_t len = 0;
-    int ret;
-    EXPECT('[');
-    for (;;) {
-        _parse_whitespace(c);
-        if (CUR() == ']') {
-            NEXT();
-            goto success;
-        }
-        value = lept_new_value();
-        if ((ret = _parse_value(c, value)) != LEPT_PARSE_OK) {
-            lept_free_value(value);
-            goto fail;
-        }
-        ++len;
-        item = lept_new_array_item();
-        item->value = value;
-        if (head == NULL) { /* item is first item */
-            head = item;
+static void _query_begin(lept_query_state* s, const lept_query* q, lept_value* results) {
+    size_t i;
+    s->q = q;
+    s->results = results;
+    s->active = NEWN((q->depth + 1) * q->count, size_t);
+    for (i = 0; i < q->count; ++i) {
+        s->active[i] = i;
+        if (q->paths[i].wildcard) {
+            results[i].type = LEPT_ARRAY;
+            results[i].value.a = lept_new_array();
         } else {
-            previous->next = item;
+            results[i].type = LEPT_UNKNOWN;
         }
-        previous = item;
-        _parse_whitespace(c);
-        if (CUR() == ']') {
-            NEXT();
-            goto success;
-        } if (CUR() == ',') {
-            NEXT();
-            continue;
-        } else {
-            ret = LEPT_PARSE_UNCLOSED_BRACKETS;
-            goto fail;
+    }
+}
+
+/* a match of path i, moved out of v if move is set, copied otherwise */
+static void _query_store(lept_query_state* s, size_t i, lept_value* v, int move) {
+    lept_value* result = &s->results[i];
+    if (s->q->paths[i].wildcard) {
+        result = lept_pushback_array_element(result->value.a);
+    } else if (result->type != LEPT_UNKNOWN) { /* the first of duplicate keys */
+        if (move) {
+            lept_free_value_on_stack(v);
         }
+        return;
     }
-success:
-    a = lept_new_array();
-    a->len = len;
-    a->items = head;
-    v->value.a = a;
-    v->type = LEPT_ARRAY;
-    return LEPT_PARSE_OK;
-fail:
-    while (head) {
-        item = head->next;
-        lept_free_array_item(head);
-        head = item;
+    if (move) {
+        *result = *v;
+    } else {
+        _copy_value(result, v);
     }
-    return ret;
 }
 
-static int _parse_object(lept_context* c, lept_value* v) {
-    lept_object* o;
-    lept_object_node* head = NULL;
-    lept_object_node* previous = NULL;
-    lept_object_node* node = NULL;
-    lept_string* key;
-    lept_value* value;
-    size_t len = 0;
-    int ret;
-    EXPECT('{');
-    for (;;) {
-        _parse_whitespace(c);
-        if (CUR() == '}') {
-            NEXT();
-            goto success;
+static void _query_dom(lept_query_state* s, const lept_value* v, size_t n, size_t depth) {
+    const lept_query* q = s->q;
+    const size_t* active = s->active + depth * q->count;
+    size_t* next = s->active + (depth + 1) * q->count;
+    const lept_array* a;
+    const lept_object_node* node;
+    size_t i, k, m;
+    for (k = 0; k < n; ++k) {
+        if (q->paths[active[k]].len == depth) {
+            _query_store(s, active[k], (lept_value*)v, 0);
         }
-        if (CUR() != '\"') {
-            ret = LEPT_PARSE_INVALID_VALUE;
-            goto fail;
-        }
-        key = lept_new_string();
-        if ((ret = _parse_str(c, key)) != LEPT_PARSE_OK) {
-            lept_free_string(key);
-            goto fail;
+    }
+    if (v->type == LEPT_ARRAY) {
+        a = _array_of(v);
+        for (i = 0; i < a->len; ++i) {
+            for (k = m = 0; k < n; ++k) {
+                const lept_query_path* path = &q->paths[active[k]];
+                if (path->len > depth && _token_matches_index(&path->tokens[depth], i)) {
+                    next[m++] = active[k];
+                }
+            }
+            if (m > 0) {
+                _query_dom(s, &a->items[i], m, depth + 1);
+            }
         }
-        _parse_whitespace(c);
-        if (CUR() != ':') {
-            lept_free_string(key);
-            ret = LEPT_PARSE_EXPECT_VALUE;
-            goto fail;
+    } else if (v->type == LEPT_OBJECT) {
+        for (node = _object_of(v)->nodes; node; node = node->next) {
+            for (k = m = 0; k < n; ++k) {
+                const lept_query_path* path = &q->paths[active[k]];
+                if (path->len > depth &&
+                    _token_matches_key(&path->tokens[depth], node->key->str, node->key->len)) {
+                    next[m++] = active[k];
+                }
+            }
+            if (m > 0) {
+                _query_dom(s, &node->value, m, depth + 1);
+            }
         }
+    }
+}
+
+/* move past the value at c->json, looking no further than its end */
+static int _query_skip(lept_context* c) {
+    const char* p;
+    switch (CUR()) {
+        case '[': case '{':
+            if ((p = _match_bracket(c->json, c->end)) == NULL) {
+                return LEPT_PARSE_UNCLOSED_BRACKETS;
+            }
+            c->json = p;
+            return LEPT_PARSE_OK;
+        case '"':
+            for (++c->json;; ++c->json) {
+                c->json = c->scan_string(c->json, c->end);
+                if (c->json == c->end) {
+                    return LEPT_PARSE_UNCLOSED_QUOTES;
+                } else if (*c->json == '"') {
+                    NEXT();
+                    return LEPT_PARSE_OK;
+                } else if (*c->json == '\\' && c->json + 1 != c->end) {
+                    NEXT();
+                }
+            }
+        case '\0':
+            return c->json != c->end ? LEPT_PARSE_INVALID_VALUE : LEPT_PARSE_EXPECT_VALUE;
+        case ']': case '}':
+            return LEPT_PARSE_EXPECT_VALUE;
+        case ',': case ':':
+            return LEPT_PARSE_INVALID_VALUE;
+        default: /* a number or literal */
+            while (c->json != c->end && !ISWHITESPACE(*c->json) &&
+                   *c->json != ',' && *c->json != ']' && *c->json != '}') {
+                NEXT();
+            }
+            return LEPT_PARSE_OK;
+    }
+}
+
+static int _query_stream(lept_query_state* s, lept_context* c, size_t n, size_t depth);
+
+/* the value at c->json, each of its n active paths continues into it */
+static int _query_members(lept_query_state* s, lept_context* c, size_t n, size_t depth) {
+    const lept_query* q = s->q;
+    const size_t* active = s->active + depth * q->count;
+    size_t* next = s->active + (depth + 1) * q->count;
+    int object = CUR() == '{';
+    const char* key = NULL;
+    size_t keylen = 0, i, k, m;
+    int ret;
+    NEXT();
+    _parse_whitespace(c);
+    if (CUR() == (object ? '}' : ']')) {
         NEXT();
-        _parse_whitespace(c);
-        value = lept_new_value();
-        if ((ret = _parse_value(c, value)) != LEPT_PARSE_OK) {
-            lept_free_string(key);
-            lept_free_value(value);
-            goto fail;
+        return LEPT_PARSE_OK;
+    }
+    for (i = 0;; ++i) {
+        if (object) {
+            if (CUR() != '\"') {
+                return LEPT_PARSE_INVALID_VALUE;
+            }
+            if ((ret = _parse_str(c, &key, &keylen)) != LEPT_PARSE_OK) {
+                return ret;
+            }
+            _parse_whitespace(c);
+            if (CUR() != ':') {
+                return LEPT_PARSE_EXPECT_VALUE;
+            }
+            NEXT();
+            _parse_whitespace(c);
         }
-        ++len;
-        node = lept_new_object_node();
-        node->key = key;
-        node->value = value;
-        if (head == NULL) { /* node is first node */
-            head = node;
-        } else {
-            previous->next = node;
+        for (k = m = 0; k < n; ++k) {
+            const lept_query_token* t = &q->paths[active[k]].tokens[depth];
+            if (object ? _token_matches_key(t, key, keylen) : _token_matches_index(t, i)) {
+                next[m++] = active[k];
+            }
+        }
+        ret = m > 0 ? _query_stream(s, c, m, depth + 1) : _query_skip(c);
+        if (ret != LEPT_PARSE_OK) {
+            return ret;
         }
-        previous = node;
         _parse_whitespace(c);
-        if (CUR() == '}') {
+        if (CUR() == (object ? '}' : ']')) {
             NEXT();
-            goto success;
-        } if (CUR() == ',') {
+            return LEPT_PARSE_OK;
+        } else if (CUR() == ',') {
             NEXT();
-            continue;
+            _parse_whitespace(c);
         } else {
-            ret = LEPT_PARSE_UNCLOSED_BRACKETS;
-            goto fail;
+            return LEPT_PARSE_UNCLOSED_BRACKETS;
         }
     }
-success:
-    o = lept_new_object();
-    o->len = len;
-    o->nodes = head;
-    v->value.o = o;
-    v->type = LEPT_OBJECT;
-    return LEPT_PARSE_OK;
-fail:
-    while (head) {
-        node = head->next;
-        lept_free_object_node(head);
-        head = node;
-    }
-    return ret;
 }
 
-static int _parse_value(lept_context* c, lept_value* v) {
-    switch (CUR()) {
-        case 'n':
-            return _parse_literal(c, v, "null", LEPT_NULL);
-        case 't':
-            return _parse_literal(c, v, "true", LEPT_TRUE);
-        case 'f':
-            return _parse_literal(c, v, "false", LEPT_FALSE);
-        case '"':
-            return _parse_string(c, v);
-        case '[':
-            return _parse_array(c, v);
-        case '{':
-            return _parse_object(c, v);
-        case '0': case '1': case '2': case '3': case '4':
-        case '5': case '6': case '7': case '8': case '9':
-        case '-':
-            return _parse_number(c, v);
-        case ']': case '}': case '\0':
-            return LEPT_PARSE_EXPECT_VALUE;
-        default :
-            return LEPT_PARSE_INVALID_VALUE;
+static int _query_stream(lept_query_state* s, lept_context* c, size_t n, size_t depth) {
+    const size_t* active = s->active + depth * s->q->count;
+    lept_value v;
+    size_t k;
+    int ret;
+    for (k = 0; k < n; ++k) {
+        if (s->q->paths[active[k]].len == depth) { /* build it */
+            if ((ret = _parse_value(c)) != LEPT_PARSE_OK) {
+                return ret;
+            }
+            memcpy(&v, _context_pop(c, sizeof(lept_value)), sizeof(lept_value));
+            if (n == 1) {
+                _query_store(s, active[0], &v, 1);
+            } else {
+                _query_dom(s, &v, n, depth);
+                lept_free_value_on_stack(&v);
+            }
+            return LEPT_PARSE_OK;
+        }
+    }
+    if (n > 0 && (CUR() == '[' || CUR() == '{')) {
+        return _query_members(s, c, n, depth);
     }
+    return _query_skip(c);
 }
 
-int lept_parse(lept_value* v, const char* json) {
+int lept_query_run(const lept_query* q, const char* json, size_t len, lept_value* results) {
+    lept_query_state s;
     lept_context c;
+    lept_value v;
+    size_t i;
     int ret;
-    assert(v != NULL);
+    assert(q != NULL);
     assert(json != NULL);
-    c.json = json;
-    v->type = LEPT_UNKNOWN;
+    _query_begin(&s, q, results);
+    _context_init(&c, json, len, NULL);
+    c.handler = &_dom_handler;
+    c.handler_ctx = &c;
     _parse_whitespace(&c);
-    if ((ret = _parse_value(&c, v)) == LEPT_PARSE_OK) {
+    if ((ret = _query_stream(&s, &c, q->count, 0)) == LEPT_PARSE_OK) {
         _parse_whitespace(&c);
-        if (*c.json != '\0') {
+        if (c.json != c.end) {
             ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
         }
+    } else {
+        _dom_finish(&c, &v, ret); /* release a half built match */
+        for (i = 0; i < q->count; ++i) {
+            lept_free_value_on_stack(&results[i]);
+            results[i].type = LEPT_UNKNOWN;
+        }
     }
+    _context_free(&c);
+    FREE(s.active);
     return ret;
 }
 
-lept_string* lept_new_string() {
-    lept_string* s = NEW(lept_string);
-    s->len = 0;
-    s->str = NULL;
-    return s;
+void lept_query_run_value(const lept_query* q, const lept_value* v, lept_value* results) {
+    lept_query_state s;
+    assert(q != NULL);
+    assert(v != NULL);
+    _query_begin(&s, q, results);
+    _query_dom(&s, v, q->count, 0);
+    FREE(s.active);
 }
 
-lept_array_item* lept_new_array_item() {
-    lept_array_item* i = NEW(lept_array_item);
-    i->next = NULL;
-    i->value = NULL;
-    return i;
-}
+/*
+ * Tape. The parser reports to a handler that appends words, keeping the
+ * start of each open container on the context stack until its end. Both
+ * buffers are sized from the input up front: a value takes at least as
+ * many input bytes as it takes words, minus the missing separator of a
+ * number at the end, and a string never decodes to more than its quotes
+ * and content.
+ */
 
-lept_array* lept_new_array() {
-    lept_array* a = NEW(lept_array);
-    a->len = 0;
-    a->items = NULL;
-    return a;
+#define TAPE_WORD(tag, payload) ((uint64_t)(unsigned char)(tag) << 56 | (uint64_t)(payload))
+#define TAPE_TAG(w)             ((char)((w) >> 56))
+#define TAPE_PAYLOAD(w)         ((w) & (((uint64_t)1 << 56) - 1))
+
+typedef struct {
+    lept_context* c;
+    lept_tape* t;
+} lept_tape_builder;
+
+static int _tape_null(void* ctx) {
+    lept_tape* t = ((lept_tape_builder*)ctx)->t;
+    t->words[t->len++] = TAPE_WORD('n', 0);
+    return 0;
 }
 
-lept_object_node* lept_new_object_node() {
-    lept_object_node* n = NEW(lept_object_node);
-    n->next = NULL;
-    n->key = NULL;
-    n->value = NULL;
-    return n;
+static int _tape_bool(void* ctx, int b) {
+    lept_tape* t = ((lept_tape_builder*)ctx)->t;
+    t->words[t->len++] = TAPE_WORD(b ? 't' : 'f', 0);
+    return 0;
 }
 
-lept_object* lept_new_object() {
-    lept_object* o = NEW(lept_object);
-    o->len = 0;
-    o->nodes = NULL;
-    return o;
+static int _tape_number(void* ctx, double n) {
+    lept_tape* t = ((lept_tape_builder*)ctx)->t;
+    t->words[t->len++] = TAPE_WORD('d', 0);
+    memcpy(&t->words[t->len++], &n, sizeof(double));
+    return 0;
 }
 
-lept_value* lept_new_value() {
-    lept_value* v = NEW(lept_value);
-    v->type = LEPT_UNKNOWN;
-    return v;
+static int _tape_string(void* ctx, const char* str, size_t len) {
+    lept_tape* t = ((lept_tape_builder*)ctx)->t;
+    t->words[t->len++] = TAPE_WORD('"', t->strings_len);
+    t->words[t->len++] = len;
+    memcpy(t->strings + t->strings_len, str, len);
+    t->strings[t->strings_len + len] = '\0';
+    t->strings_len += len + 1;
+    return 0;
 }
 
-void lept_free_string(lept_string* s) {
-    assert(s != NULL);
-    free(s->str);
-    free(s);
+static int _tape_start(lept_tape_builder* b) {
+    *(size_t*)_context_push(b->c, sizeof(size_t)) = b->t->len++;
+    return 0;
 }
 
-void lept_free_array_item(lept_array_item* i) {
-    assert(i != NULL);
-    lept_free_value(i->value);
-    free(i);
+static int _tape_end(lept_tape_builder* b, char open, char close, size_t len) {
+    lept_tape* t = b->t;
+    size_t start = *(size_t*)_context_pop(b->c, sizeof(size_t));
+    t->words[t->len++] = TAPE_WORD(close, len);
+    t->words[start] = TAPE_WORD(open, t->len);
+    return 0;
 }
 
-void lept_free_array(lept_array* a) {
-    lept_array_item* item;
-    lept_array_item* next;
-    assert(a != NULL);
-    for (item = a->items; item; item = next) {
-        next = item->next;
-        lept_free_array_item(item);
+static int _tape_start_array(void* ctx)              { return _tape_start((lept_tape_builder*)ctx); }
+static int _tape_end_array(void* ctx, size_t len)    { return _tape_end((lept_tape_builder*)ctx, '[', ']', len); }
+static int _tape_start_object(void* ctx)             { return _tape_start((lept_tape_builder*)ctx); }
+static int _tape_end_object(void* ctx, size_t len)   { return _tape_end((lept_tape_builder*)ctx, '{', '}', len); }
+
+static const lept_handler _tape_handler = {
+    _tape_null,
+    _tape_bool,
+    _tape_number,
+    _tape_string,
+    _tape_start_object,
+    _tape_string,   /* on_key */
+    _tape_end_object,
+    _tape_start_array,
+    _tape_end_array
+};
+
+int lept_parse_tape(lept_tape* t, const char* json, size_t len) {
+    lept_tape_builder b;
+    lept_context c;
+    int ret;
+    assert(t != NULL);
+    assert(json != NULL || len == 0);
+    t->words = NEWN(len + 2, uint64_t);
+    t->strings = NEWN(len + 1, char);
+    t->len = t->strings_len = 0;
+    _context_init(&c, json, len, NULL);
+    b.c = &c;
+    b.t = t;
+    c.handler = &_tape_handler;
+    c.handler_ctx = &b;
+    ret = _parse_root(&c);
+    _context_free(&c);
+    if (ret != LEPT_PARSE_OK && ret != LEPT_PARSE_ROOT_NOT_SINGULAR) {
+        lept_tape_free(t);
+        return ret;
     }
-    free(a);
+    assert(t->len <= len + 2 && t->strings_len <= len + 1);
+    t->words = (uint64_t*)REALLOC(t->words, t->len * sizeof(uint64_t));
+    if (t->strings_len > 0) {
+        t->strings = (char*)REALLOC(t->strings, t->strings_len);
+    }
+    return ret;
 }
 
-void lept_free_object_node(lept_object_node* n) {
-    assert(n != NULL);
-    lept_free_string(n->key);
-    lept_free_value(n->value);
-    free(n);
+void lept_tape_free(lept_tape* t) {
+    assert(t != NULL);
+    FREE(t->words);
+    FREE(t->strings);
+    t->words = NULL;
+    t->strings = NULL;
+    t->len = t->strings_len = 0;
 }
 
-void lept_free_object(lept_object* o) {
-    lept_object_node* node;
-    lept_object_node* next;
-    assert(o != NULL);
-    for (node = o->nodes; node; node = next) {
-        next = node->next;
-        lept_free_object_node(node);
-    }
-    free(o);
+lept_tape_iter lept_tape_root(const lept_tape* t) {
+    lept_tape_iter it;
+    assert(t != NULL && t->len > 0);
+    it.tape = t;
+    it.index = 0;
+    return it;
 }
 
-void lept_free_value_on_stack(lept_value* v) {
-    assert(v != NULL);
-    switch (v->type) {
-        case LEPT_STRING: lept_free_string(v->value.s); break;
-        case LEPT_ARRAY : lept_free_array(v->value.a);  break;
-        case LEPT_OBJECT: lept_free_object(v->value.o); break;
-        default: break;
+#define TAPE_AT(it) ((it).tape->words[(it).index])
+
+lept_type lept_tape_get_type(lept_tape_iter it) {
+    switch (TAPE_TAG(TAPE_AT(it))) {
+        case 'n': return LEPT_NULL;
+        case 't': return LEPT_TRUE;
+        case 'f': return LEPT_FALSE;
+        case 'd': return LEPT_NUMBER;
+        case '"': return LEPT_STRING;
+        case '[': return LEPT_ARRAY;
+        case '{': return LEPT_OBJECT;
+        default:  return LEPT_UNKNOWN; /* the end of a container */
     }
 }
 
-void lept_free_value(lept_value* v) {
-    assert(v != NULL);
-    lept_free_value_on_stack(v);
-    free(v);
+double lept_tape_get_number(lept_tape_iter it) {
+    double n;
+    assert(TAPE_TAG(TAPE_AT(it)) == 'd');
+    memcpy(&n, &it.tape->words[it.index + 1], sizeof(double));
+    return n;
 }
 
-int lept_parse_file(lept_value* v, const char* path) {
-    char* buffer;
-    int ret;
-    long file_size;
-    long result;
-    FILE* file = fopen(path, "r");
-    if (file == NULL) return LEPT_FILE_CANNOT_OPEN;
-    fseek(file, 0, SEEK_END);
-    file_size = ftell(file);
-    rewind(file);
-    buffer = NEWN(file_size + 1, char);
-    result = fread(buffer, 1, file_size, file);
-    buffer[file_size] = '\0';
-    if (result != file_size) {
-        ret = LEPT_FILE_READ_ERROR;
-        goto cleanup;
-    }
-    ret = lept_parse(v, buffer);
-cleanup:
-    fclose(file);
-    free(buffer);
-    return ret;
+const char* lept_tape_get_string(lept_tape_iter it) {
+    assert(TAPE_TAG(TAPE_AT(it)) == '"');
+    return it.tape->strings + TAPE_PAYLOAD(TAPE_AT(it));
 }
 
-lept_type lept_get_type(const lept_value* v) {
-    assert(v != NULL);
-    return v->type;
+size_t lept_tape_get_string_length(lept_tape_iter it) {
+    assert(TAPE_TAG(TAPE_AT(it)) == '"');
+    return (size_t)it.tape->words[it.index + 1];
 }
 
-double lept_get_number(const lept_value* v) {
-    assert(v != NULL);
-    assert(v->type == LEPT_NUMBER);
-    return v->value.n;
+size_t lept_tape_get_size(lept_tape_iter it) {
+    uint64_t w = TAPE_AT(it);
+    assert(TAPE_TAG(w) == '[' || TAPE_TAG(w) == '{');
+    w = it.tape->words[TAPE_PAYLOAD(w) - 1];
+    return (size_t)(TAPE_TAG(w) == '}' ? 2 * TAPE_PAYLOAD(w) : TAPE_PAYLOAD(w));
 }
 
-lept_string* lept_get_string(const lept_value* v) {
-    assert(v != NULL);
-    assert(v->type == LEPT_STRING);
-    return v->value.s;
+lept_tape_iter lept_tape_first(lept_tape_iter container) {
+    assert(TAPE_TAG(TAPE_AT(container)) == '[' || TAPE_TAG(TAPE_AT(container)) == '{');
+    ++container.index;
+    return container;
 }
 
-lept_array* lept_get_array(const lept_value* v) {
-    assert(v != NULL);
-    assert(v->type == LEPT_ARRAY);
-    return v->value.a;
+lept_tape_iter lept_tape_next(lept_tape_iter it) {
+    uint64_t w = TAPE_AT(it);
+    switch (TAPE_TAG(w)) {
+        case '[': case '{': it.index = (size_t)TAPE_PAYLOAD(w); break;
+        case 'd': case '"': it.index += 2; break;
+        default:            it.index += 1; break;
+    }
+    return it;
 }
 
-lept_object* lept_get_object(const lept_value* v) {
+int lept_tape_is_end(lept_tape_iter it) {
+    char tag = TAPE_TAG(TAPE_AT(it));
+    return tag == ']' || tag == '}';
+}
+
+lept_tape_iter lept_tape_find(lept_tape_iter object, const char* key, size_t keylen) {
+    lept_tape_iter it;
+    assert(TAPE_TAG(TAPE_AT(object)) == '{');
+    for (it = lept_tape_first(object); !lept_tape_is_end(it); it = lept_tape_next(it)) {
+        int match = lept_tape_get_string_length(it) == keylen &&
+                    memcmp(lept_tape_get_string(it), key, keylen) == 0;
+        it = lept_tape_next(it);
+        if (match) {
+            return it;
+        }
+    }
+    return it;
+}
+
+void lept_tape_to_value(lept_tape_iter it, lept_value* v) {
+    lept_object_node** tail;
+    lept_tape_iter e;
     assert(v != NULL);
-    assert(v->type == LEPT_OBJECT);
-    return v->value.o;
+    switch (TAPE_TAG(TAPE_AT(it))) {
+        case 'n': v->type = LEPT_NULL;  break;
+        case 't': v->type = LEPT_TRUE;  break;
+        case 'f': v->type = LEPT_FALSE; break;
+        case 'd':
+            v->type = LEPT_NUMBER;
+            v->value.n = lept_tape_get_number(it);
+            break;
+        case '"':
+            lept_set_string(v, lept_tape_get_string(it), lept_tape_get_string_length(it));
+            break;
+        case '[':
+            v->type = LEPT_ARRAY;
+            v->value.a = lept_new_array();
+            lept_reserve_array(v->value.a, lept_tape_get_size(it));
+            for (e = lept_tape_first(it); !lept_tape_is_end(e); e = lept_tape_next(e)) {
+                lept_tape_to_value(e, lept_pushback_array_element(v->value.a));
+            }
+            break;
+        case '{':
+            v->type = LEPT_OBJECT;
+            v->value.o = lept_new_object();
+            v->value.o->len = lept_tape_get_size(it) / 2;
+            tail = &v->value.o->nodes;
+            for (e = lept_tape_first(it); !lept_tape_is_end(e); e = lept_tape_next(e)) {
+                *tail = lept_new_object_node();
+                (*tail)->key = _string_block(MALLOC(sizeof(lept_string) + lept_tape_get_string_length(e) + 1),
+                                             lept_tape_get_string(e), lept_tape_get_string_length(e));
+                e = lept_tape_next(e);
+                lept_tape_to_value(e, &(*tail)->value);
+                tail = &(*tail)->next;
+            }
+            break;
+        default:
+            assert(0); /* not a value */
+    }
 }
+
+#undef TAPE_AT
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h> /* size_t */
+#include <stdint.h> /* uint32_t, uint64_t */
 
 typedef enum {
     LEPT_UNKNOWN,
@@ -20,45 +21,187 @@ typedef enum {
 
 DECLARE_STRUCT(lept_string)
 DECLARE_STRUCT(lept_value)
-DECLARE_STRUCT(lept_array_item)
 DECLARE_STRUCT(lept_array)
 DECLARE_STRUCT(lept_object_node)
+DECLARE_STRUCT(lept_object_index)
 DECLARE_STRUCT(lept_object)
+DECLARE_STRUCT(lept_allocator)
+DECLARE_STRUCT(lept_allocator_stats)
+DECLARE_STRUCT(lept_counting_allocator)
+DECLARE_STRUCT(lept_arena_chunk)
+DECLARE_STRUCT(lept_arena)
+DECLARE_STRUCT(lept_parse_options)
+DECLARE_STRUCT(lept_buffer)
+DECLARE_STRUCT(lept_handler)
+DECLARE_STRUCT(lept_push_parser)
+DECLARE_STRUCT(lept_query)
+DECLARE_STRUCT(lept_key_pool)
+DECLARE_STRUCT(lept_parse_cache)
+DECLARE_STRUCT(lept_parse_cache_stats)
+DECLARE_STRUCT(lept_tape)
+DECLARE_STRUCT(lept_tape_iter)
+
+/* strings up to this length are stored in the value itself */
+#define LEPT_SHORT_STRING_MAX 14
 
 STRUCT(lept_value) {
-    lept_type type;
     union {
         double n;
-        lept_string* s;
+        lept_string* s; /* a string longer than LEPT_SHORT_STRING_MAX */
         lept_array* a;
         lept_object* o;
     } value;
+    /*
+     * A short string takes the first LEPT_SHORT_STRING_MAX bytes of the
+     * value and is terminated by its first unused byte, or by short_spare
+     * (LEPT_SHORT_STRING_MAX - length) once it is full.
+     */
+    char short_tail[LEPT_SHORT_STRING_MAX - 8];
+    unsigned char short_spare; /* 0xFF if value.s holds the string */
+    unsigned char type;        /* lept_type */
 };
 
 STRUCT(lept_string) {
     size_t len;
     char* str;
-};
-
-STRUCT(lept_array_item) {
-    lept_array_item* next;
-    lept_value* value;
+    int borrowed; /* str is not freed: it is in an insitu buffer or this block */
+    int interned; /* a key shared through a lept_key_pool */
+    size_t refs;  /* owners, more than one after lept_copy() */
 };
 
 STRUCT(lept_array) {
     size_t len;
-    lept_array_item* items;
+    size_t capacity;
+    lept_value* items; /* contiguous, items[0] .. items[len - 1] */
+    const char* lazy;  /* unparsed source [lazy, lazy_end), NULL once parsed */
+    const char* lazy_end;
+    size_t refs;       /* owners, more than one after lept_copy() */
+    size_t hash;       /* lept_hash() of the array, 0 until it is asked for */
 };
 
 STRUCT(lept_object_node) {
     lept_object_node* next;
     lept_string* key;
-    lept_value* value;
+    lept_value value;
 };
 
 STRUCT(lept_object) {
     size_t len;
     lept_object_node* nodes;
+    lept_object_index* index; /* key hash index, built on demand */
+    lept_arena* arena;        /* owner of the nodes, NULL if malloc'ed */
+    const lept_allocator* allocator; /* of the index when not in an arena */
+    const char* lazy;         /* unparsed source [lazy, lazy_end), NULL once parsed */
+    const char* lazy_end;
+    size_t refs;              /* owners, more than one after lept_copy() */
+    size_t hash;              /* lept_hash() of the object, 0 until it is asked for */
+};
+
+/*
+ * Where the library gets memory. The functions behave like malloc(),
+ * realloc() and free() and get ctx first; they must be thread-safe if the
+ * library is used from several threads.
+ */
+STRUCT(lept_allocator) {
+    void* (*malloc)(void* ctx, size_t size);
+    void* (*realloc)(void* ctx, void* p, size_t size);
+    void (*free)(void* ctx, void* p);
+    void* ctx;
+};
+
+STRUCT(lept_allocator_stats) {
+    size_t allocations; /* calls to malloc and realloc */
+    size_t frees;
+    size_t bytes;       /* live now */
+    size_t peak_bytes;  /* most bytes live at once */
+};
+
+/* counts what passes through to base, updated atomically */
+STRUCT(lept_counting_allocator) {
+    lept_allocator allocator; /* hand this one to the library */
+    const lept_allocator* base;
+    lept_allocator_stats stats;
+};
+
+STRUCT(lept_arena_chunk) {
+    lept_arena_chunk* next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+};
+
+/*
+ * A region of bump-allocated chunks. Values parsed with lept_parse_arena()
+ * live here until lept_arena_reset(), which keeps the chunks for reuse.
+ */
+STRUCT(lept_arena) {
+    lept_arena_chunk* chunks;  /* all chunks, in allocation order */
+    lept_arena_chunk* current; /* chunk being bump-allocated from */
+    char* stack;               /* scratch space of the parser, kept across resets */
+    size_t stack_size;
+    const lept_allocator* allocator; /* of chunks and stack, the global one after init */
+};
+
+STRUCT(lept_parse_options) {
+    int flags;         /* LEPT_PARSE_* flags */
+    lept_arena* arena; /* allocate the document from an arena, may be NULL */
+    lept_key_pool* keys; /* share object keys through a pool, may be NULL */
+    /* allocate the document from this instead of the global allocator, may be NULL */
+    const lept_allocator* allocator;
+    /*
+     * Deepest nesting accepted, 0 for LEPT_PARSE_MAX_DEPTH. Parsing needs
+     * no C stack per level, but freeing and stringifying a document do.
+     */
+    size_t max_depth;
+};
+
+/*
+ * A document flattened in parse order. Each value is one or two words: a
+ * tag byte and a payload, then the bits of a number or a string length.
+ * A container start holds the index past its end, the end holds the
+ * count of values inside. Strings are NUL terminated in one buffer.
+ */
+STRUCT(lept_tape) {
+    uint64_t* words;
+    size_t len;
+    char* strings;
+    size_t strings_len;
+};
+
+/* a position on a tape, valid while the tape is */
+STRUCT(lept_tape_iter) {
+    const lept_tape* tape;
+    size_t index;
+};
+
+/* growable output of lept_stringify(), reuse it to avoid reallocation */
+STRUCT(lept_buffer) {
+    char* data; /* NUL-terminated, NULL until the first write */
+    size_t len;
+    size_t capacity;
+};
+
+/*
+ * Events of lept_parse_sax(), any of them may be NULL. An event returning
+ * nonzero stops the parse with LEPT_PARSE_STOPPED. Strings and keys are
+ * unescaped, not NUL-terminated and only valid during the call.
+ */
+STRUCT(lept_handler) {
+    int (*on_null)(void* ctx);
+    int (*on_bool)(void* ctx, int b);
+    int (*on_number)(void* ctx, double n);
+    int (*on_string)(void* ctx, const char* str, size_t len);
+    int (*on_start_object)(void* ctx);
+    int (*on_key)(void* ctx, const char* str, size_t len);
+    int (*on_end_object)(void* ctx, size_t len);
+    int (*on_start_array)(void* ctx);
+    int (*on_end_array)(void* ctx, size_t len);
+};
+
+STRUCT(lept_parse_cache_stats) {
+    size_t hits;
+    size_t misses;
+    size_t entries;
+    size_t bytes; /* kept texts, paths and documents */
 };
 
 #undef DECLARE_STRUCT
@@ -67,36 +210,275 @@ STRUCT(lept_object) {
 enum {
     LEPT_PARSE_OK = 0,
     LEPT_PARSE_EXPECT_VALUE,
-    LEPT_PARSE_INVALID_VALUE,
+    LEPT_PARSE_INVALID_VALUE, /* also bad escapes and ill-formed UTF-8 in strings */
     LEPT_PARSE_UNCLOSED_QUOTES,
     LEPT_PARSE_UNCLOSED_BRACKETS,
     LEPT_PARSE_ROOT_NOT_SINGULAR,
     LEPT_PARSE_NUMBER_TOO_BIG,
     LEPT_FILE_CANNOT_OPEN,
     LEPT_FILE_READ_ERROR,
+    LEPT_PARSE_STOPPED,
+    LEPT_PARSE_TOO_DEEP, /* nested deeper than lept_parse_options.max_depth */
+    LEPT_PARSE_INVALID_OPTIONS /* lept_parse_options that do not go together */
 };
 
+/* lept_parse_options.flags */
+enum {
+    LEPT_PARSE_INDEX_OBJECTS = 1 << 0, /* build key indexes while parsing */
+    /*
+     * Validate the whole text but only keep the source of containers, which
+     * are parsed one level at a time on first access. The text must outlive
+     * the value. An arena or allocator gives LEPT_PARSE_INVALID_OPTIONS, as
+     * the levels come from the global allocator. The key pool and
+     * LEPT_PARSE_INDEX_OBJECTS are ignored: every key is copied, and an
+     * index is built on the first lookup as without the flag. Reading a
+     * lazy tree from several threads at once needs a lock.
+     */
+    LEPT_PARSE_LAZY = 1 << 1
+};
+
+/*
+ * Deepest nesting accepted without options or with max_depth 0. Freeing,
+ * copying, comparing and stringifying a document take some C stack per
+ * level, and this keeps them within the stack of a small worker thread.
+ */
+#ifndef LEPT_PARSE_MAX_DEPTH
+#define LEPT_PARSE_MAX_DEPTH 512
+#endif
+/* lept_parse_options.max_depth for trusted documents and a stack to match */
+#define LEPT_PARSE_DEPTH_UNLIMITED ((size_t)-1)
+
+/* objects with fewer members are searched linearly unless indexed explicitly */
+#ifndef LEPT_OBJECT_INDEX_MIN
+#define LEPT_OBJECT_INDEX_MIN 8
+#endif
+
 int lept_parse(lept_value* v, const char* json);
+int lept_parse_opts(lept_value* v, const char* json, const lept_parse_options* opts);
+/* json needs no terminator, a '\0' inside it is not the end of the input */
+int lept_parse_n(lept_value* v, const char* json, size_t len);
+/* reports the document to handler as events instead of building a tree */
+int lept_parse_sax(const char* json, const lept_handler* handler, void* ctx);
+/*
+ * Decodes strings inside json, which must outlive v. The closing quote of
+ * every string is overwritten with '\0'. Short strings are still copied
+ * into their values.
+ */
+int lept_parse_insitu(lept_value* v, char* json, size_t len);
 int lept_parse_file(lept_value* v, const char* path);
 
+/*
+ * Incremental parsing of a document arriving in chunks, which may be split
+ * at any byte. feed() returns the first error as soon as it is seen, and
+ * finish() completes the tree, after which the parser takes a new document.
+ */
+lept_push_parser* lept_push_parser_new(const lept_parse_options* opts);
+void lept_push_parser_free(lept_push_parser* p);
+int lept_push_parser_feed(lept_push_parser* p, const char* chunk, size_t len);
+int lept_push_parser_finish(lept_push_parser* p, lept_value* v);
+
+/* lept_parse_ndjson() flags, LEPT_PARSE_* flags may be added */
+enum {
+    LEPT_NDJSON_ORDERED = 1 << 16 /* call back in line order */
+};
+
+/*
+ * Called for every line that is not blank, with offset being where the line
+ * starts in buf and ret its parse result. v lives in a per-thread arena and
+ * is only valid during the call. Without LEPT_NDJSON_ORDERED the callback
+ * runs concurrently on several threads. Returning nonzero stops the batch.
+ */
+typedef int (*lept_ndjson_callback)(void* ctx, size_t offset, lept_value* v, int ret);
+
+/* parse newline delimited JSON on nthreads threads, <= 0 for one per CPU */
+int lept_parse_ndjson(const char* buf, size_t len, int nthreads, int flags,
+                      lept_ndjson_callback callback, void* ctx);
+
+/*
+ * Builds the members of a large root array or object on nthreads threads,
+ * <= 0 for one per CPU. Gives the same tree and errors as lept_parse_n().
+ */
+int lept_parse_parallel(lept_value* v, const char* json, size_t len, int nthreads);
+/*
+ * Offsets of the structural characters {}[],: outside strings, in a
+ * malloc'ed array the caller frees. len must fit in 32 bits.
+ */
+uint32_t* lept_find_structurals(const char* json, size_t len, size_t* count);
+
+/*
+ * A set of JSON Pointers (RFC 6901) compiled once and run over many
+ * documents. A "*" token matches every element or member. Returns NULL if
+ * a path is neither empty nor starts with '/', or has a bad '~' escape.
+ */
+lept_query* lept_query_compile(const char* const* paths, size_t count);
+void lept_query_free(lept_query* q);
+/*
+ * results[i] receives the value paths[i] points to, LEPT_UNKNOWN if there
+ * is none; a path with a "*" gets an array of all its matches instead.
+ * Values off every path are skipped by scanning for their end, so errors
+ * inside them go unreported. On errors all results are LEPT_UNKNOWN.
+ */
+int lept_query_run(const lept_query* q, const char* json, size_t len, lept_value* results);
+void lept_query_run_value(const lept_query* q, const lept_value* v, lept_value* results);
+
+/*
+ * Two allocations for the whole document. t is empty on errors except
+ * LEPT_PARSE_ROOT_NOT_SINGULAR, which keeps the first value and must be
+ * freed.
+ */
+int lept_parse_tape(lept_tape* t, const char* json, size_t len);
+void lept_tape_free(lept_tape* t);
+lept_tape_iter lept_tape_root(const lept_tape* t);
+lept_type lept_tape_get_type(lept_tape_iter it);
+double lept_tape_get_number(lept_tape_iter it);
+const char* lept_tape_get_string(lept_tape_iter it);
+size_t lept_tape_get_string_length(lept_tape_iter it);
+/* values in an array, keys and values in an object */
+size_t lept_tape_get_size(lept_tape_iter it);
+/* iterate with lept_tape_next() from the first until lept_tape_is_end() */
+lept_tape_iter lept_tape_first(lept_tape_iter container);
+lept_tape_iter lept_tape_next(lept_tape_iter it);
+int lept_tape_is_end(lept_tape_iter it);
+/* the value of key, at the end of the object if there is none */
+lept_tape_iter lept_tape_find(lept_tape_iter object, const char* key, size_t keylen);
+/* a malloc'ed copy of the value at it */
+void lept_tape_to_value(lept_tape_iter it, lept_value* v);
+
+/*
+ * The allocator used when a call is given none, the C library's until set.
+ * Set it before other threads use the library and keep it while anything
+ * allocated from it is alive; NULL restores the default.
+ */
+void lept_set_allocator(const lept_allocator* a);
+const lept_allocator* lept_get_allocator();
+/* base may be NULL for the global allocator */
+void lept_counting_allocator_init(lept_counting_allocator* a, const lept_allocator* base);
+
+void lept_arena_init(lept_arena* a);
+void lept_arena_reset(lept_arena* a);
+void lept_arena_free(lept_arena* a);
+void* lept_arena_alloc(lept_arena* a, size_t size);
+/* values parsed into an arena must not be passed to lept_free_*() */
+int lept_parse_arena(lept_arena* a, lept_value* v, const char* json);
+
+/*
+ * Interned object keys, shared by every document parsed with the pool and
+ * by threads parsing at the same time. Each use holds a reference that
+ * lept_free_string() drops, so documents may outlive the pool; documents
+ * in an arena hold none and must not.
+ */
+lept_key_pool* lept_key_pool_new();
+void lept_key_pool_free(lept_key_pool* p);
+/* the shared key equal to str, with a reference for the caller */
+lept_string* lept_key_pool_intern(lept_key_pool* p, const char* str, size_t len);
+
+/*
+ * Documents kept by the hash of their text, for input that is parsed again
+ * and again. A hit gives a lept_copy() of the kept document, shared until
+ * it is written. The least recently used documents go once the cache holds
+ * more than max_bytes. Threads may share a cache.
+ */
+lept_parse_cache* lept_parse_cache_new(size_t max_bytes);
+/* documents given out stay valid */
+void lept_parse_cache_free(lept_parse_cache* c);
+/* as lept_parse_n(), a document that fails to parse is not kept */
+int lept_parse_cached(lept_parse_cache* c, lept_value* v, const char* json, size_t len);
+/* as lept_parse_file(), the file is read again once its size or modification time changes */
+int lept_parse_file_cached(lept_parse_cache* c, lept_value* v, const char* path);
+void lept_parse_cache_get_stats(lept_parse_cache* c, lept_parse_cache_stats* stats);
+
+enum {
+    LEPT_STRINGIFY_OK = 0,
+    LEPT_STRINGIFY_INVALID_VALUE /* unknown type, NaN or infinity */
+};
+
+void lept_buffer_init(lept_buffer* b);
+void lept_buffer_reset(lept_buffer* b);
+void lept_buffer_free(lept_buffer* b);
+
+/* append the JSON text of v to b, nothing is appended on failure */
+int lept_stringify(const lept_value* v, lept_buffer* b);
+int lept_stringify_pretty(const lept_value* v, lept_buffer* b);
+
+/* append the MessagePack or CBOR encoding of v to b, nothing is appended on failure */
+int lept_to_msgpack(const lept_value* v, lept_buffer* b);
+int lept_to_cbor(const lept_value* v, lept_buffer* b);
+/*
+ * Decode one value as lept_parse_opts() parses text, opts may be NULL.
+ * Map keys must be strings; bin, ext, byte strings, tags and chunked
+ * strings are invalid values. Decoding takes C stack per level, so
+ * LEPT_PARSE_DEPTH_UNLIMITED is only for data from a trusted source.
+ */
+int lept_from_msgpack(lept_value* v, const char* data, size_t len, const lept_parse_options* opts);
+int lept_from_cbor(lept_value* v, const char* data, size_t len, const lept_parse_options* opts);
+
 lept_string* lept_new_string();
-lept_array_item* lept_new_array_item();
 lept_array* lept_new_array();
 lept_object_node* lept_new_object_node();
 lept_object* lept_new_object();
 lept_value* lept_new_value();
 
 void lept_free_string(lept_string* s);
-void lept_free_array_item(lept_array_item* i);
 void lept_free_array(lept_array* a);
 void lept_free_object_node(lept_object_node* n);
 void lept_free_object(lept_object* o);
 void lept_free_value(lept_value* v);
 void lept_free_value_on_stack(lept_value* v);
+/*
+ * lept_free_*() and the setters use the global allocator. A document parsed
+ * with lept_parse_options.allocator is read-only and freed with this.
+ */
+void lept_free_value_with(lept_value* v, const lept_allocator* a);
+
+/*
+ * dst shares the strings, arrays and objects of src, so a copy takes O(1)
+ * whatever the size of src, and each copy is freed on its own. Shared
+ * containers are copied on write: change one only through what
+ * lept_get_mutable_array() or lept_get_mutable_object() return. The
+ * references are counted atomically and lookups may run concurrently, so
+ * copies can go to other threads. Lazily parsed containers are filled in
+ * on first access, which is not safe to race.
+ */
+void lept_copy(lept_value* dst, const lept_value* src);
+/* leaves src LEPT_UNKNOWN; dst is overwritten without being freed, as by lept_copy() */
+void lept_move(lept_value* dst, lept_value* src);
+void lept_swap(lept_value* a, lept_value* b);
 
 lept_type lept_get_type(const lept_value* v);
 
 double lept_get_number(const lept_value* v);
-lept_string* lept_get_string(const lept_value* v);
+/* the characters of a short string move with the value */
+const char* lept_get_string(const lept_value* v);
+size_t lept_get_string_length(const lept_value* v);
+/* a copy of str in v, which is overwritten without being freed */
+void lept_set_string(lept_value* v, const char* str, size_t len);
 lept_array* lept_get_array(const lept_value* v);
+/*
+ * The array of v for changing. If it is shared, v first gets its own copy
+ * of this level, whose elements share what they held.
+ */
+lept_array* lept_get_mutable_array(lept_value* v);
+size_t lept_get_array_size(const lept_value* v);
+lept_value* lept_get_array_element(const lept_value* v, size_t index);
+
+void lept_reserve_array(lept_array* a, size_t capacity);
+lept_value* lept_pushback_array_element(lept_array* a);
 lept_object* lept_get_object(const lept_value* v);
+/* as lept_get_mutable_array(), the nodes are copied and share their keys and values */
+lept_object* lept_get_mutable_object(lept_value* v);
+lept_value* lept_find_object_value(const lept_value* v, const char* key, size_t keylen);
+/* a key interned in the pool the object was parsed with is found by address */
+lept_value* lept_find_object_key(const lept_value* v, const lept_string* key);
+
+/* rebuilds the key index of o, call it again after changing o->nodes */
+void lept_index_object(lept_object* o);
+
+/* the same JSON: objects match whatever the order of their keys, and -0 equals 0 */
+int lept_is_equal(const lept_value* a, const lept_value* b);
+/*
+ * Equal values hash the same, in every run. Arrays and objects keep their
+ * hash; lept_get_mutable_array(), lept_get_mutable_object(),
+ * lept_pushback_array_element() and lept_index_object() forget it, so a
+ * container changed any other way must not have been hashed.
+ */
+size_t lept_hash(const lept_value* v);
@@ -61,24 +61,54 @@ TEST(simple, number) {
     TEST_NUMBER("-2.2250738585072014e-308" , -2.2250738585072014e-308);
     TEST_NUMBER("1.7976931348623157e+308"  ,  1.7976931348623157e+308);  /* Max double */
     TEST_NUMBER("-1.7976931348623157e+308" , -1.7976931348623157e+308);
+
+    TEST_NUMBER("9007199254740993", 9007199254740993.0); /* 2^53 + 1, rounds to even */
+    TEST_NUMBER("12345678901234567890123", 12345678901234567890123.0); /* more than 19 digits */
+    TEST_NUMBER("0.000000000000000000000000000000001234", 1.234e-33);
+    TEST_NUMBER("2.2250738585072011e-308", 2.2250738585072011e-308);
+    TEST_NUMBER("1e-400", 0.0);
+    TEST_NUMBER("0e1000", 0.0);
+    TEST_NUMBER("123e-2", 1.23);
 }
 
-#define TEST_STRING(json, expect)                          \
-    do {                                                   \
-        lept_value* v = lept_new_value();                  \
-        lept_string* s;                                    \
-        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json)); \
-        EXPECT_EQ_INT(LEPT_STRING, lept_get_type(v));      \
-        s = lept_get_string(v);                            \
-        EXPECT_EQ_ULONG(strlen(expect), s->len);           \
-        EXPECT_EQ_STRING(expect, s->str);                  \
-        lept_free_value(v);                                \
+/* compares the bits with the C library for numbers on every exponent */
+TEST(simple, number_exact) {
+    char json[64];
+    unsigned long seed = 1;
+    int i;
+    for (i = 0; i < 20000; ++i) {
+        lept_value v;
+        double expect;
+        unsigned long long digits;
+        seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+        digits = (unsigned long long)(seed >> 11);
+        switch (i % 3) {
+            case 0: sprintf(json, "%.17g", (double)digits * 1e-10 * (i % 7 + 1)); break;
+            case 1: sprintf(json, "%llue%d", digits % 100000000000000000ull, (int)(seed % 640) - 340); break;
+            default: sprintf(json, "%llu.%llue%d", digits % 1000, digits, (int)(seed % 600) - 300); break;
+        }
+        expect = strtod(json, NULL);
+        if (expect == HUGE_VAL) {
+            continue;
+        }
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+        EXPECT_EQ_BASE(memcmp(&expect, &v.value.n, sizeof(double)) == 0, expect, v.value.n, "%.17g");
+    }
+}
+
+#define TEST_STRING(json, expect)                                   \
+    do {                                                            \
+        lept_value* v = lept_new_value();                           \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));          \
+        EXPECT_EQ_INT(LEPT_STRING, lept_get_type(v));               \
+        EXPECT_EQ_ULONG(strlen(expect), lept_get_string_length(v)); \
+        EXPECT_EQ_STRING(expect, lept_get_string(v));               \
+        lept_free_value(v);                                         \
     } while (0)
 
 #define TEST_LONG_STRING(n, ch)                              \
     do {                                                     \
         lept_value* v = lept_new_value();                    \
-        lept_string* s;                                      \
         char* expect = NEWN(n + 1, char);                    \
         char* quoted = NEWN(n + 3, char);                    \
         memset(expect, ch, (n + 1) * sizeof(char));          \
@@ -87,9 +117,8 @@ TEST(simple, number) {
         expect[n] = quoted[n + 2] = '\0';                    \
         EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, quoted)); \
         EXPECT_EQ_INT(LEPT_STRING, lept_get_type(v));        \
-        s = lept_get_string(v);                              \
-        EXPECT_EQ_ULONG(n, s->len);                          \
-        EXPECT_EQ_STRING(expect, s->str);                    \
+        EXPECT_EQ_ULONG(n, lept_get_string_length(v));       \
+        EXPECT_EQ_STRING(expect, lept_get_string(v));        \
         lept_free_value(v);                                  \
     } while (0)
 
@@ -103,6 +132,12 @@ TEST(simple, string) {
     TEST_STRING("\"\\r\"", "\r");
     TEST_STRING("\"\\t\"", "\t");
     TEST_STRING("\"\\\"\"", "\"");
+    TEST_STRING("\"\\u0024\"", "\x24");         /* Dollar sign U+0024 */
+    TEST_STRING("\"\\u00A2\"", "\xC2\xA2");     /* Cents sign U+00A2 */
+    TEST_STRING("\"\\u20AC\"", "\xE2\x82\xAC"); /* Euro sign U+20AC */
+    TEST_STRING("\"\\uD834\\uDD1E\"", "\xF0\x9D\x84\x9E"); /* G clef sign U+1D11E */
+    TEST_STRING("\"\\ud834\\udd1e\"", "\xF0\x9D\x84\x9E");
+    TEST_STRING("\"\xE2\x82\xAC \xF0\x9D\x84\x9E\"", "\xE2\x82\xAC \xF0\x9D\x84\x9E");
     TEST_LONG_STRING(1ul, 'x');
     TEST_LONG_STRING(15ul, 'x');
     TEST_LONG_STRING(16ul, 'x');
@@ -111,20 +146,123 @@ TEST(simple, string) {
     TEST_LONG_STRING(1025ul, 'x');
 }
 
-#define TEST_ARRAY(json, ...)                                  \
-    do {                                                       \
-        double array[100] = __VA_ARGS__;                       \
-        double* p = array;                                     \
-        lept_value* v = lept_new_value();                      \
-        lept_array* a;                                         \
-        lept_array_item* i;                                    \
-        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));     \
-        EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(v));           \
-        a = lept_get_array(v);                                 \
-        for (i = a->items; i != NULL; i = i->next) {           \
-            EXPECT_EQ_DOUBLE(lept_get_number(i->value), *p++); \
-        }                                                      \
-        lept_free_value(v);                                    \
+/* puts the escape at every offset of the vector blocks */
+TEST(simple, string_scan) {
+    char json[80];
+    char expect[80];
+    int i;
+    for (i = 0; i < 70; ++i) {
+        lept_value* v = lept_new_value();
+        json[0] = '"';
+        memset(json + 1, 'a', i);
+        memcpy(json + 1 + i, "\\n", 2);
+        memset(json + 3 + i, 'b', 70 - i);
+        json[73] = '"';
+        json[74] = '\0';
+        memset(expect, 'a', i);
+        expect[i] = '\n';
+        memset(expect + i + 1, 'b', 70 - i);
+        expect[71] = '\0';
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));
+        EXPECT_EQ_STRING(expect, lept_get_string(v));
+        lept_free_value(v);
+    }
+}
+
+/* well-formed and ill-formed UTF-8 at every offset of the vector blocks */
+static const char* utf8_valid[] = {
+    "\xC2\x80", "\xC3\xA9", "\xDF\xBF", "\xE0\xA0\x80", "\xE2\x82\xAC", "\xED\x9F\xBF", "\xEE\x80\x80",
+    "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF0\x9D\x84\x9E", "\xF4\x8F\xBF\xBF"
+};
+static const char* utf8_invalid[] = {
+    "\x80", "\xBF", "\xC0\xAF", "\xC1\xBF", "\xC3", "\xC3\xA9\xA9", "\xE0\x80\xAF", "\xE0\x9F\xBF", "\xE2\x82",
+    "\xED\xA0\x80", "\xED\xBF\xBF", "\xF0\x80\x80\xAF", "\xF0\x8F\xBF\xBF", "\xF0\x9D\x84", "\xF4\x90\x80\x80",
+    "\xF5\x80\x80\x80", "\xF8\x88\x80\x80\x80", "\xFE", "\xFF"
+};
+
+static void utf8_json(char* json, char* expect, int i, const char* seq) {
+    size_t n = strlen(seq);
+    json[0] = '"';
+    memset(json + 1, 'a', i);
+    memcpy(json + 1 + i, seq, n);
+    memset(json + 1 + i + n, 'b', 70 - i);
+    strcpy(json + 71 + n, "\"");
+    if (expect != NULL) {
+        memcpy(expect, json + 1, 70 + n);
+        expect[70 + n] = '\0';
+    }
+}
+
+TEST(simple, string_utf8) {
+    char json[80], expect[80];
+    size_t k;
+    int i;
+    for (k = 0; k < sizeof(utf8_valid) / sizeof(utf8_valid[0]); ++k) {
+        for (i = 0; i <= 70; ++i) {
+            utf8_json(json, expect, i, utf8_valid[k]);
+            TEST_STRING(json, expect);
+        }
+    }
+}
+
+/* strings up to LEPT_SHORT_STRING_MAX are kept in the value */
+TEST(simple, short_string) {
+    char json[32];
+    char expect[24];
+    lept_value v;
+    size_t i;
+    for (i = 0; i < 20; ++i) {
+        memset(expect, 'a' + (int)i, i);
+        expect[i] = '\0';
+        sprintf(json, "\"%s\"", expect);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+        EXPECT_EQ_ULONG(i, lept_get_string_length(&v));
+        EXPECT_EQ_STRING(expect, lept_get_string(&v));
+        EXPECT_EQ_INT(i <= LEPT_SHORT_STRING_MAX, lept_get_string(&v) == (const char*)&v);
+        lept_free_value_on_stack(&v);
+        lept_set_string(&v, expect, i);
+        EXPECT_EQ_ULONG(i, lept_get_string_length(&v));
+        EXPECT_EQ_STRING(expect, lept_get_string(&v));
+        lept_free_value_on_stack(&v);
+    }
+    lept_set_string(&v, "a\0b", 3);
+    EXPECT_EQ_ULONG(3ul, lept_get_string_length(&v));
+    EXPECT_EQ_INT(0, memcmp("a\0b", lept_get_string(&v), 4));
+}
+
+TEST(simple, whitespace) {
+    char json[300];
+    const char ws[] = " \t\r\n";
+    int i, j;
+    for (i = 0; i < 70; ++i) {
+        lept_value* v = lept_new_value();
+        char* p = json;
+        for (j = 0; j < i; ++j) *p++ = ws[j % 4];
+        *p++ = '[';
+        for (j = 0; j < i; ++j) *p++ = ws[(j + 1) % 4];
+        *p++ = '1';
+        for (j = 0; j < i; ++j) *p++ = ws[(j + 2) % 4];
+        *p++ = ']';
+        for (j = 0; j < i; ++j) *p++ = ws[(j + 3) % 4];
+        *p = '\0';
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));
+        EXPECT_EQ_ULONG(1ul, lept_get_array_size(v));
+        lept_free_value(v);
+    }
+}
+
+#define TEST_ARRAY(json, ...)                                        \
+    do {                                                             \
+        double array[100] = __VA_ARGS__;                             \
+        lept_value* v = lept_new_value();                            \
+        size_t i;                                                    \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));           \
+        EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(v));                 \
+        for (i = 0; i < lept_get_array_size(v); ++i) {               \
+            lept_value* e = lept_get_array_element(v, i);            \
+            EXPECT_EQ_DOUBLE(lept_get_number(e), array[i]);          \
+        }                                                            \
+        lept_free_value(v);                                          \
     } while (0)
 
 TEST(simple, array) {
@@ -134,30 +272,157 @@ TEST(simple, array) {
     TEST_ARRAY("[ 0, 1, 2 ]", {0, 1, 2});
 }
 
-#define TEST_OBJECT(json, keys, ...)                           \
-    do {                                                       \
-        const char* k = keys;                                  \
-        double values[100] = __VA_ARGS__;                      \
-        double* p = values;                                    \
-        lept_value* v = lept_new_value();                      \
-        lept_object* o;                                        \
-        lept_object_node* n;                                   \
-        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));     \
-        EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(v));          \
-        o = lept_get_object(v);                                \
-        for (n = o->nodes; n != NULL; n = n->next) {           \
-            EXPECT_EQ_CHAR(n->key->str[0], *k++);              \
-            EXPECT_EQ_DOUBLE(lept_get_number(n->value), *p++); \
-        }                                                      \
-        lept_free_value(v);                                    \
+#define TEST_OBJECT(json, keys, ...)                            \
+    do {                                                        \
+        const char* k = keys;                                   \
+        double values[100] = __VA_ARGS__;                       \
+        double* p = values;                                     \
+        lept_value* v = lept_new_value();                       \
+        lept_object* o;                                         \
+        lept_object_node* n;                                    \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));      \
+        EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(v));           \
+        o = lept_get_object(v);                                 \
+        for (n = o->nodes; n != NULL; n = n->next) {            \
+            EXPECT_EQ_CHAR(n->key->str[0], *k++);               \
+            EXPECT_EQ_DOUBLE(lept_get_number(&n->value), *p++); \
+        }                                                       \
+        lept_free_value(v);                                     \
     } while (0)
 
+TEST(simple, nested_array) {
+    lept_value* v = lept_new_value();
+    lept_value* e;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, "[[], 1, [2, [3]], \"4\"]"));
+    EXPECT_EQ_ULONG(4ul, lept_get_array_size(v));
+    EXPECT_EQ_ULONG(0ul, lept_get_array_size(lept_get_array_element(v, 0)));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_get_array_element(v, 1)));
+    e = lept_get_array_element(v, 2);
+    EXPECT_EQ_ULONG(2ul, lept_get_array_size(e));
+    EXPECT_EQ_DOUBLE(2.0, lept_get_number(lept_get_array_element(e, 0)));
+    e = lept_get_array_element(e, 1);
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_get_array_element(e, 0)));
+    EXPECT_EQ_STRING("4", lept_get_string(lept_get_array_element(v, 3)));
+    lept_free_value(v);
+}
+
+TEST(simple, array_pushback) {
+    lept_value* v = lept_new_value();
+    lept_array* a = lept_new_array();
+    lept_value* e;
+    size_t i;
+    v->type = LEPT_ARRAY;
+    v->value.a = a;
+    for (i = 0; i < 10; ++i) {
+        e = lept_pushback_array_element(a);
+        e->type = LEPT_NUMBER;
+        e->value.n = (double)i;
+    }
+    EXPECT_EQ_ULONG(10ul, lept_get_array_size(v));
+    EXPECT_EQ_INT(1, a->capacity >= 10);
+    for (i = 0; i < 10; ++i) {
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(v, i)));
+    }
+    lept_free_value(v);
+}
+
 TEST(simple, object) {
     TEST_OBJECT("{}", "", {0});
     TEST_OBJECT("{\"a\":0}", "a", {0});
     TEST_OBJECT("{\"a\":0,\"b\":1}", "ab", {0,1});
 }
 
+static char* make_object_json(int n) {
+    char* json = NEWN(n * 16 + 3, char);
+    char* p = json;
+    int i;
+    *p++ = '{';
+    for (i = 0; i < n; ++i) {
+        p += sprintf(p, "%s\"k%d\":%d", i == 0 ? "" : ",", i, i);
+    }
+    *p++ = '}';
+    *p = '\0';
+    return json;
+}
+
+#define EXPECT_FIND_NUMBER(v, key, number)                            \
+    do {                                                              \
+        lept_value* found = lept_find_object_value(v, key, strlen(key)); \
+        EXPECT_EQ_INT(1, found != NULL);                              \
+        if (found != NULL) {                                          \
+            EXPECT_EQ_DOUBLE(number, lept_get_number(found));         \
+        }                                                             \
+    } while (0)
+
+#define EXPECT_NOT_FOUND(v, key) \
+    EXPECT_EQ_INT(1, lept_find_object_value(v, key, strlen(key)) == NULL)
+
+TEST(object, find_linear) {
+    lept_value* v = lept_new_value();
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, "{\"a\":1,\"ab\":2,\"a\":3,\"\":4}"));
+    EXPECT_FIND_NUMBER(v, "a", 1.0); /* first of duplicated keys */
+    EXPECT_FIND_NUMBER(v, "ab", 2.0);
+    EXPECT_FIND_NUMBER(v, "", 4.0);
+    EXPECT_NOT_FOUND(v, "b");
+    EXPECT_NOT_FOUND(v, "abc");
+    EXPECT_EQ_INT(1, lept_get_object(v)->index == NULL);
+    lept_free_value(v);
+}
+
+TEST(object, find_indexed) {
+    lept_value* v = lept_new_value();
+    char* json = make_object_json(300);
+    char key[16];
+    int i;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));
+    EXPECT_EQ_INT(1, lept_get_object(v)->index == NULL);
+    for (i = 0; i < 300; ++i) {
+        sprintf(key, "k%d", i);
+        EXPECT_FIND_NUMBER(v, key, (double)i);
+    }
+    EXPECT_EQ_INT(1, lept_get_object(v)->index != NULL);
+    EXPECT_NOT_FOUND(v, "k300");
+    EXPECT_NOT_FOUND(v, "k");
+    lept_free_value(v);
+    free(json);
+}
+
+TEST(object, find_small_indexed) {
+    lept_value* v = lept_new_value();
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, "{\"a\":1,\"ab\":2,\"a\":3}"));
+    lept_index_object(lept_get_object(v));
+    EXPECT_FIND_NUMBER(v, "a", 1.0);
+    EXPECT_FIND_NUMBER(v, "ab", 2.0);
+    EXPECT_NOT_FOUND(v, "b");
+    lept_free_value(v);
+}
+
+TEST(object, index_flag) {
+    lept_value* v = lept_new_value();
+    lept_value w;
+    lept_parse_options opts;
+    lept_arena a;
+    char* json = make_object_json(100);
+    opts.flags = LEPT_PARSE_INDEX_OBJECTS;
+    opts.arena = NULL;
+    opts.keys = NULL;
+    opts.allocator = NULL;
+    opts.max_depth = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(v, json, &opts));
+    EXPECT_EQ_INT(1, lept_get_object(v)->index != NULL);
+    EXPECT_FIND_NUMBER(v, "k42", 42.0);
+    lept_free_value(v);
+
+    lept_arena_init(&a);
+    opts.flags = 0;
+    opts.arena = &a;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&w, json, &opts));
+    EXPECT_FIND_NUMBER(&w, "k99", 99.0); /* index lives in the arena */
+    EXPECT_EQ_INT(1, lept_get_object(&w)->index != NULL);
+    lept_arena_free(&a);
+    free(json);
+}
+
 #define TEST_ERROR(error, json)                    \
     do {                                           \
         lept_value* v = lept_new_value();          \
@@ -179,6 +444,7 @@ TEST(error, invalid_value) {
     TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "nul");
     TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "?");
     TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "{1");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "[\"a\",[\"b\",nul]]");
     /* invalid number */
     TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "+0");
     TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "+1");
@@ -201,6 +467,7 @@ TEST(error, unclosed_quotes) {
     TEST_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "\"");
     TEST_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "\"1");
     TEST_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "\"1\\\"");
+    TEST_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "\"0123456789abcdef0123456789abcdef0123456789");
 }
 
 TEST(error, root_not_singular) {
@@ -211,6 +478,42 @@ TEST(error, root_not_singular) {
     TEST_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "0x123");
 }
 
+TEST(error, invalid_unicode) {
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u0\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u01\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u012\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u/000\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uG000\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u0/00\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u00G0\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u000/\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u 123\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\u012");
+    /* surrogates come in pairs, high then low */
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uD800\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uDBFF\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uD800\\\\\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uD800\\uDBFF\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uD800\\uE000\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uDC00\"");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "\"\\uDFFF\\uD800\"");
+}
+
+TEST(error, invalid_utf8) {
+    char json[80];
+    size_t k;
+    int i;
+    for (k = 0; k < sizeof(utf8_invalid) / sizeof(utf8_invalid[0]); ++k) {
+        for (i = 0; i <= 70; ++i) {
+            utf8_json(json, NULL, i, utf8_invalid[k]);
+            TEST_ERROR(LEPT_PARSE_INVALID_VALUE, json);
+        }
+    }
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "[\"\\n\xC3\"]");
+    TEST_ERROR(LEPT_PARSE_INVALID_VALUE, "{\"\xFF\":1}");
+}
+
 TEST(error, number_too_big) {
     TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "1e309");
     TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "-1e309");
@@ -225,34 +528,34 @@ TEST(error, number_too_big) {
 #define EXPECT_ARRAY(length)                                  \
     EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(v));              \
     a = lept_get_array(v);                                    \
-    EXPECT_EQ_ULONG(length, o->len);                          \
+    EXPECT_EQ_ULONG(length, a->len);                          \
     i = a->items;
 
 #define EXPECT_KEY(keystr)                                    \
     EXPECT_EQ_STRING(keystr, n->key->str);
 
 #define EXPECT_VALUE_TRUE()                                   \
-    EXPECT_EQ_INT(LEPT_TRUE, lept_get_type(n->value));        \
+    EXPECT_EQ_INT(LEPT_TRUE, lept_get_type(&n->value));       \
     n = n->next;
 #define EXPECT_VALUE_FALSE()                                  \
-    EXPECT_EQ_INT(LEPT_FALSE, lept_get_type(n->value));       \
+    EXPECT_EQ_INT(LEPT_FALSE, lept_get_type(&n->value));      \
     n = n->next;
 #define EXPECT_VALUE_NULL()                                   \
-    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(n->value));        \
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&n->value));       \
     n = n->next;
-#define EXPECT_VALUE_NUMBER(number)                           \
-    EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(n->value));      \
-    EXPECT_EQ_DOUBLE(number, lept_get_number(n->value));      \
+#define EXPECT_VALUE_NUMBER(number)                            \
+    EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(&n->value));      \
+    EXPECT_EQ_DOUBLE(number, lept_get_number(&n->value));      \
     n = n->next;
 #define EXPECT_VALUE_STRING(string)                           \
-    EXPECT_EQ_INT(LEPT_STRING, lept_get_type(n->value));      \
-    EXPECT_EQ_STRING(string, lept_get_string(n->value)->str); \
+    EXPECT_EQ_INT(LEPT_STRING, lept_get_type(&n->value));     \
+    EXPECT_EQ_STRING(string, lept_get_string(&n->value));     \
     n = n->next;
 #define EXPECT_VALUE_OBJECT(length)                           \
-    v = n->value;                                             \
+    v = &n->value;                                            \
     EXPECT_OBJECT(length);
 #define EXPECT_VALUE_ARRAY(length)                            \
-    v = n->value;                                             \
+    v = &n->value;                                            \
     EXPECT_ARRAY(length);
 
 #define EXPECT_VALUE(value)                                   \
@@ -262,9 +565,9 @@ TEST(error, number_too_big) {
     EXPECT_KEY(key); EXPECT_VALUE(value);
 
 #define EXPECT_ITEM_STRING(string)                            \
-    EXPECT_EQ_INT(LEPT_STRING, lept_get_type(i->value));      \
-    EXPECT_EQ_STRING(string, lept_get_string(i->value)->str); \
-    i = i->next;
+    EXPECT_EQ_INT(LEPT_STRING, lept_get_type(i));             \
+    EXPECT_EQ_STRING(string, lept_get_string(i));             \
+    ++i;
 
 #define EXPECT_ITEM(value)                                    \
     EXPECT_ITEM_##value;
@@ -288,7 +591,7 @@ TEST(complex, mix) {
     lept_object* o;
     lept_object_node* n;
     lept_array* a;
-    lept_array_item* i;
+    lept_value* i;
 
     EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(v, json));
 
@@ -322,22 +625,1639 @@ TEST(file, ok) {
     TEST_FILE(LEPT_PARSE_OK, "test/good/2.json");
 }
 
+TEST(file, error) {
+    TEST_FILE(LEPT_FILE_CANNOT_OPEN, "test/good/missing.json");
+    TEST_FILE(LEPT_PARSE_EXPECT_VALUE, "/dev/null"); /* not mappable, read instead */
+}
+
+/* the text is copied without its terminator so overreads are caught by sanitizers */
+#define TEST_PARSE_N(expect, json)                                \
+    do {                                                          \
+        size_t len = strlen(json);                                \
+        char* buf = (char*)malloc(len);                           \
+        lept_value v;                                             \
+        memcpy(buf, json, len);                                   \
+        EXPECT_EQ_INT(expect, lept_parse_n(&v, buf, len));        \
+        if (expect == LEPT_PARSE_OK) {                            \
+            lept_free_value_on_stack(&v);                         \
+        }                                                         \
+        free(buf);                                                \
+    } while (0)
+
+TEST(length, ok) {
+    TEST_PARSE_N(LEPT_PARSE_OK, "null");
+    TEST_PARSE_N(LEPT_PARSE_OK, "0");
+    TEST_PARSE_N(LEPT_PARSE_OK, "-1.5e+10");
+    TEST_PARSE_N(LEPT_PARSE_OK, "123456789012345678901234567890");
+    TEST_PARSE_N(LEPT_PARSE_OK, "\"a\\nb\"");
+    TEST_PARSE_N(LEPT_PARSE_OK, " [1, {\"a\": [true]}] ");
+}
+
+TEST(length, truncated) {
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_parse_n(&v, "null", 0));
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, "nul");
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, "-");
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, "1.");
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, "1e+");
+    TEST_PARSE_N(LEPT_PARSE_UNCLOSED_QUOTES, "\"abc");
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, "\"abc\\");
+    TEST_PARSE_N(LEPT_PARSE_EXPECT_VALUE, "[1,");
+    TEST_PARSE_N(LEPT_PARSE_UNCLOSED_BRACKETS, "[1");
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, "{");
+    TEST_PARSE_N(LEPT_PARSE_EXPECT_VALUE, "{\"a\"");
+}
+
+TEST(length, embedded_nul) {
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_n(&v, "[1]\0", 3));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_n(&v, "[1]\0", 4));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_n(&v, "\0", 1));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_n(&v, "[\0]", 3));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_parse_n(&v, "[", 1));
+}
+
+#define TEST_ARENA_ERROR(error, json)                          \
+    do {                                                      \
+        lept_value v;                                         \
+        EXPECT_EQ_INT(error, lept_parse_arena(&a, &v, json)); \
+        lept_arena_reset(&a);                                 \
+    } while (0)
+
+static size_t count_arena_chunks(const lept_arena* a) {
+    size_t n = 0;
+    lept_arena_chunk* k;
+    for (k = a->chunks; k; k = k->next) {
+        ++n;
+    }
+    return n;
+}
+
+TEST(arena, parse) {
+    lept_arena a;
+    lept_value v;
+    lept_object* o;
+    lept_object_node* n;
+    lept_arena_init(&a);
+    EXPECT_EQ_INT(LEPT_PARSE_OK,
+                  lept_parse_arena(&a, &v, "{\"a\":[1,\"xyz\",null],\"b\":\"\\n\"}"));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+    o = lept_get_object(&v);
+    EXPECT_EQ_ULONG(2ul, o->len);
+    n = o->nodes;
+    EXPECT_EQ_STRING("a", n->key->str);
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&n->value));
+    EXPECT_EQ_ULONG(3ul, lept_get_array(&n->value)->len);
+    EXPECT_EQ_STRING("xyz", lept_get_string(lept_get_array_element(&n->value, 1)));
+    n = n->next;
+    EXPECT_EQ_STRING("b", n->key->str);
+    EXPECT_EQ_STRING("\n", lept_get_string(&n->value));
+    lept_arena_free(&a);
+}
+
+TEST(arena, reuse) {
+    lept_arena a;
+    lept_value v;
+    lept_arena_chunk* first;
+    size_t chunks;
+    int i;
+    char* json = NEWN(20002, char);
+    json[0] = '[';
+    for (i = 0; i < 5000; ++i) {
+        memcpy(json + 1 + i * 4, "\"x\",", 4);
+    }
+    json[20000] = ']';
+    json[20001] = '\0';
+    lept_arena_init(&a);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_arena(&a, &v, json));
+    EXPECT_EQ_ULONG(5000ul, lept_get_array(&v)->len);
+    first = a.chunks;
+    chunks = count_arena_chunks(&a);
+    EXPECT_EQ_INT(1, chunks > 1);
+    for (i = 0; i < 3; ++i) {
+        lept_arena_reset(&a);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_arena(&a, &v, json));
+        EXPECT_EQ_ULONG(5000ul, lept_get_array(&v)->len);
+    }
+    EXPECT_EQ_INT(1, first == a.chunks);
+    EXPECT_EQ_ULONG(chunks, count_arena_chunks(&a));
+    lept_arena_free(&a);
+    free(json);
+}
+
+TEST(arena, error) {
+    lept_arena a;
+    lept_arena_init(&a);
+    TEST_ARENA_ERROR(LEPT_PARSE_EXPECT_VALUE, "[1,");
+    TEST_ARENA_ERROR(LEPT_PARSE_INVALID_VALUE, "{\"a\":[\"b\",nul]}");
+    TEST_ARENA_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "[\"abc");
+    TEST_ARENA_ERROR(LEPT_PARSE_UNCLOSED_BRACKETS, "{\"a\":1");
+    TEST_ARENA_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "[] x");
+    lept_arena_free(&a);
+}
+
+TEST(insitu, string) {
+    char json[] = "[\"abcdefghijklmnopq\", \"a\\nb\\\\c\\\"0123456789\", \"abc\", \"\\uD834\\uDD1E \\u20AC \\u00A2 0123456789\"]";
+    lept_value v;
+    lept_value* e;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_insitu(&v, json, sizeof(json) - 1));
+    EXPECT_EQ_ULONG(4ul, lept_get_array_size(&v));
+    e = lept_get_array_element(&v, 0);
+    EXPECT_EQ_INT(1, lept_get_string(e) == json + 2); /* escape free, not moved */
+    EXPECT_EQ_ULONG(17ul, lept_get_string_length(e));
+    EXPECT_EQ_STRING("abcdefghijklmnopq", lept_get_string(e));
+    e = lept_get_array_element(&v, 1);
+    EXPECT_EQ_INT(1, lept_get_string(e) == json + 23);
+    EXPECT_EQ_ULONG(16ul, lept_get_string_length(e));
+    EXPECT_EQ_STRING("a\nb\\c\"0123456789", lept_get_string(e));
+    e = lept_get_array_element(&v, 2); /* short strings are copied into the value */
+    EXPECT_EQ_INT(1, lept_get_string(e) == (const char*)e);
+    EXPECT_EQ_STRING("abc", lept_get_string(e));
+    e = lept_get_array_element(&v, 3); /* \\u escapes shrink as they are decoded */
+    EXPECT_EQ_STRING("\xF0\x9D\x84\x9E \xE2\x82\xAC \xC2\xA2 0123456789", lept_get_string(e));
+    lept_free_value_on_stack(&v);
+}
+
+TEST(insitu, object) {
+    char json[] = "{\"key\\t\":{\"inner\":\"0123456789abcdef0123456789abcdef\\/x\"}}";
+    lept_value v;
+    lept_object_node* n;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_insitu(&v, json, sizeof(json) - 1));
+    n = lept_get_object(&v)->nodes;
+    EXPECT_EQ_STRING("key\t", n->key->str);
+    n = lept_get_object(&n->value)->nodes;
+    EXPECT_EQ_STRING("inner", n->key->str);
+    EXPECT_EQ_STRING("0123456789abcdef0123456789abcdef/x", lept_get_string(&n->value));
+    lept_free_value_on_stack(&v);
+}
+
+#define TEST_INSITU_ERROR(error, str)                                        \
+    do {                                                                     \
+        char json[] = str;                                                   \
+        lept_value v;                                                        \
+        EXPECT_EQ_INT(error, lept_parse_insitu(&v, json, sizeof(json) - 1)); \
+    } while (0)
+
+TEST(insitu, error) {
+    TEST_INSITU_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "[\"abc");
+    TEST_INSITU_ERROR(LEPT_PARSE_INVALID_VALUE, "[\"a\\x\"]");
+    TEST_INSITU_ERROR(LEPT_PARSE_INVALID_VALUE, "[\"a\\uD800\"]");
+    TEST_INSITU_ERROR(LEPT_PARSE_INVALID_VALUE, "[\"a\\n\xE2\x82\"]");
+    TEST_INSITU_ERROR(LEPT_PARSE_EXPECT_VALUE, "{\"a\":");
+}
+
+#define TEST_ROUNDTRIP(json)                                   \
+    do {                                                       \
+        lept_value v;                                          \
+        lept_buffer b;                                         \
+        lept_buffer_init(&b);                                  \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));    \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b)); \
+        EXPECT_EQ_STRING(json, b.data);                        \
+        EXPECT_EQ_ULONG(strlen(json), b.len);                  \
+        lept_free_value_on_stack(&v);                          \
+        lept_buffer_free(&b);                                  \
+    } while (0)
+
+TEST(stringify, literal) {
+    TEST_ROUNDTRIP("null");
+    TEST_ROUNDTRIP("false");
+    TEST_ROUNDTRIP("true");
+}
+
+TEST(stringify, number) {
+    TEST_ROUNDTRIP("0");
+    TEST_ROUNDTRIP("-0");
+    TEST_ROUNDTRIP("1");
+    TEST_ROUNDTRIP("-1");
+    TEST_ROUNDTRIP("1.5");
+    TEST_ROUNDTRIP("-1.5");
+    TEST_ROUNDTRIP("3.25");
+    TEST_ROUNDTRIP("0.1");
+    TEST_ROUNDTRIP("0.001234");
+    TEST_ROUNDTRIP("1e-7");
+    TEST_ROUNDTRIP("1.234e-7");
+    TEST_ROUNDTRIP("10000000000");
+    TEST_ROUNDTRIP("1e30");
+    TEST_ROUNDTRIP("1.234e30");
+    TEST_ROUNDTRIP("5e-324");
+    TEST_ROUNDTRIP("-5e-324");
+    TEST_ROUNDTRIP("2.225073858507201e-308");
+    TEST_ROUNDTRIP("2.2250738585072014e-308");
+    TEST_ROUNDTRIP("1.7976931348623157e308");
+    TEST_ROUNDTRIP("-1.7976931348623157e308");
+}
+
+/* the output must read back as the same double */
+TEST(stringify, number_exact) {
+    unsigned long long seed = 7;
+    lept_buffer b;
+    int i;
+    lept_buffer_init(&b);
+    for (i = 0; i < 20000; ++i) {
+        lept_value v, w;
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        v.type = LEPT_NUMBER;
+        memcpy(&v.value.n, &seed, sizeof(double));
+        if (v.value.n != v.value.n || v.value.n == HUGE_VAL || v.value.n == -HUGE_VAL) {
+            continue;
+        }
+        lept_buffer_reset(&b);
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b));
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&w, b.data));
+        EXPECT_EQ_BASE(memcmp(&v.value.n, &w.value.n, sizeof(double)) == 0, v.value.n, w.value.n, "%.17g");
+    }
+    lept_buffer_free(&b);
+}
+
+TEST(stringify, string) {
+    TEST_ROUNDTRIP("\"\"");
+    TEST_ROUNDTRIP("\"Hello\"");
+    TEST_ROUNDTRIP("\"Hello\\nWorld\"");
+    TEST_ROUNDTRIP("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
+    TEST_ROUNDTRIP("\"0123456789abcdef0123456789abcdef0123456789abcdef\\t0123456789abcdef\"");
+}
+
+TEST(stringify, control) {
+    lept_value v;
+    lept_buffer b;
+    lept_buffer_init(&b);
+    lept_set_string(&v, "a\0\x01\x1F", 4);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b));
+    EXPECT_EQ_STRING("\"a\\u0000\\u0001\\u001F\"", b.data);
+    lept_buffer_free(&b);
+}
+
+TEST(stringify, container) {
+    TEST_ROUNDTRIP("[]");
+    TEST_ROUNDTRIP("{}");
+    TEST_ROUNDTRIP("[null,false,true,123,\"abc\",[1,2,3]]");
+    TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+}
+
+TEST(stringify, pretty) {
+    lept_value v;
+    lept_buffer b;
+    lept_buffer_init(&b);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":[1,{}],\"b\":[]}"));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify_pretty(&v, &b));
+    EXPECT_EQ_STRING("{\n    \"a\": [\n        1,\n        {}\n    ],\n    \"b\": []\n}", b.data);
+    lept_free_value_on_stack(&v);
+    lept_buffer_free(&b);
+}
+
+TEST(stringify, reuse) {
+    lept_value v;
+    lept_buffer b;
+    char* data;
+    lept_buffer_init(&b);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[1,2,3]"));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b)); /* appends */
+    EXPECT_EQ_STRING("[1,2,3][1,2,3]", b.data);
+    data = b.data;
+    lept_buffer_reset(&b);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b));
+    EXPECT_EQ_STRING("[1,2,3]", b.data);
+    EXPECT_EQ_INT(1, data == b.data);
+    lept_free_value_on_stack(&v);
+    lept_buffer_free(&b);
+}
+
+TEST(stringify, invalid) {
+    lept_value v;
+    lept_buffer b;
+    lept_buffer_init(&b);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[1,2]"));
+    lept_get_array_element(&v, 1)->value.n = HUGE_VAL;
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_VALUE, lept_stringify(&v, &b));
+    EXPECT_EQ_ULONG(0ul, b.len);
+    EXPECT_EQ_STRING("", b.data);
+    lept_free_value_on_stack(&v);
+    lept_buffer_free(&b);
+}
+
+/* records events as a compact trace, stopping once stop_at events are seen */
+typedef struct {
+    char trace[256];
+    size_t len;
+    int events, stop_at;
+    const char* last_str;
+} sax_recorder;
+
+static int sax_put(sax_recorder* r, const char* s, size_t n) {
+    memcpy(r->trace + r->len, s, n);
+    r->len += n;
+    r->trace[r->len] = '\0';
+    return ++r->events == r->stop_at;
+}
+
+static int sax_null(void* ctx) { return sax_put(ctx, "n ", 2); }
+static int sax_bool(void* ctx, int b) { return sax_put(ctx, b ? "t " : "f ", 2); }
+static int sax_start_object(void* ctx) { return sax_put(ctx, "{ ", 2); }
+static int sax_start_array(void* ctx) { return sax_put(ctx, "[ ", 2); }
+
+static int sax_number(void* ctx, double n) {
+    char buf[32];
+    return sax_put(ctx, buf, sprintf(buf, "%g ", n));
+}
+
+static int sax_string(void* ctx, const char* str, size_t len) {
+    ((sax_recorder*)ctx)->last_str = str;
+    sax_put(ctx, "\"", 1);
+    sax_put(ctx, str, len);
+    ((sax_recorder*)ctx)->events -= 2;
+    return sax_put(ctx, "\" ", 2);
+}
+
+static int sax_key(void* ctx, const char* str, size_t len) {
+    sax_put(ctx, str, len);
+    --((sax_recorder*)ctx)->events;
+    return sax_put(ctx, ": ", 2);
+}
+
+static int sax_end_object(void* ctx, size_t len) {
+    char buf[32];
+    return sax_put(ctx, buf, sprintf(buf, "}%d ", (int)len));
+}
+
+static int sax_end_array(void* ctx, size_t len) {
+    char buf[32];
+    return sax_put(ctx, buf, sprintf(buf, "]%d ", (int)len));
+}
+
+static const lept_handler sax_handler = {
+    sax_null, sax_bool, sax_number, sax_string,
+    sax_start_object, sax_key, sax_end_object,
+    sax_start_array, sax_end_array
+};
+
+#define TEST_SAX(expect_ret, expect_trace, stop, json) \
+    do { \
+        sax_recorder r; \
+        r.len = 0; \
+        r.trace[0] = '\0'; \
+        r.events = 0; \
+        r.stop_at = stop; \
+        EXPECT_EQ_INT(expect_ret, lept_parse_sax(json, &sax_handler, &r)); \
+        EXPECT_EQ_STRING(expect_trace, r.trace); \
+    } while(0)
+
+TEST(sax, events) {
+    TEST_SAX(LEPT_PARSE_OK, "n ", 0, " null ");
+    TEST_SAX(LEPT_PARSE_OK, "[ ]0 ", 0, "[]");
+    TEST_SAX(LEPT_PARSE_OK, "{ }0 ", 0, "{ }");
+    TEST_SAX(LEPT_PARSE_OK, "[ t f 1.5 \"a\nb\" ]4 ", 0, "[true, false, 1.5, \"a\\nb\"]");
+    TEST_SAX(LEPT_PARSE_OK, "{ a: [ n ]1 b: { c: \"\" }1 }2 ", 0, "{\"a\":[null],\"b\":{\"c\":\"\"}}");
+}
+
+TEST(sax, stop) {
+    TEST_SAX(LEPT_PARSE_STOPPED, "[ ", 1, "[1,2]");
+    TEST_SAX(LEPT_PARSE_STOPPED, "[ 1 2 ", 3, "[1,2]");
+    TEST_SAX(LEPT_PARSE_STOPPED, "{ a: ", 2, "{\"a\":1}");
+    TEST_SAX(LEPT_PARSE_STOPPED, "{ x\ty: ", 2, "{\"x\\ty\":1}");
+}
+
+TEST(sax, error) {
+    TEST_SAX(LEPT_PARSE_INVALID_VALUE, "[ 1 ", 0, "[1,nul]");
+    TEST_SAX(LEPT_PARSE_UNCLOSED_BRACKETS, "{ a: 1 ", 0, "{\"a\":1");
+    TEST_SAX(LEPT_PARSE_ROOT_NOT_SINGULAR, "n ", 0, "null x");
+}
+
+TEST(sax, zero_copy) {
+    const char* json = "[\"abc\"]";
+    sax_recorder r;
+    r.len = 0;
+    r.events = 0;
+    r.stop_at = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_sax(json, &sax_handler, &r));
+    EXPECT_EQ_INT(1, r.last_str == json + 2); /* escape free, points into json */
+}
+
+static int feed_split(lept_value* v, const char* json, size_t split) {
+    lept_push_parser* p = lept_push_parser_new(NULL);
+    size_t len = strlen(json), i;
+    int ret = LEPT_PARSE_OK;
+    if (split == 0) { /* one byte at a time */
+        for (i = 0; i < len && ret == LEPT_PARSE_OK; ++i) {
+            ret = lept_push_parser_feed(p, json + i, 1);
+        }
+    } else {
+        ret = lept_push_parser_feed(p, json, split);
+        if (ret == LEPT_PARSE_OK) {
+            ret = lept_push_parser_feed(p, json + split, len - split);
+        }
+    }
+    if (ret == LEPT_PARSE_OK) {
+        ret = lept_push_parser_finish(p, v);
+    } else {
+        v->type = LEPT_UNKNOWN;
+    }
+    lept_push_parser_free(p);
+    return ret;
+}
+
+TEST(push, split) {
+    const char* json = " { \"a\\tb\" : [ null , true,false, -12.5e-3, \"x\\\"y\\\\z\", \"\" ] ,"
+                       "\"o\":{\"k\":123456789012345678901234567890},\"e\":[],\"f\":{} } ";
+    lept_value expect, v;
+    lept_buffer b, bv;
+    size_t i, len = strlen(json);
+    lept_buffer_init(&b);
+    lept_buffer_init(&bv);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, json));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&expect, &b));
+    for (i = 0; i < len; ++i) {
+        EXPECT_EQ_INT(LEPT_PARSE_OK, feed_split(&v, json, i));
+        lept_buffer_reset(&bv);
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &bv));
+        EXPECT_EQ_STRING(b.data, bv.data);
+        lept_free_value_on_stack(&v);
+    }
+    lept_free_value_on_stack(&expect);
+    lept_buffer_free(&b);
+    lept_buffer_free(&bv);
+}
+
+#define TEST_PUSH_ERROR(json) \
+    do { \
+        lept_value v, w; \
+        int expect = lept_parse(&v, json); \
+        EXPECT_EQ_INT(expect, feed_split(&w, json, 0)); \
+        if (expect == LEPT_PARSE_ROOT_NOT_SINGULAR) { \
+            lept_free_value_on_stack(&w); \
+        } \
+        lept_free_value_on_stack(&v); \
+    } while (0)
+
+TEST(push, error) {
+    TEST_PUSH_ERROR("");
+    TEST_PUSH_ERROR(" ");
+    TEST_PUSH_ERROR("nul");
+    TEST_PUSH_ERROR("nulx");
+    TEST_PUSH_ERROR("truex");
+    TEST_PUSH_ERROR("?");
+    TEST_PUSH_ERROR("1.2.3");
+    TEST_PUSH_ERROR("[1.2.3]");
+    TEST_PUSH_ERROR("0123");
+    TEST_PUSH_ERROR("1e");
+    TEST_PUSH_ERROR("[1,");
+    TEST_PUSH_ERROR("[1}");
+    TEST_PUSH_ERROR("[}");
+    TEST_PUSH_ERROR("{]");
+    TEST_PUSH_ERROR("{");
+    TEST_PUSH_ERROR("{\"a\"");
+    TEST_PUSH_ERROR("{\"a\" 1}");
+    TEST_PUSH_ERROR("{\"a\":}");
+    TEST_PUSH_ERROR("{\"a\":1");
+    TEST_PUSH_ERROR("{\"a\":1]");
+    TEST_PUSH_ERROR("{1:1}");
+    TEST_PUSH_ERROR("\"abc");
+    TEST_PUSH_ERROR("\"a\\");
+    TEST_PUSH_ERROR("\"\\v\"");
+    TEST_PUSH_ERROR("[[[\"a\",{\"b\":[nul");
+    TEST_PUSH_ERROR("null x");
+    TEST_PUSH_ERROR("[] []");
+}
+
+TEST(push, reuse) {
+    lept_push_parser* p = lept_push_parser_new(NULL);
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "[1,", 3));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "2]", 2));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_finish(p, &v));
+    EXPECT_EQ_ULONG(2ul, lept_get_array_size(&v));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_UNCLOSED_BRACKETS, lept_push_parser_feed(p, "[1 2", 4));
+    EXPECT_EQ_INT(LEPT_PARSE_UNCLOSED_BRACKETS, lept_push_parser_finish(p, &v));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "\"ab", 3));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "c\"", 2));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_finish(p, &v));
+    EXPECT_EQ_STRING("abc", lept_get_string(&v));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "{\"a\":[", 6)); /* dropped by free */
+    lept_push_parser_free(p);
+}
+
+#define NDJSON_LINES 20000
+
+typedef struct {
+    size_t count, stop_at;
+    size_t last_offset;
+    int in_order;
+    int seen[NDJSON_LINES];
+    int errors;
+} ndjson_result;
+
+/* every slot of seen is written by one line only, so threads never share one */
+static int ndjson_collect(void* ctx, size_t offset, lept_value* v, int ret) {
+    ndjson_result* r = (ndjson_result*)ctx;
+    if (ret != LEPT_PARSE_OK) {
+        r->errors = 1; /* only the one invalid line, delivered ordered */
+        return 0;
+    }
+    r->seen[(int)lept_get_number(lept_find_object_value(v, "i", 1))] = 1;
+    if (r->in_order) {
+        r->in_order = r->count == 0 || offset > r->last_offset;
+        r->last_offset = offset;
+        return ++r->count == r->stop_at;
+    }
+    return 0;
+}
+
+static char* ndjson_lines(size_t* len) {
+    char* buf = (char*)malloc(NDJSON_LINES * 96);
+    char* p = buf;
+    int i;
+    for (i = 0; i < NDJSON_LINES; ++i) {
+        p += sprintf(p, "{\"i\":%d,\"s\":\"%*s\"}%s", i, i % 50, "", i % 7 == 0 ? "\r\n\n  \n" : "\n");
+    }
+    *len = p - buf - 1; /* the last line has no newline */
+    return buf;
+}
+
+static void ndjson_result_init(ndjson_result* r, int ordered, size_t stop_at) {
+    memset(r, 0, sizeof(ndjson_result));
+    r->in_order = ordered;
+    r->stop_at = stop_at;
+}
+
+static int ndjson_seen_all(const ndjson_result* r) {
+    int i;
+    for (i = 0; i < NDJSON_LINES; ++i) {
+        if (!r->seen[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+TEST(ndjson, ordered) {
+    ndjson_result r;
+    size_t len;
+    char* buf = ndjson_lines(&len);
+    int nthreads;
+    for (nthreads = 1; nthreads <= 4; ++nthreads) {
+        ndjson_result_init(&r, 1, 0);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ndjson(buf, len, nthreads, LEPT_NDJSON_ORDERED, ndjson_collect, &r));
+        EXPECT_EQ_ULONG((unsigned long)NDJSON_LINES, (unsigned long)r.count);
+        EXPECT_EQ_INT(1, r.in_order);
+        EXPECT_EQ_INT(1, ndjson_seen_all(&r));
+    }
+    free(buf);
+}
+
+TEST(ndjson, unordered) {
+    ndjson_result r;
+    size_t len;
+    char* buf = ndjson_lines(&len);
+    ndjson_result_init(&r, 0, 0);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ndjson(buf, len, 4, LEPT_PARSE_INDEX_OBJECTS, ndjson_collect, &r));
+    EXPECT_EQ_INT(1, ndjson_seen_all(&r));
+    free(buf);
+}
+
+TEST(ndjson, stop) {
+    ndjson_result r;
+    size_t len;
+    char* buf = ndjson_lines(&len);
+    ndjson_result_init(&r, 1, 1000);
+    EXPECT_EQ_INT(LEPT_PARSE_STOPPED, lept_parse_ndjson(buf, len, 4, LEPT_NDJSON_ORDERED, ndjson_collect, &r));
+    EXPECT_EQ_ULONG(1000ul, (unsigned long)r.count);
+    free(buf);
+}
+
+TEST(ndjson, error) {
+    const char* buf = "{\"i\":0}\n[1,\n{\"i\":1}";
+    ndjson_result r;
+    ndjson_result_init(&r, 1, 0);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ndjson(buf, strlen(buf), 2, LEPT_NDJSON_ORDERED, ndjson_collect, &r));
+    EXPECT_EQ_ULONG(2ul, (unsigned long)r.count);
+    EXPECT_EQ_INT(1, r.errors);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ndjson("", 0, 0, 0, ndjson_collect, &r));
+}
+
+/* the structural characters outside strings, one character at a time */
+static size_t find_structurals_naive(const char* json, size_t len, uint32_t* out) {
+    size_t n = 0, i;
+    int in_string = 0, escaped = 0;
+    for (i = 0; i < len; ++i) {
+        /* backslashes outside strings are invalid, they still escape quotes */
+        if (json[i] == '"' && !escaped) {
+            in_string = !in_string;
+        } else if (!in_string && strchr("{}[],:", json[i]) != NULL) {
+            out[n++] = (uint32_t)i;
+        }
+        escaped = json[i] == '\\' && !escaped;
+    }
+    return n;
+}
+
+TEST(parallel, structurals) {
+    static const char alphabet[] = "\"\\\\[]{},: a";
+    char json[300];
+    uint32_t expect[300];
+    uint32_t* actual;
+    size_t len, n, expect_n, i;
+    unsigned long seed = 1;
+    int round, ok;
+    for (round = 0; round < 2000; ++round) {
+        len = round % 300;
+        for (i = 0; i < len; ++i) {
+            seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+            json[i] = alphabet[(seed >> 33) % (sizeof(alphabet) - 1)];
+        }
+        expect_n = find_structurals_naive(json, len, expect);
+        actual = lept_find_structurals(json, len, &n);
+        ok = n == expect_n && (n == 0 || memcmp(expect, actual, n * sizeof(uint32_t)) == 0);
+        EXPECT_EQ_INT(1, ok);
+        free(actual);
+    }
+}
+
+/* a root of n members with brackets, commas and escaped quotes in strings */
+static char* parallel_document(int n, int object, const char* last) {
+    char* json = (char*)malloc((size_t)n * 96 + 64);
+    char* p = json;
+    int i;
+    *p++ = object ? '{' : '[';
+    for (i = 0; i < n; ++i) {
+        if (i > 0) {
+            *p++ = ',';
+        }
+        if (object) {
+            p += sprintf(p, "\"k%d\\\"]\" : ", i);
+        }
+        p += sprintf(p, "{\"a\":[%d,\"x],\\\\\\\"{\\\"\"],\"b\":{\"c\":[]}} ", i);
+    }
+    p += sprintf(p, "%s%c ", last, object ? '}' : ']');
+    return json;
+}
+
+static void test_parallel(int expect_ret, const char* json) {
+    lept_value expect, v;
+    lept_buffer b, bv;
+    int nthreads;
+    lept_buffer_init(&b);
+    lept_buffer_init(&bv);
+    EXPECT_EQ_INT(expect_ret, lept_parse(&expect, json));
+    if (expect_ret == LEPT_PARSE_OK) {
+        lept_stringify(&expect, &b);
+    }
+    for (nthreads = 1; nthreads <= 4; ++nthreads) {
+        EXPECT_EQ_INT(expect_ret, lept_parse_parallel(&v, json, strlen(json), nthreads));
+        if (expect_ret == LEPT_PARSE_OK) {
+            lept_buffer_reset(&bv);
+            lept_stringify(&v, &bv);
+            EXPECT_EQ_STRING(b.data, bv.data);
+        }
+        if (expect_ret == LEPT_PARSE_OK || expect_ret == LEPT_PARSE_ROOT_NOT_SINGULAR) {
+            lept_free_value_on_stack(&v);
+        }
+    }
+    if (expect_ret == LEPT_PARSE_OK || expect_ret == LEPT_PARSE_ROOT_NOT_SINGULAR) {
+        lept_free_value_on_stack(&expect);
+    }
+    lept_buffer_free(&b);
+    lept_buffer_free(&bv);
+}
+
+#define TEST_PARALLEL(expect, n, object, last)             \
+    do {                                                   \
+        char* json = parallel_document(n, object, last);   \
+        test_parallel(expect, json);                       \
+        free(json);                                        \
+    } while (0)
+
+TEST(parallel, ok) {
+    TEST_PARALLEL(LEPT_PARSE_OK, 3000, 0, "");
+    TEST_PARALLEL(LEPT_PARSE_OK, 3000, 1, "");
+    TEST_PARALLEL(LEPT_PARSE_OK, 3000, 0, ",");   /* trailing comma */
+    TEST_PARALLEL(LEPT_PARSE_OK, 3000, 1, ",\n");
+    TEST_PARALLEL(LEPT_PARSE_OK, 10, 0, "");      /* small enough to parse on one thread */
+}
+
+TEST(parallel, error) {
+    TEST_PARALLEL(LEPT_PARSE_INVALID_VALUE, 3000, 0, ",nul");
+    TEST_PARALLEL(LEPT_PARSE_INVALID_VALUE, 3000, 0, ",,1");
+    TEST_PARALLEL(LEPT_PARSE_UNCLOSED_BRACKETS, 3000, 0, "}");
+    TEST_PARALLEL(LEPT_PARSE_EXPECT_VALUE, 3000, 1, ",\"k\" 1");
+    TEST_PARALLEL(LEPT_PARSE_INVALID_VALUE, 3000, 1, ",1:1");
+    TEST_PARALLEL(LEPT_PARSE_ROOT_NOT_SINGULAR, 3000, 0, "] [");
+    TEST_PARALLEL(LEPT_PARSE_UNCLOSED_QUOTES, 3000, 0, ",\"abc");
+}
+
+static const lept_parse_options lazy_options = { LEPT_PARSE_LAZY, NULL };
+
+/* a lazy parse must stringify exactly like an eager one */
+#define TEST_LAZY(json) \
+    do { \
+        lept_value eager, lazy; \
+        lept_buffer b1, b2; \
+        lept_buffer_init(&b1); \
+        lept_buffer_init(&b2); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&eager, json)); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&lazy, json, &lazy_options)); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&eager, &b1)); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&lazy, &b2)); \
+        EXPECT_EQ_STRING(b1.data, b2.data); \
+        lept_free_value_on_stack(&eager); \
+        lept_free_value_on_stack(&lazy); \
+        lept_buffer_free(&b1); \
+        lept_buffer_free(&b2); \
+    } while (0)
+
+TEST(lazy, stringify) {
+    TEST_LAZY("null");
+    TEST_LAZY("\"a\\tc\"");
+    TEST_LAZY("[]");
+    TEST_LAZY("{ }");
+    TEST_LAZY(" [ 1 , [ ] , [ [ 2 ] , { } ] , \"]\" ] ");
+    TEST_LAZY("{\"a\\\"]\":{\"b\":[1,2,{\"c\":\"}\\\\\"}]},\"d\":[[[[[]]]]],\"e\":true}");
+}
+
+TEST(lazy, access) {
+    const char* json = "{\"skip\":[1,[2,3],{\"x\":4}],\"n\":{\"m\":[5]},\"s\":\"t\"}";
+    lept_value v;
+    const lept_value* skip;
+    const lept_value* n;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, json, &lazy_options));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+    EXPECT_EQ_INT(1, v.value.o->lazy == json);
+    n = lept_find_object_value(&v, "n", 1);
+    EXPECT_EQ_INT(1, v.value.o->lazy == NULL);
+    EXPECT_EQ_ULONG(3ul, v.value.o->len);
+    skip = &v.value.o->nodes->value;
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(skip));
+    EXPECT_EQ_INT(1, skip->value.a->lazy != NULL);
+    EXPECT_EQ_DOUBLE(5.0, lept_get_number(
+        lept_get_array_element(lept_find_object_value(n, "m", 1), 0)));
+    EXPECT_EQ_INT(1, skip->value.a->lazy != NULL); /* never touched */
+    EXPECT_EQ_STRING("t", lept_get_string(lept_find_object_value(&v, "s", 1)));
+    EXPECT_EQ_ULONG(3ul, lept_get_array_size(skip));
+    EXPECT_EQ_INT(1, lept_get_array_element(skip, 1)->value.a->lazy != NULL);
+    lept_free_value_on_stack(&v); /* frees a partly materialized tree */
+}
+
+TEST(lazy, error) {
+    static const char* const bad[] = {
+        "[1,2", "{\"a\":[1,}", "[\"\\x\"]", "{\"a\" 1}", "[nul]", "[1e400]"
+    };
+    lept_value v;
+    size_t i;
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        EXPECT_EQ_INT(lept_parse(&v, bad[i]), lept_parse_opts(&v, bad[i], &lazy_options));
+        EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    }
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_opts(&v, "[1] 2", &lazy_options));
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+    EXPECT_EQ_ULONG(1ul, lept_get_array_size(&v));
+    lept_free_value_on_stack(&v);
+}
+
+TEST(lazy, invalid_options) {
+    lept_counting_allocator g;
+    lept_arena arena;
+    lept_parse_options opts = { LEPT_PARSE_LAZY, NULL, NULL, NULL, 0 };
+    lept_value v;
+    lept_counting_allocator_init(&g, NULL);
+    opts.allocator = &g.allocator;
+    v.type = LEPT_FALSE;
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_OPTIONS, lept_parse_opts(&v, "{\"a\":[1]}", &opts));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    EXPECT_EQ_ULONG(0ul, (unsigned long)g.stats.allocations);
+    /* the arena would not own the levels materialized later */
+    opts.allocator = NULL;
+    opts.arena = &arena;
+    lept_arena_init(&arena);
+    v.type = LEPT_FALSE;
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_OPTIONS, lept_parse_opts(&v, "{\"a\":[1]}", &opts));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    lept_arena_free(&arena);
+}
+
+/* pinned: a lazy document neither interns its keys nor indexes while parsing */
+TEST(lazy, ignored_options) {
+    char* json = make_object_json(100);
+    lept_key_pool* pool = lept_key_pool_new();
+    lept_string* k0 = lept_key_pool_intern(pool, "k0", 2);
+    lept_parse_options opts = { LEPT_PARSE_LAZY | LEPT_PARSE_INDEX_OBJECTS, NULL, NULL, NULL, 0 };
+    lept_object* o;
+    lept_value v;
+    opts.keys = pool;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, json, &opts));
+    o = lept_get_object(&v);
+    EXPECT_EQ_INT(1, o->nodes->key != k0);
+    EXPECT_EQ_INT(0, o->nodes->key->interned);
+    EXPECT_EQ_INT(1, o->index == NULL);
+    EXPECT_FIND_NUMBER(&v, "k42", 42.0);
+    EXPECT_EQ_INT(1, o->index != NULL);
+    lept_free_value_on_stack(&v);
+    lept_free_string(k0);
+    lept_key_pool_free(pool);
+    free(json);
+}
+
+static const char* const query_paths[] = {
+    "/user/id", "/items/*/price", "/meta/ts", "/missing", "/a~1b/~0", "/items/1", "/items/*/*", ""
+};
+#define QUERY_COUNT (sizeof(query_paths) / sizeof(query_paths[0]))
+static const char* const query_expects[QUERY_COUNT] = {
+    "7", "[1.5,2,3]", "\"x\\\"y\"", NULL, "true", "{\"price\":2}", "[1.5,\"a\",2,3]",
+    "{\"skip\":[[1],{\"a\":\"]\"}],\"user\":{\"name\":\"n\",\"id\":7},\"items\":[{\"price\":1.5,\"tag\":\"a\"},"
+    "{\"price\":2},{\"price\":3}],\"meta\":{\"ts\":\"x\\\"y\"},\"a/b\":{\"~\":true}}"
+};
+
+static void check_query_results(lept_value* results) {
+    lept_buffer b;
+    size_t i;
+    for (i = 0; i < QUERY_COUNT; ++i) {
+        if (query_expects[i] == NULL) {
+            EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&results[i]));
+            continue;
+        }
+        lept_buffer_init(&b);
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&results[i], &b));
+        EXPECT_EQ_STRING(query_expects[i], b.data);
+        lept_buffer_free(&b);
+        lept_free_value_on_stack(&results[i]);
+    }
+}
+
+TEST(query, run) {
+    const char* json = " { \"skip\" : [ [1] , {\"a\":\"]\"} ] , \"user\":{\"name\":\"n\",\"id\":7},"
+                       "\"items\":[{\"price\":1.5,\"tag\":\"a\"},{\"price\":2},{\"price\":3}],"
+                       "\"meta\":{\"ts\":\"x\\\"y\"},\"a/b\":{\"~\":true}}";
+    lept_query* q = lept_query_compile(query_paths, QUERY_COUNT);
+    lept_value results[QUERY_COUNT];
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_query_run(q, json, strlen(json), results));
+    check_query_results(results);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    lept_query_run_value(q, &v, results);
+    check_query_results(results);
+    lept_free_value_on_stack(&v);
+    lept_query_free(q);
+}
+
+TEST(query, compile) {
+    static const char* const bad1[] = { "/a", "a" };
+    static const char* const bad2[] = { "/a~2" };
+    static const char* const first[] = { "/0/k", "/01" };
+    lept_query* q;
+    lept_value results[2];
+    EXPECT_EQ_INT(1, lept_query_compile(bad1, 2) == NULL);
+    EXPECT_EQ_INT(1, lept_query_compile(bad2, 1) == NULL);
+    q = lept_query_compile(first, 2);
+    /* "0" is an index, "01" only a key; the first of duplicate keys wins */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_query_run(q, "[{\"k\":1,\"k\":2}]", 15, results));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(&results[0]));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&results[1]));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_query_run(q, "{\"0\":{\"k\":3},\"01\":4}", 20, results));
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(&results[0]));
+    EXPECT_EQ_DOUBLE(4.0, lept_get_number(&results[1]));
+    lept_query_free(q);
+}
+
+#define TEST_QUERY_ERROR(expect, json) \
+    do { \
+        lept_value results[QUERY_COUNT]; \
+        size_t i; \
+        EXPECT_EQ_INT(expect, lept_query_run(q, json, strlen(json), results)); \
+        for (i = 0; i < QUERY_COUNT - 2; ++i) { \
+            EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&results[i])); \
+        } \
+    } while (0)
+
+TEST(query, error) {
+    lept_query* q = lept_query_compile(query_paths + 1, QUERY_COUNT - 2);
+    const char* json;
+    TEST_QUERY_ERROR(LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_QUERY_ERROR(LEPT_PARSE_UNCLOSED_BRACKETS, "{\"items\":[{\"price\":1}");
+    TEST_QUERY_ERROR(LEPT_PARSE_UNCLOSED_BRACKETS, "{\"other\":[1,2}");
+    TEST_QUERY_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "{\"other\":\"abc\\\"}");
+    TEST_QUERY_ERROR(LEPT_PARSE_INVALID_VALUE, "{\"items\":[{\"price\":[1,2,nul]}]}");
+    TEST_QUERY_ERROR(LEPT_PARSE_EXPECT_VALUE, "{\"items\":[1,]}");
+    TEST_QUERY_ERROR(LEPT_PARSE_INVALID_VALUE, "{\"items\":{1:2}}");
+    lept_query_free(q);
+    q = lept_query_compile(query_paths, 1);
+    {   /* values off the paths are not validated */
+        lept_value result;
+        json = "{\"x\":[1,,tru],\"user\":{\"id\":1}}";
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_query_run(q, json, strlen(json), &result));
+        EXPECT_EQ_DOUBLE(1.0, lept_get_number(&result));
+        json = "{\"user\":{\"id\":2}} x";
+        EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_query_run(q, json, strlen(json), &result));
+        EXPECT_EQ_DOUBLE(2.0, lept_get_number(&result));
+    }
+    lept_query_free(q);
+}
+
+TEST(pool, intern) {
+    lept_key_pool* p = lept_key_pool_new();
+    lept_parse_options opts = { 0, NULL, NULL };
+    lept_string* id = lept_key_pool_intern(p, "id", 2);
+    lept_string* name = lept_key_pool_intern(p, "name", 4);
+    lept_value v, w;
+    lept_string key;
+    EXPECT_EQ_INT(1, id == lept_key_pool_intern(p, "id", 2));
+    lept_free_string(id);
+    EXPECT_EQ_INT(1, id != name);
+    EXPECT_EQ_STRING("name", name->str);
+    opts.keys = p;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, "{\"id\":1,\"name\":\"id\"}", &opts));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&w, "[{\"name\":2}]", &opts));
+    EXPECT_EQ_INT(1, lept_get_object(&v)->nodes->key == id);
+    EXPECT_EQ_STRING("id", lept_get_string(lept_find_object_key(&v, name)));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_find_object_key(&v, id)));
+    EXPECT_EQ_INT(1, lept_get_object(lept_get_array_element(&w, 0))->nodes->key == name);
+    key.str = "id"; /* an equal key from elsewhere still matches */
+    key.len = 2;
+    key.borrowed = key.interned = 0;
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_find_object_key(&v, &key)));
+    lept_free_string(id);
+    lept_free_string(name);
+    lept_key_pool_free(p);
+    EXPECT_EQ_STRING("name", lept_get_object(&v)->nodes->next->key->str); /* outlives the pool */
+    lept_free_value_on_stack(&v);
+    lept_free_value_on_stack(&w);
+}
+
+TEST(pool, index) {
+    lept_key_pool* p = lept_key_pool_new();
+    lept_parse_options opts = { LEPT_PARSE_INDEX_OBJECTS, NULL, NULL };
+    char* json = make_object_json(100);
+    lept_string* key;
+    lept_value v;
+    char buf[8];
+    int i;
+    opts.keys = p;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, json, &opts));
+    EXPECT_EQ_INT(1, lept_get_object(&v)->index != NULL);
+    for (i = 0; i < 100; i += 11) {
+        sprintf(buf, "k%d", i);
+        key = lept_key_pool_intern(p, buf, strlen(buf));
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_find_object_key(&v, key)));
+        lept_free_string(key);
+    }
+    key = lept_key_pool_intern(p, "k100", 4);
+    EXPECT_EQ_INT(1, lept_find_object_key(&v, key) == NULL);
+    lept_free_string(key);
+    lept_free_value_on_stack(&v);
+    lept_key_pool_free(p);
+    free(json);
+}
+
+TEST(tape, access) {
+    const char* json = " { \"n\" : null , \"a\" : [ 1.5 , true , false , [ ] , { } ] , \"s\" : \"a\\tb\" } ";
+    lept_tape t;
+    lept_tape_iter root, a, e;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_tape(&t, json, strlen(json)));
+    root = lept_tape_root(&t);
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_tape_get_type(root));
+    EXPECT_EQ_ULONG(6ul, lept_tape_get_size(root));
+    EXPECT_EQ_INT(LEPT_NULL, lept_tape_get_type(lept_tape_find(root, "n", 1)));
+    EXPECT_EQ_STRING("a\tb", lept_tape_get_string(lept_tape_find(root, "s", 1)));
+    EXPECT_EQ_ULONG(3ul, lept_tape_get_string_length(lept_tape_find(root, "s", 1)));
+    EXPECT_EQ_INT(1, lept_tape_is_end(lept_tape_find(root, "x", 1)));
+    a = lept_tape_find(root, "a", 1);
+    EXPECT_EQ_ULONG(5ul, lept_tape_get_size(a));
+    e = lept_tape_first(a);
+    EXPECT_EQ_DOUBLE(1.5, lept_tape_get_number(e));
+    e = lept_tape_next(e);
+    EXPECT_EQ_INT(LEPT_TRUE, lept_tape_get_type(e));
+    e = lept_tape_next(e);
+    EXPECT_EQ_INT(LEPT_FALSE, lept_tape_get_type(e));
+    e = lept_tape_next(e);
+    EXPECT_EQ_ULONG(0ul, lept_tape_get_size(e));
+    EXPECT_EQ_INT(1, lept_tape_is_end(lept_tape_first(e)));
+    e = lept_tape_next(e);
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_tape_get_type(e));
+    EXPECT_EQ_INT(1, lept_tape_is_end(lept_tape_next(e)));
+    /* skipping the array lands on the next key */
+    EXPECT_EQ_STRING("s", lept_tape_get_string(lept_tape_next(a)));
+    lept_tape_free(&t);
+}
+
+TEST(tape, to_value) {
+    static const char* const jsons[] = {
+        "null", "-0.5", "\"\"", "\"a string long enough to leave the value\"", "[]", "{}",
+        "{\"k\":[1,{\"a\":[]},\"x\"],\"\":{\"b\":false}}"
+    };
+    lept_buffer b;
+    lept_tape t;
+    lept_value v;
+    size_t i;
+    for (i = 0; i < sizeof(jsons) / sizeof(jsons[0]); ++i) {
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_tape(&t, jsons[i], strlen(jsons[i])));
+        lept_tape_to_value(lept_tape_root(&t), &v);
+        lept_tape_free(&t);
+        lept_buffer_init(&b);
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b));
+        EXPECT_EQ_STRING(jsons[i], b.data);
+        lept_buffer_free(&b);
+        lept_free_value_on_stack(&v);
+    }
+}
+
+#define TEST_TAPE_ERROR(expect, json) \
+    do { \
+        lept_tape t; \
+        EXPECT_EQ_INT(expect, lept_parse_tape(&t, json, strlen(json))); \
+        EXPECT_EQ_INT(1, t.words == NULL && t.len == 0); \
+    } while (0)
+
+TEST(tape, error) {
+    lept_tape t;
+    TEST_TAPE_ERROR(LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_TAPE_ERROR(LEPT_PARSE_INVALID_VALUE, "[1,nul]");
+    TEST_TAPE_ERROR(LEPT_PARSE_UNCLOSED_BRACKETS, "{\"a\":[1,2}");
+    TEST_TAPE_ERROR(LEPT_PARSE_UNCLOSED_QUOTES, "[\"abc]");
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_tape(&t, "1 2", 3));
+    EXPECT_EQ_DOUBLE(1.0, lept_tape_get_number(lept_tape_root(&t)));
+    lept_tape_free(&t);
+}
+
+TEST(binary, roundtrip) {
+    static const char* const jsons[] = {
+        "null", "false", "true", "0", "-0", "127", "-32", "-33", "255", "65536", "-2147483649",
+        "4294967296", "1.5", "-1e300", "\"\"", "\"a string long enough for the 8-bit length form\"",
+        "[]", "{}", "[1,[2,[3]],{\"k\":\"v\"}]", "{\"a\":{\"b\":[null,true]},\"c\":-0.25}"
+    };
+    int (*encode[])(const lept_value*, lept_buffer*) = { lept_to_msgpack, lept_to_cbor };
+    int (*decode[])(lept_value*, const char*, size_t, const lept_parse_options*) = { lept_from_msgpack, lept_from_cbor };
+    lept_buffer b, text;
+    lept_value v, w;
+    size_t i, k;
+    for (k = 0; k < 2; ++k) {
+        for (i = 0; i < sizeof(jsons) / sizeof(jsons[0]); ++i) {
+            EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, jsons[i]));
+            lept_buffer_init(&b);
+            EXPECT_EQ_INT(LEPT_STRINGIFY_OK, encode[k](&v, &b));
+            EXPECT_EQ_INT(LEPT_PARSE_OK, decode[k](&w, b.data, b.len, NULL));
+            lept_buffer_init(&text);
+            EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&w, &text));
+            EXPECT_EQ_STRING(jsons[i], text.data);
+            lept_buffer_free(&text);
+            lept_buffer_free(&b);
+            lept_free_value_on_stack(&v);
+            lept_free_value_on_stack(&w);
+        }
+    }
+}
+
+#define TEST_ENCODE(encode, expect, json) \
+    do { \
+        lept_buffer b; \
+        lept_value v; \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json)); \
+        lept_buffer_init(&b); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, encode(&v, &b)); \
+        EXPECT_EQ_ULONG((unsigned long)(sizeof(expect) - 1), (unsigned long)b.len); \
+        EXPECT_EQ_INT(0, memcmp(expect, b.data, sizeof(expect) - 1)); \
+        lept_buffer_free(&b); \
+        lept_free_value_on_stack(&v); \
+    } while (0)
+
+TEST(binary, encode) {
+    TEST_ENCODE(lept_to_msgpack, "\x82\xA1" "a\x93\x01\xFF\xCD\x01\x2C\xA1" "b\xC3", "{\"a\":[1,-1,300],\"b\":true}");
+    TEST_ENCODE(lept_to_msgpack, "\xCB\x3F\xF8\x00\x00\x00\x00\x00\x00", "1.5");
+    TEST_ENCODE(lept_to_msgpack, "\xD0\x80", "-128");
+    TEST_ENCODE(lept_to_cbor, "\xA2\x61" "a\x83\x01\x20\x19\x01\x2C\x61" "b\xF5", "{\"a\":[1,-1,300],\"b\":true}");
+    TEST_ENCODE(lept_to_cbor, "\xFB\x3F\xF8\x00\x00\x00\x00\x00\x00", "1.5");
+    TEST_ENCODE(lept_to_cbor, "\x38\xFF", "-256");
+}
+
+#define TEST_DECODE(decode, expect, bytes) \
+    do { \
+        lept_buffer b; \
+        lept_value v; \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, decode(&v, bytes, sizeof(bytes) - 1, NULL)); \
+        lept_buffer_init(&b); \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &b)); \
+        EXPECT_EQ_STRING(expect, b.data); \
+        lept_buffer_free(&b); \
+        lept_free_value_on_stack(&v); \
+    } while (0)
+
+/* forms other encoders produce */
+TEST(binary, decode) {
+    TEST_DECODE(lept_from_msgpack, "[255,-2,1.5]", "\x93\xCF\x00\x00\x00\x00\x00\x00\x00\xFF\xD3\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFE\xCA\x3F\xC0\x00\x00");
+    TEST_DECODE(lept_from_msgpack, "{\"k\":\"v\"}", "\xDE\x00\x01\xDA\x00\x01k\xD9\x01v");
+    TEST_DECODE(lept_from_cbor, "[1,[2],{\"a\":null}]", "\x9F\x01\x9F\x02\xFF\xBF\x61" "a\xF6\xFF\xFF");
+    TEST_DECODE(lept_from_cbor, "[1,-2,65504,5.960464477539063e-8,0.5]",
+                "\x85\xF9\x3C\x00\xF9\xC0\x00\xF9\x7B\xFF\xF9\x00\x01\xFA\x3F\x00\x00\x00");
+}
+
+#define TEST_DECODE_ERROR(decode, expect, bytes) \
+    do { \
+        lept_value v; \
+        v.type = LEPT_FALSE; \
+        EXPECT_EQ_INT(expect, decode(&v, bytes, sizeof(bytes) - 1, NULL)); \
+        EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v)); \
+    } while (0)
+
+TEST(binary, error) {
+    lept_parse_options opts = { 0, NULL, NULL };
+    lept_arena arena;
+    lept_value v;
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_INVALID_VALUE, "\xC1");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_INVALID_VALUE, "\x91\xC4\x00");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_INVALID_VALUE, "\xCD\x01");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_INVALID_VALUE, "\x81\x01\x02");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_UNCLOSED_QUOTES, "\xA3" "ab");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_UNCLOSED_BRACKETS, "\x92\xA1" "a");
+    TEST_DECODE_ERROR(lept_from_msgpack, LEPT_PARSE_UNCLOSED_BRACKETS, "\x81\xA1" "a");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_INVALID_VALUE, "\x42" "ab");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_INVALID_VALUE, "\xC1\x01");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_INVALID_VALUE, "\xF7");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_INVALID_VALUE, "\xA1\x01\x02");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_UNCLOSED_QUOTES, "\x63" "ab");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_UNCLOSED_BRACKETS, "\x9F\x61" "a");
+    TEST_DECODE_ERROR(lept_from_cbor, LEPT_PARSE_UNCLOSED_BRACKETS, "\x82\x01");
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_from_cbor(&v, "\x01\x02", 2, NULL));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(&v));
+    /* decoding allocates from the arena of the options */
+    lept_arena_init(&arena);
+    opts.arena = &arena;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_from_msgpack(&v, "\x91\xA1" "a", 3, &opts));
+    EXPECT_EQ_STRING("a", lept_get_string(lept_get_array_element(&v, 0)));
+    lept_arena_free(&arena);
+}
+
+TEST(allocator, global) {
+    lept_counting_allocator g;
+    lept_key_pool* p;
+    lept_value v;
+    lept_buffer b;
+    lept_counting_allocator_init(&g, NULL);
+    lept_set_allocator(&g.allocator);
+    EXPECT_EQ_INT(1, lept_get_allocator() == &g.allocator);
+    p = lept_key_pool_new();
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a long string to leave the value\":[1,{\"k\":null}]}"));
+    EXPECT_EQ_INT(1, g.stats.allocations > 0 && g.stats.bytes > 0);
+    lept_buffer_init(&b);
+    lept_stringify(&v, &b);
+    lept_buffer_free(&b);
+    lept_free_value_on_stack(&v);
+    lept_free_string(lept_key_pool_intern(p, "k", 1));
+    lept_key_pool_free(p);
+    EXPECT_EQ_ULONG(0ul, (unsigned long)g.stats.bytes);
+    EXPECT_EQ_INT(1, g.stats.peak_bytes > 0 && g.stats.frees > 0);
+    lept_set_allocator(NULL);
+    EXPECT_EQ_INT(1, lept_get_allocator() != &g.allocator);
+}
+
+TEST(allocator, per_call) {
+    lept_counting_allocator g, t;
+    lept_parse_options opts = { 0, NULL, NULL, NULL };
+    char* json = make_object_json(100);
+    lept_arena arena;
+    lept_value v;
+    lept_counting_allocator_init(&t, NULL); /* on top of the C library */
+    lept_counting_allocator_init(&g, NULL);
+    lept_set_allocator(&g.allocator);
+    opts.allocator = &t.allocator;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, json, &opts));
+    EXPECT_EQ_DOUBLE(42.0, lept_get_number(lept_find_object_value(&v, "k42", 3))); /* builds the index */
+    EXPECT_EQ_INT(1, lept_get_object(&v)->index != NULL && t.stats.bytes > 0);
+    EXPECT_EQ_ULONG(0ul, (unsigned long)g.stats.allocations);
+    lept_free_value_with(&v, &t.allocator);
+    EXPECT_EQ_ULONG(0ul, (unsigned long)t.stats.bytes);
+    /* an error frees what was built */
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_opts(&v, "[\"a long string to leave the value\",{\"k\":[1,x]}]", &opts));
+    EXPECT_EQ_ULONG(0ul, (unsigned long)t.stats.bytes);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_from_msgpack(&v, "\x91\xA1" "a", 3, &opts));
+    EXPECT_EQ_INT(1, t.stats.bytes > 0);
+    lept_free_value_with(&v, &t.allocator);
+    EXPECT_EQ_ULONG(0ul, (unsigned long)t.stats.bytes);
+    /* arenas keep the allocator they are given after init */
+    lept_arena_init(&arena);
+    arena.allocator = &t.allocator;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_arena(&arena, &v, json));
+    EXPECT_EQ_INT(1, t.stats.bytes > 0);
+    lept_arena_free(&arena);
+    EXPECT_EQ_ULONG(0ul, (unsigned long)t.stats.bytes);
+    EXPECT_EQ_ULONG(0ul, (unsigned long)g.stats.allocations);
+    lept_set_allocator(NULL);
+    free(json);
+}
+
+TEST(copy, share) {
+    lept_counting_allocator g;
+    char* json = make_object_json(100);
+    lept_value v, c[3];
+    size_t i;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    lept_counting_allocator_init(&g, NULL);
+    lept_set_allocator(&g.allocator);
+    for (i = 0; i < 3; ++i) {
+        lept_copy(&c[i], &v);
+    }
+    EXPECT_EQ_ULONG(0ul, (unsigned long)g.stats.allocations); /* nothing is copied */
+    lept_set_allocator(NULL);
+    EXPECT_EQ_INT(1, lept_get_object(&c[2]) == lept_get_object(&v));
+    lept_free_value_on_stack(&v); /* the copies keep what they share */
+    EXPECT_EQ_DOUBLE(42.0, lept_get_number(lept_find_object_value(&c[0], "k42", 3)));
+    EXPECT_EQ_DOUBLE(7.0, lept_get_number(lept_find_object_value(&c[1], "k7", 2)));
+    for (i = 0; i < 3; ++i) {
+        lept_free_value_on_stack(&c[i]);
+    }
+    /* long strings are shared too, short ones travel in the value */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "\"a string too long for the value\""));
+    lept_copy(&c[0], &v);
+    EXPECT_EQ_INT(1, lept_get_string(&c[0]) == lept_get_string(&v));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_STRING("a string too long for the value", lept_get_string(&c[0]));
+    lept_free_value_on_stack(&c[0]);
+    free(json);
+}
+
+TEST(copy, write) {
+    lept_value v, c;
+    lept_array* a;
+    lept_object* o;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"list\":[1,[2],\"a string too long for the value\"],\"n\":3}"));
+    a = lept_get_array(lept_find_object_value(&v, "list", 4));
+    EXPECT_EQ_INT(1, lept_get_mutable_object(&v) == lept_get_object(&v)); /* not shared, no copy */
+    lept_copy(&c, &v);
+    o = lept_get_mutable_object(&c);
+    EXPECT_EQ_INT(1, o != lept_get_object(&v) && o == lept_get_object(&c));
+    EXPECT_EQ_INT(1, o->nodes->key == lept_get_object(&v)->nodes->key);
+    /* the copied level still shares the array until it is written */
+    EXPECT_EQ_INT(1, lept_get_array(lept_find_object_value(&c, "list", 4)) == a);
+    lept_set_string(lept_pushback_array_element(lept_get_mutable_array(lept_find_object_value(&c, "list", 4))), "x", 1);
+    EXPECT_EQ_ULONG(4ul, lept_get_array_size(lept_find_object_value(&c, "list", 4)));
+    EXPECT_EQ_ULONG(3ul, lept_get_array_size(lept_find_object_value(&v, "list", 4)));
+    EXPECT_EQ_INT(1, lept_get_array(lept_get_array_element(lept_find_object_value(&c, "list", 4), 1)) ==
+                     lept_get_array(&a->items[1]));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_STRING("a string too long for the value",
+                     lept_get_string(lept_get_array_element(lept_find_object_value(&c, "list", 4), 2)));
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_find_object_value(&c, "n", 1)));
+    lept_free_value_on_stack(&c);
+}
+
+TEST(copy, move_swap) {
+    lept_value v, w;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[1,2]"));
+    lept_move(&w, &v);
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    EXPECT_EQ_ULONG(2ul, lept_get_array_size(&w));
+    lept_set_string(&v, "short", 5);
+    lept_swap(&v, &w);
+    EXPECT_EQ_STRING("short", lept_get_string(&w));
+    EXPECT_EQ_ULONG(2ul, lept_get_array_size(&v));
+    lept_move(&v, &v);
+    EXPECT_EQ_ULONG(2ul, lept_get_array_size(&v));
+    lept_free_value_on_stack(&v);
+    lept_free_value_on_stack(&w);
+}
+
+#define TEST_EQUAL(json1, json2, equality)                                \
+    do {                                                                  \
+        lept_value a, b;                                                  \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, json1));              \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, json2));              \
+        EXPECT_EQ_INT(equality, lept_is_equal(&a, &b));                   \
+        if (equality) { /* and again with the hashes cached */            \
+            EXPECT_EQ_INT(1, lept_hash(&a) == lept_hash(&b));             \
+        }                                                                 \
+        EXPECT_EQ_INT(equality, lept_is_equal(&b, &a));                   \
+        lept_free_value_on_stack(&a);                                     \
+        lept_free_value_on_stack(&b);                                     \
+    } while (0)
+
+TEST(equal, values) {
+    TEST_EQUAL("true", "true", 1);
+    TEST_EQUAL("true", "false", 0);
+    TEST_EQUAL("null", "0", 0);
+    TEST_EQUAL("123", "1.23e2", 1);
+    TEST_EQUAL("0", "-0", 1);
+    TEST_EQUAL("123", "124", 0);
+    TEST_EQUAL("\"a\"", "\"a\"", 1);
+    TEST_EQUAL("\"a\"", "\"ab\"", 0);
+    TEST_EQUAL("\"a string too long for the value\"", "\"a string too long for the value\"", 1);
+    TEST_EQUAL("\"a string too long for the value\"", "\"a string too long for the valve\"", 0);
+    TEST_EQUAL("[]", "[]", 1);
+    TEST_EQUAL("[1,2,3]", "[1,2,3]", 1);
+    TEST_EQUAL("[1,2,3]", "[3,2,1]", 0);
+    TEST_EQUAL("[1,2,3]", "[1,2]", 0);
+    TEST_EQUAL("[[1],{}]", "[[1],{}]", 1);
+    TEST_EQUAL("[]", "{}", 0);
+    TEST_EQUAL("{}", "{}", 1);
+    TEST_EQUAL("{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":1}", 1);
+    TEST_EQUAL("{\"a\":1,\"b\":2}", "{\"a\":2,\"b\":1}", 0);
+    TEST_EQUAL("{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":2}", 0);
+    TEST_EQUAL("{\"a\":1,\"b\":2}", "{\"a\":1}", 0);
+    TEST_EQUAL("{\"a\":[1,{\"x\":null,\"y\":true}],\"b\":\"s\"}",
+               "{\"b\":\"s\",\"a\":[1,{\"y\":true,\"x\":null}]}", 1);
+    TEST_EQUAL("{\"a\":[1,{\"x\":null,\"y\":true}]}", "{\"a\":[1,{\"y\":false,\"x\":null}]}", 0);
+    /* repeated keys are matched member for member */
+    TEST_EQUAL("{\"k\":1,\"k\":1}", "{\"k\":1,\"j\":5}", 0);
+    TEST_EQUAL("{\"k\":1,\"j\":5}", "{\"k\":1,\"k\":1}", 0);
+    TEST_EQUAL("{\"k\":1,\"k\":2}", "{\"k\":2,\"k\":1}", 1);
+    TEST_EQUAL("{\"k\":1,\"k\":1,\"j\":5}", "{\"j\":5,\"k\":1,\"j\":5}", 0);
+    TEST_EQUAL("{\"j\":5,\"k\":1,\"j\":5}", "{\"k\":1,\"k\":1,\"j\":5}", 0);
+    TEST_EQUAL("{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"k\":0,\"k\":0}",
+               "{\"k\":0,\"j\":0,\"i\":9,\"h\":8,\"g\":7,\"f\":6,\"e\":5,\"d\":4,\"c\":3,\"b\":2,\"a\":1}", 0);
+    TEST_EQUAL("{\"k\":0,\"j\":0,\"i\":9,\"h\":8,\"g\":7,\"f\":6,\"e\":5,\"d\":4,\"c\":3,\"b\":2,\"a\":1}",
+               "{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"k\":0,\"k\":0}", 0);
+    TEST_EQUAL("{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"k\":0,\"k\":1}",
+               "{\"k\":1,\"k\":0,\"i\":9,\"h\":8,\"g\":7,\"f\":6,\"e\":5,\"d\":4,\"c\":3,\"b\":2,\"a\":1}", 1);
+}
+
+TEST(equal, hash) {
+    char* json = make_object_json(100);
+    lept_value v, c, r;
+    size_t h;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    /* the same keys in reverse, looked up through the index */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&r, json));
+    {
+        lept_object* o = lept_get_mutable_object(&r);
+        lept_object_node* reversed = NULL;
+        lept_object_node* next;
+        lept_object_node* node;
+        for (node = o->nodes; node; node = next) {
+            next = node->next;
+            node->next = reversed;
+            reversed = node;
+        }
+        o->nodes = reversed;
+        lept_index_object(o);
+    }
+    h = lept_hash(&v);
+    EXPECT_EQ_INT(1, h == lept_hash(&r));
+    EXPECT_EQ_INT(1, lept_is_equal(&v, &r));
+    lept_copy(&c, &v);
+    EXPECT_EQ_INT(1, h == lept_hash(&c) && lept_is_equal(&c, &v));
+    /* a write through the mutable getter forgets the hash */
+    lept_get_mutable_object(&c);
+    lept_find_object_value(&c, "k7", 2)->value.n = 8.0;
+    EXPECT_EQ_INT(0, h == lept_hash(&c));
+    EXPECT_EQ_INT(0, lept_is_equal(&c, &v));
+    EXPECT_EQ_INT(1, h == lept_hash(&v));
+    lept_free_value_on_stack(&v);
+    lept_free_value_on_stack(&r);
+    lept_free_value_on_stack(&c);
+    free(json);
+}
+
+#define EXPECT_CACHE_STATS(c, expect_hits, expect_misses, expect_entries) \
+    do {                                                                   \
+        lept_parse_cache_stats stats;                                      \
+        lept_parse_cache_get_stats(c, &stats);                             \
+        EXPECT_EQ_ULONG(expect_hits, stats.hits);                          \
+        EXPECT_EQ_ULONG(expect_misses, stats.misses);                      \
+        EXPECT_EQ_ULONG(expect_entries, stats.entries);                    \
+    } while (0)
+
+TEST(cache, text) {
+    static const char json[] = "{\"flags\":[\"a string too long for the value\",true],\"n\":1}";
+    lept_parse_cache* c = lept_parse_cache_new(1 << 20);
+    lept_value v, w;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, json, sizeof(json) - 1));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &w, json, sizeof(json) - 1));
+    EXPECT_CACHE_STATS(c, 1ul, 1ul, 1ul);
+    EXPECT_EQ_INT(1, lept_get_object(&v) == lept_get_object(&w));
+    /* a copy written to leaves the kept document alone */
+    lept_find_object_value(&w, "n", 1);
+    lept_get_mutable_object(&w);
+    lept_find_object_value(&w, "n", 1)->value.n = 2.0;
+    lept_free_value_on_stack(&w);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &w, json, sizeof(json) - 1));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_find_object_value(&w, "n", 1)));
+    lept_free_value_on_stack(&w);
+    /* the same text elsewhere in memory, a prefix of it, and a failure that is not kept */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &w, "[1] ", 3));
+    lept_free_value_on_stack(&w);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &w, "[1]", 3));
+    lept_free_value_on_stack(&w);
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_cached(c, &w, "[1]x", 4));
+    lept_free_value_on_stack(&w);
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_cached(c, &w, "[1]x", 4));
+    lept_free_value_on_stack(&w);
+    EXPECT_CACHE_STATS(c, 3ul, 4ul, 2ul);
+    lept_parse_cache_free(c);
+    EXPECT_EQ_STRING("a string too long for the value",
+                     lept_get_string(lept_get_array_element(lept_find_object_value(&v, "flags", 5), 0)));
+    lept_free_value_on_stack(&v);
+}
+
+TEST(cache, lru) {
+    lept_parse_cache* c = lept_parse_cache_new(1 << 20);
+    lept_parse_cache_stats stats;
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[1,2,3]", 7));
+    lept_free_value_on_stack(&v);
+    lept_parse_cache_get_stats(c, &stats);
+    lept_parse_cache_free(c);
+    c = lept_parse_cache_new(stats.bytes * 2); /* room for two documents of that size */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[1,2,3]", 7));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[4,5,6]", 7));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[1,2,3]", 7));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[7,8,9]", 7)); /* [4,5,6] goes */
+    lept_free_value_on_stack(&v);
+    EXPECT_CACHE_STATS(c, 1ul, 3ul, 2ul);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[1,2,3]", 7));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[4,5,6]", 7));
+    lept_free_value_on_stack(&v);
+    EXPECT_CACHE_STATS(c, 2ul, 4ul, 2ul);
+    lept_parse_cache_free(c);
+    /* a document bigger than the cache is parsed but not kept */
+    c = lept_parse_cache_new(16);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_cached(c, &v, "[1,2,3]", 7));
+    lept_free_value_on_stack(&v);
+    EXPECT_CACHE_STATS(c, 0ul, 1ul, 0ul);
+    lept_parse_cache_free(c);
+}
+
+static void write_file(const char* path, const char* text) {
+    FILE* f = fopen(path, "wb");
+    fputs(text, f);
+    fclose(f);
+}
+
+TEST(cache, file) {
+    static const char* path = "lept_cache_test.json";
+    lept_parse_cache* c = lept_parse_cache_new(1 << 20);
+    lept_value v, w;
+    write_file(path, "{\"version\":1}");
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file_cached(c, &v, path));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file_cached(c, &w, path));
+    EXPECT_CACHE_STATS(c, 1ul, 1ul, 1ul);
+    EXPECT_EQ_INT(1, lept_get_object(&v) == lept_get_object(&w));
+    lept_free_value_on_stack(&w);
+    write_file(path, "{\"version\":10}");
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file_cached(c, &w, path));
+    EXPECT_EQ_DOUBLE(10.0, lept_get_number(lept_find_object_value(&w, "version", 7)));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_find_object_value(&v, "version", 7)));
+    EXPECT_CACHE_STATS(c, 1ul, 2ul, 1ul);
+    lept_free_value_on_stack(&v);
+    lept_free_value_on_stack(&w);
+    remove(path);
+    EXPECT_EQ_INT(LEPT_FILE_CANNOT_OPEN, lept_parse_file_cached(c, &v, path));
+    lept_parse_cache_free(c);
+}
+
+static char* nested_json(size_t depth, const char* open, const char* close) {
+    size_t i, n = strlen(open), m = strlen(close);
+    char* json = (char*)malloc(depth * (n + m) + 2);
+    char* p = json;
+    for (i = 0; i < depth; ++i, p += n) {
+        memcpy(p, open, n);
+    }
+    *p++ = '0';
+    for (i = 0; i < depth; ++i, p += m) {
+        memcpy(p, close, m);
+    }
+    *p = '\0';
+    return json;
+}
+
+TEST(depth, unlimited) {
+    char* json = nested_json(100000, "[{\"k\":", "}]");
+    lept_arena arena;
+    lept_parse_options opts = { 0, NULL, NULL, NULL, LEPT_PARSE_DEPTH_UNLIMITED };
+    lept_value v;
+    const lept_value* e = &v;
+    size_t depth = 0;
+    lept_arena_init(&arena);
+    opts.arena = &arena;
+    /* the arena is released without walking the document */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, json, &opts));
+    while (lept_get_type(e) != LEPT_NUMBER) {
+        e = lept_get_type(e) == LEPT_ARRAY ? lept_get_array_element(e, 0) : lept_find_object_value(e, "k", 1);
+        ++depth;
+    }
+    EXPECT_EQ_ULONG(200000ul, (unsigned long)depth);
+    lept_arena_free(&arena);
+    free(json);
+}
+
+TEST(depth, default) {
+    char* json = nested_json(LEPT_PARSE_MAX_DEPTH, "[", "]");
+    char* deeper = nested_json(LEPT_PARSE_MAX_DEPTH + 1, "[", "]");
+    char* deepest = nested_json(1000000, "[", "]");
+    lept_parse_options opts = { LEPT_PARSE_LAZY, NULL, NULL, NULL, 0 };
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse(&v, deeper));
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse_n(&v, deepest, strlen(deepest)));
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse_opts(&v, deeper, &opts));
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse_parallel(&v, deepest, strlen(deepest), 2));
+    free(json);
+    free(deeper);
+    free(deepest);
+}
+
+TEST(depth, limit) {
+    lept_parse_options opts = { 0, NULL, NULL, NULL, 3 };
+    lept_value v;
+    v.type = LEPT_FALSE;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, "[{\"a\":[1]},[]]", &opts));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse_opts(&v, "[{\"a\":[[1]]},[]]", &opts));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse_opts(&v, "[[[[", &opts));
+    /* other errors still win when they come first */
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_opts(&v, "[[x,[[1]]]]", &opts));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_opts(&v, "[1,[2,[3,]],]", &opts));
+    lept_free_value_on_stack(&v);
+}
+
+TEST(depth, push) {
+    lept_parse_options opts = { 0, NULL, NULL, NULL, 3 };
+    lept_push_parser* p = lept_push_parser_new(&opts);
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "[[[1]],", 7));
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_push_parser_feed(p, "[[[1]]]]", 8));
+    lept_push_parser_free(p);
+    p = lept_push_parser_new(&opts);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_feed(p, "[[[1]],[[2]]]", 13));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_push_parser_finish(p, &v));
+    lept_free_value_on_stack(&v);
+    lept_push_parser_free(p);
+}
+
+TEST(depth, binary) {
+    lept_parse_options opts = { 0, NULL, NULL, NULL, 2 };
+    lept_value v;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_from_msgpack(&v, "\x91\x91\x01", 3, &opts));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_from_msgpack(&v, "\x91\x81\xA1" "a" "\x90", 5, &opts));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_from_cbor(&v, "\x81\xA1\x61" "a" "\x01", 5, &opts));
+    lept_free_value_on_stack(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_from_cbor(&v, "\x9F\x9F\x9F\xFF\xFF\xFF", 6, &opts));
+    EXPECT_EQ_INT(LEPT_UNKNOWN, lept_get_type(&v));
+}
+
+/* one-element arrays, each the head of the next, far deeper than the default */
+TEST(depth, binary_default) {
+    size_t len = 2 << 20;
+    char* data = (char*)malloc(len);
+    lept_value v;
+    memset(data, 0x91, len);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_from_msgpack(&v, data, len, NULL));
+    memset(data, 0x81, len);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_from_cbor(&v, data, len, NULL));
+    memset(data, 0x9F, len); /* of unknown length */
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_from_cbor(&v, data, len, NULL));
+    /* the limit itself is accepted */
+    memset(data, 0x91, LEPT_PARSE_MAX_DEPTH);
+    data[LEPT_PARSE_MAX_DEPTH] = 0x01;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_from_msgpack(&v, data, LEPT_PARSE_MAX_DEPTH + 1, NULL));
+    lept_free_value_on_stack(&v);
+    memset(data, 0x81, LEPT_PARSE_MAX_DEPTH);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_from_cbor(&v, data, LEPT_PARSE_MAX_DEPTH + 1, NULL));
+    lept_free_value_on_stack(&v);
+    free(data);
+}
+
 MAIN_BEG
     SUITE_BEG(simple)
         RUN_TEST(simple, null)
         RUN_TEST(simple, true)
         RUN_TEST(simple, false)
         RUN_TEST(simple, number)
+        RUN_TEST(simple, number_exact)
         RUN_TEST(simple, string)
+        RUN_TEST(simple, string_scan)
+        RUN_TEST(simple, string_utf8)
+        RUN_TEST(simple, short_string)
+        RUN_TEST(simple, whitespace)
         RUN_TEST(simple, array)
+        RUN_TEST(simple, nested_array)
+        RUN_TEST(simple, array_pushback)
         RUN_TEST(simple, object)
     SUITE_END(simple)
+    SUITE_BEG(object)
+        RUN_TEST(object, find_linear)
+        RUN_TEST(object, find_indexed)
+        RUN_TEST(object, find_small_indexed)
+        RUN_TEST(object, index_flag)
+    SUITE_END(object)
     SUITE_BEG(error)
         RUN_TEST(error, expect_value)
         RUN_TEST(error, invalid_value)
         RUN_TEST(error, unclosed_brackets)
         RUN_TEST(error, unclosed_quotes)
         RUN_TEST(error, root_not_singular)
+        RUN_TEST(error, invalid_unicode)
+        RUN_TEST(error, invalid_utf8)
         RUN_TEST(error, number_too_big)
     SUITE_END(error)
     SUITE_BEG(complex)
@@ -345,5 +2265,107 @@ MAIN_BEG
     SUITE_END(complex)
     SUITE_BEG(file)
         RUN_TEST(file, ok)
+        RUN_TEST(file, error)
     SUITE_END(file)
+    SUITE_BEG(length)
+        RUN_TEST(length, ok)
+        RUN_TEST(length, truncated)
+        RUN_TEST(length, embedded_nul)
+    SUITE_END(length)
+    SUITE_BEG(insitu)
+        RUN_TEST(insitu, string)
+        RUN_TEST(insitu, object)
+        RUN_TEST(insitu, error)
+    SUITE_END(insitu)
+    SUITE_BEG(stringify)
+        RUN_TEST(stringify, literal)
+        RUN_TEST(stringify, number)
+        RUN_TEST(stringify, number_exact)
+        RUN_TEST(stringify, string)
+        RUN_TEST(stringify, control)
+        RUN_TEST(stringify, container)
+        RUN_TEST(stringify, pretty)
+        RUN_TEST(stringify, reuse)
+        RUN_TEST(stringify, invalid)
+    SUITE_END(stringify)
+    SUITE_BEG(arena)
+        RUN_TEST(arena, parse)
+        RUN_TEST(arena, reuse)
+        RUN_TEST(arena, error)
+    SUITE_END(arena)
+    SUITE_BEG(sax)
+        RUN_TEST(sax, events)
+        RUN_TEST(sax, stop)
+        RUN_TEST(sax, error)
+        RUN_TEST(sax, zero_copy)
+    SUITE_END(sax)
+    SUITE_BEG(push)
+        RUN_TEST(push, split)
+        RUN_TEST(push, error)
+        RUN_TEST(push, reuse)
+    SUITE_END(push)
+    SUITE_BEG(ndjson)
+        RUN_TEST(ndjson, ordered)
+        RUN_TEST(ndjson, unordered)
+        RUN_TEST(ndjson, stop)
+        RUN_TEST(ndjson, error)
+    SUITE_END(ndjson)
+    SUITE_BEG(parallel)
+        RUN_TEST(parallel, structurals)
+        RUN_TEST(parallel, ok)
+        RUN_TEST(parallel, error)
+    SUITE_END(parallel)
+    SUITE_BEG(lazy)
+        RUN_TEST(lazy, stringify)
+        RUN_TEST(lazy, access)
+        RUN_TEST(lazy, error)
+        RUN_TEST(lazy, invalid_options)
+        RUN_TEST(lazy, ignored_options)
+    SUITE_END(lazy)
+    SUITE_BEG(query)
+        RUN_TEST(query, run)
+        RUN_TEST(query, compile)
+        RUN_TEST(query, error)
+    SUITE_END(query)
+    SUITE_BEG(pool)
+        RUN_TEST(pool, intern)
+        RUN_TEST(pool, index)
+    SUITE_END(pool)
+    SUITE_BEG(tape)
+        RUN_TEST(tape, access)
+        RUN_TEST(tape, to_value)
+        RUN_TEST(tape, error)
+    SUITE_END(tape)
+    SUITE_BEG(binary)
+        RUN_TEST(binary, roundtrip)
+        RUN_TEST(binary, encode)
+        RUN_TEST(binary, decode)
+        RUN_TEST(binary, error)
+    SUITE_END(binary)
+    SUITE_BEG(allocator)
+        RUN_TEST(allocator, global)
+        RUN_TEST(allocator, per_call)
+    SUITE_END(allocator)
+    SUITE_BEG(cache)
+        RUN_TEST(cache, text)
+        RUN_TEST(cache, lru)
+        RUN_TEST(cache, file)
+    SUITE_END(cache)
+    SUITE_BEG(equal)
+        RUN_TEST(equal, values)
+        RUN_TEST(equal, hash)
+    SUITE_END(equal)
+    SUITE_BEG(copy)
+        RUN_TEST(copy, share)
+        RUN_TEST(copy, write)
+        RUN_TEST(copy, move_swap)
+    SUITE_END(copy)
+    SUITE_BEG(depth)
+        RUN_TEST(depth, unlimited)
+        RUN_TEST(depth, default)
+        RUN_TEST(depth, limit)
+        RUN_TEST(depth, push)
+        RUN_TEST(depth, binary)
+        RUN_TEST(depth, binary_default)
+    SUITE_END(depth)
 MAIN_END